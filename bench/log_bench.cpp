@@ -0,0 +1,583 @@
+/**
+ * @brief 日志流水线基准测试
+ * @details 每项输出ns/op和allocs/op(全局operator new计数)，端到端测试另外输出
+ *          单条日志延迟的p50/p99/p99.9(ns，各线程平均)
+ *          编译: g++ -std=c++17 -O2 -I lckl bench/log_bench.cpp lckl/[a-z]*.cpp -lbenchmark -pthread -o log_bench
+ *          压缩项需要另加 -DLCKL_HAVE_ZSTD -DLCKL_HAVE_LZ4 -lzstd -llz4，否则按未压缩写入
+ */
+#include "log.h"
+#include "log_pool.h"
+#include "async_appender.h"
+#include "buffered_appender.h"
+#include "sharded_appender.h"
+#include "uring_appender.h"
+#include "compress_appender.h"
+#include "deferred_log.h"
+#include "log_limit.h"
+#include "log_metrics.h"
+#include "static_formatter.h"
+#include "util.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <thread>
+
+static std::atomic<uint64_t> s_allocs{0};
+
+//替换的operator new/delete统一用malloc/free
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+/**
+ * @brief 统计循环内的内存分配次数，结束时写入allocs/op
+ */
+class AllocCounter {
+public:
+    AllocCounter(benchmark::State& state)
+        :m_state(state)
+        ,m_begin(s_allocs.load(std::memory_order_relaxed)) {
+    }
+    ~AllocCounter() {
+        uint64_t n = s_allocs.load(std::memory_order_relaxed) - m_begin;
+        //多线程时计数是全局的，按总迭代数平均
+        m_state.counters["allocs/op"] = benchmark::Counter(
+                (double)n / m_state.threads(), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& m_state;
+    uint64_t m_begin;
+};
+
+/**
+ * @brief 延迟直方图，每个2的幂区间分为16格，误差约6%
+ */
+class LatencyHistogram {
+public:
+    void add(uint64_t ns) {
+        ++m_buckets[index(ns)];
+        ++m_count;
+    }
+    uint64_t percentile(double p) const {
+        uint64_t target = m_count * p;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            sum += m_buckets[i];
+            if (sum > target) {
+                return value(i);
+            }
+        }
+        return value(BUCKETS - 1);
+    }
+    void report(benchmark::State& state) const {
+        if (!m_count) {
+            return;
+        }
+        state.counters["p50_ns"] = benchmark::Counter(percentile(0.5), benchmark::Counter::kAvgThreads);
+        state.counters["p99_ns"] = benchmark::Counter(percentile(0.99), benchmark::Counter::kAvgThreads);
+        state.counters["p99.9_ns"] = benchmark::Counter(percentile(0.999), benchmark::Counter::kAvgThreads);
+    }
+
+private:
+    static const size_t SUB = 16;
+    static const size_t BUCKETS = 64 * SUB;
+
+    static size_t index(uint64_t v) {
+        if (v < SUB) {
+            return v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        size_t sub = (v >> (msb - 4)) & (SUB - 1);
+        return (msb - 3) * SUB + sub;
+    }
+    static uint64_t value(size_t i) {
+        if (i < SUB) {
+            return i;
+        }
+        int msb = i / SUB + 3;
+        return ((uint64_t)(SUB + i % SUB)) << (msb - 4);
+    }
+
+private:
+    uint64_t m_buckets[BUCKETS] = {0};
+    uint64_t m_count = 0;
+};
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 格式化后丢弃的Appender，只统计字节数，用于测量流水线本身
+ */
+class NullLogAppender : public lckl::LogAppender {
+public:
+    void log(const std::shared_ptr<lckl::Logger>& logger
+            ,lckl::LogLevel::Level level, const lckl::LogEvent::ptr& event) override {
+        static thread_local std::ostringstream t_os;
+        t_os.seekp(0);
+        m_formatter->format(t_os, logger, level, *event);
+        m_bytes.fetch_add(t_os.tellp(), std::memory_order_relaxed);
+    }
+    void write(const char* data, size_t len) override {
+        m_bytes.fetch_add(len, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_bytes{0};
+};
+
+lckl::Logger::ptr s_format_logger = std::make_shared<lckl::Logger>("bench");
+
+lckl::LogEvent::ptr make_event() {
+    auto event = std::make_shared<lckl::LogEvent>(s_format_logger, lckl::LogLevel::INFO
+                    ,__FILE__, __LINE__, 1234, lckl::get_thread_id(), 0, time(0), "main", 567890);
+    event->get_ss() << "request done id=" << 42 << " cost=" << 1.25 << "ms";
+    event->set_trace_id("4bf92f3577b34da6a3ce929d0e0e4736");
+    return event;
+}
+
+//----------------------------------------------------------------------------
+// 格式化器
+
+void BM_Formatter_Default(benchmark::State& state) {
+    lckl::LogFormatter formatter(lckl::DEFAULT_LOG_PATTERN);
+    formatter.set_compiled(state.range(0));
+    auto event = make_event();
+    std::ostringstream os;
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        os.seekp(0);
+        formatter.format(os, s_format_logger, lckl::LogLevel::INFO, *event);
+    }
+    state.SetLabel(state.range(0) ? "compiled" : "virtual");
+}
+BENCHMARK(BM_Formatter_Default)->Arg(0)->Arg(1);
+
+void BM_Formatter_DefaultString(benchmark::State& state) {
+    lckl::LogFormatter formatter(lckl::DEFAULT_LOG_PATTERN);
+    auto event = make_event();
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(formatter.format(s_format_logger, lckl::LogLevel::INFO, event));
+    }
+}
+BENCHMARK(BM_Formatter_DefaultString);
+
+void BM_Formatter_Static(benchmark::State& state) {
+    lckl::StaticLogFormatter<lckl::DEFAULT_LOG_PATTERN> formatter;
+    auto event = make_event();
+    std::ostringstream os;
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        os.seekp(0);
+        formatter.format(os, s_format_logger, lckl::LogLevel::INFO, *event);
+    }
+}
+BENCHMARK(BM_Formatter_Static);
+
+/**
+ * @brief 结构化输出，事件带4个字段，格式化追加到字符串
+ */
+void BM_Formatter_Structured(benchmark::State& state) {
+    lckl::LogFormatter formatter("%d%p%c%t%N%F%f%l%m%x", (lckl::LogFormatter::Style)state.range(0));
+    auto event = make_event();
+    event->with("user", 42).with("cost_ms", 1.25).with("ok", true).with("path", "/api/v1/items");
+    std::string out;
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        out.clear();
+        formatter.format(out, s_format_logger, lckl::LogLevel::INFO, *event);
+    }
+    const char* s_names[] = {"pattern", "json", "logfmt"};
+    state.SetLabel(s_names[state.range(0)]);
+}
+BENCHMARK(BM_Formatter_Structured)->DenseRange(lckl::LogFormatter::PATTERN, lckl::LogFormatter::LOGFMT);
+
+/**
+ * @brief 自身统计的开销：0只计数，1加上format耗时，2再加上每个模板项的耗时
+ */
+void BM_Formatter_Metrics(benchmark::State& state) {
+    lckl::LogFormatter formatter(lckl::DEFAULT_LOG_PATTERN);
+    auto event = make_event();
+    std::string out;
+    lckl::LogMetrics::set_timing(state.range(0) >= 1);
+    lckl::LogMetrics::set_item_timing(state.range(0) >= 2);
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        out.clear();
+        formatter.format(out, s_format_logger, lckl::LogLevel::INFO, *event);
+    }
+    lckl::LogMetrics::set_timing(false);
+    lckl::LogMetrics::set_item_timing(false);
+    const char* s_names[] = {"counters", "timing", "item_timing"};
+    state.SetLabel(s_names[state.range(0)]);
+}
+BENCHMARK(BM_Formatter_Metrics)->DenseRange(0, 2);
+
+//单个FormatItem，用只含一项的模式走虚函数路径测量
+const char* s_item_patterns[] = {
+    "%m", "%p", "%r", "%c", "%t", "%F", "%N", "%I",
+    "%d{%Y-%m-%d %H:%M:%S}", "%f", "%l", "%n", "%T", "literal"
+};
+
+void BM_FormatItem(benchmark::State& state) {
+    const char* pattern = s_item_patterns[state.range(0)];
+    lckl::LogFormatter formatter(pattern);
+    formatter.set_compiled(false);
+    auto event = make_event();
+    std::ostringstream os;
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        os.seekp(0);
+        formatter.format(os, s_format_logger, lckl::LogLevel::INFO, event);
+    }
+    state.SetLabel(pattern);
+}
+BENCHMARK(BM_FormatItem)->DenseRange(0, sizeof(s_item_patterns) / sizeof(s_item_patterns[0]) - 1);
+
+//----------------------------------------------------------------------------
+// 日志事件
+
+void BM_LogEvent_Construct(benchmark::State& state) {
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        lckl::LogEvent::ptr event(new lckl::LogEvent(s_format_logger, lckl::LogLevel::INFO
+                    ,__FILE__, __LINE__, 0, 1, 0, 0, "main"));
+        benchmark::DoNotOptimize(event.get());
+    }
+}
+BENCHMARK(BM_LogEvent_Construct);
+
+void BM_LogEvent_Create(benchmark::State& state) {
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        auto event = lckl::LogEvent::create(s_format_logger, lckl::LogLevel::INFO, __FILE__, __LINE__);
+        benchmark::DoNotOptimize(event.get());
+    }
+}
+BENCHMARK(BM_LogEvent_Create);
+
+//0:没有日志上下文 1:每次切换上下文并带跟踪id
+void BM_LogEvent_Context(benchmark::State& state) {
+    lckl::LogContext context(7);
+    context.set_trace_id("4bf92f3577b34da6a3ce929d0e0e4736");
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        if (state.range(0)) {
+            lckl::set_log_context(&context);
+        }
+        auto event = lckl::LogEvent::create(s_format_logger, lckl::LogLevel::INFO, __FILE__, __LINE__);
+        benchmark::DoNotOptimize(event.get());
+        lckl::set_log_context(nullptr);
+    }
+}
+BENCHMARK(BM_LogEvent_Context)->Arg(0)->Arg(1);
+
+void BM_LogEvent_Format(benchmark::State& state) {
+    auto event = make_event();
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        event->get_ss().clear();
+        event->format("user=%s id=%d cost=%.3f", "alice", 12345, 0.125);
+    }
+}
+BENCHMARK(BM_LogEvent_Format);
+
+void BM_LogEvent_Stream(benchmark::State& state) {
+    auto event = make_event();
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        event->get_ss().clear();
+        event->get_ss() << "user=" << "alice" << " id=" << 12345 << " cost=" << 0.125;
+    }
+}
+BENCHMARK(BM_LogEvent_Stream);
+
+//----------------------------------------------------------------------------
+// 日志器查找
+
+void BM_LoggerLookup(benchmark::State& state) {
+    for (int i = 0; i < 100; ++i) {
+        LCKL_LOG_NAME("bench.lookup." + std::to_string(i));
+    }
+    std::string name = "bench.lookup.42";
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(LCKL_LOG_NAME(name));
+    }
+}
+BENCHMARK(BM_LoggerLookup)->Threads(1)->Threads(4);
+
+void BM_LoggerLookupCached(benchmark::State& state) {
+    AllocCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(LCKL_LOG_NAME_CACHED("bench.lookup.42").get());
+    }
+}
+BENCHMARK(BM_LoggerLookupCached)->Threads(1)->Threads(4);
+
+//----------------------------------------------------------------------------
+// 端到端
+
+void BM_Disabled(benchmark::State& state) {
+    static auto logger = std::make_shared<lckl::Logger>("disabled");
+    logger->set_level(lckl::LogLevel::ERROR);
+    for (auto _ : state) {
+        LCKL_LOG_DEBUG(logger) << "never " << 1;
+    }
+}
+BENCHMARK(BM_Disabled);
+
+/**
+ * @brief 被限流丢弃的日志，只有调用点计数
+ */
+void BM_Limited(benchmark::State& state) {
+    static auto logger = []() {
+        auto l = std::make_shared<lckl::Logger>("limited");
+        l->add_appender(std::make_shared<NullLogAppender>());
+        return l;
+    }();
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            LCKL_LOG_EVERY_N(logger, lckl::LogLevel::ERROR, 1000000000) << "hot loop failure " << 1;
+        } else {
+            LCKL_LOG_RATE_LIMIT(logger, lckl::LogLevel::ERROR, 1) << "hot loop failure " << 1;
+        }
+    }
+    state.SetLabel(state.range(0) == 0 ? "every_n" : "rate_limit");
+}
+BENCHMARK(BM_Limited)->Arg(0)->Arg(1)->Threads(1)->Threads(4);
+
+/**
+ * @brief 模板不含%m时，流式日志与惰性日志构造消息的开销
+ */
+void BM_LazyMessage(benchmark::State& state) {
+    static auto logger = []() {
+        auto l = std::make_shared<lckl::Logger>("lazy");
+        auto appender = std::make_shared<NullLogAppender>();
+        appender->set_formatter(std::make_shared<lckl::LogFormatter>("%d%T%p%T%c%n"));
+        l->add_appender(appender);
+        return l;
+    }();
+    std::vector<int> values(64, 42);
+    auto dump = [&values]() {
+        std::string str;
+        for (int v : values) {
+            str += std::to_string(v);
+            str += ',';
+        }
+        return str;
+    };
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            LCKL_LOG_INFO(logger) << "values=" << dump();
+        } else {
+            LCKL_LOG_LAZY_INFO(logger, "values=", dump);
+        }
+    }
+    state.SetLabel(state.range(0) == 0 ? "stream" : "lazy");
+}
+BENCHMARK(BM_LazyMessage)->Arg(0)->Arg(1);
+
+enum SinkType {
+    SINK_NULL = 0,
+    SINK_FILE,
+    SINK_ASYNC,
+    SINK_BUFFERED,
+    SINK_DEFERRED,
+    SINK_SHARDED,
+    SINK_SHARDED_ORDERED,
+    SINK_URING,
+    SINK_ZSTD,
+    SINK_LZ4,
+    SINK_COUNT
+};
+
+const char* s_sink_names[] = {"null", "file", "async", "buffered", "deferred"
+                             ,"sharded", "sharded_ordered", "uring", "zstd", "lz4"};
+
+lckl::Logger::ptr get_sink_logger(int type) {
+    static lckl::Logger::ptr s_loggers[SINK_COUNT];
+    static std::once_flag s_flags[SINK_COUNT];
+    std::call_once(s_flags[type], [type]() {
+        auto logger = std::make_shared<lckl::Logger>(s_sink_names[type]);
+        switch (type) {
+        case SINK_NULL:
+        case SINK_DEFERRED:
+            logger->add_appender(std::make_shared<NullLogAppender>());
+            break;
+        case SINK_FILE:
+            logger->add_appender(std::make_shared<lckl::FileLogAppender>("/dev/null"));
+            break;
+        case SINK_ASYNC: {
+            auto sink = std::make_shared<lckl::FileLogAppender>("/dev/null");
+            sink->set_formatter(logger->get_formatter());
+            logger->add_appender(std::make_shared<lckl::AsyncLogAppender>(sink));
+            break;
+        }
+        case SINK_BUFFERED:
+            logger->add_appender(std::make_shared<lckl::BufferedFileLogAppender>("/dev/null"));
+            break;
+        case SINK_SHARDED:
+        case SINK_SHARDED_ORDERED: {
+            auto sink = std::make_shared<lckl::FileLogAppender>("/dev/null");
+            sink->set_formatter(logger->get_formatter());
+            logger->add_appender(std::make_shared<lckl::ShardedLogAppender>(sink, 4096
+                                ,lckl::ShardedLogAppender::BLOCK, type == SINK_SHARDED_ORDERED));
+            break;
+        }
+        case SINK_URING:
+            logger->add_appender(std::make_shared<lckl::UringFileLogAppender>("/dev/null"));
+            break;
+        case SINK_ZSTD:
+        case SINK_LZ4:
+            logger->add_appender(std::make_shared<lckl::CompressedFileLogAppender>("/dev/null"
+                                ,type == SINK_ZSTD ? lckl::LogCompressor::ZSTD : lckl::LogCompressor::LZ4));
+            break;
+        }
+        s_loggers[type] = logger;
+    });
+    return s_loggers[type];
+}
+
+void BM_Throughput(benchmark::State& state) {
+    int type = state.range(0);
+    auto logger = get_sink_logger(type);
+    LatencyHistogram hist;
+    {
+        AllocCounter counter(state);
+        int64_t i = 0;
+        for (auto _ : state) {
+            uint64_t begin = now_ns();
+            if (type == SINK_DEFERRED) {
+                LCKL_LOG_DEFERRED_INFO(logger, "request done id=%lld cost=%fms", (long long)i, 1.25);
+            } else {
+                LCKL_LOG_INFO(logger) << "request done id=" << i << " cost=" << 1.25 << "ms";
+            }
+            hist.add(now_ns() - begin);
+            ++i;
+        }
+    }
+    if (state.thread_index() == 0) {
+        state.SetLabel(s_sink_names[type]);
+    }
+    hist.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Throughput)->DenseRange(SINK_NULL, SINK_DEFERRED)->DenseRange(SINK_URING, SINK_LZ4)
+    ->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+
+/**
+ * @brief 共享队列和分片队列随生产者线程数的扩展性
+ * @details items_per_second为所有线程合计的吞吐，分片队列应随线程数持平或上升
+ */
+void BM_Scaling(benchmark::State& state) {
+    int type = state.range(0);
+    auto logger = get_sink_logger(type);
+    int64_t i = 0;
+    for (auto _ : state) {
+        LCKL_LOG_INFO(logger) << "request done id=" << i << " cost=" << 1.25 << "ms";
+        ++i;
+    }
+    if (state.thread_index() == 0) {
+        state.SetLabel(s_sink_names[type]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Scaling)->Arg(SINK_ASYNC)->Arg(SINK_SHARDED)->Arg(SINK_SHARDED_ORDERED)
+    ->Threads(1)->Threads(2)->Threads(4)->Threads(8)->Threads(16)
+    ->Threads(32)->Threads(64)->Threads(96)->UseRealTime();
+
+/**
+ * @brief 配置不断变化时的日志吞吐
+ * @details storm时后台线程循环增删Appender、修改Appender级别和整体替换路由，
+ *          日志路径只读取原子替换的路由表，吞吐应与idle持平
+ */
+void BM_Reconfigure(benchmark::State& state) {
+    static auto logger = []() {
+        auto l = std::make_shared<lckl::Logger>("reconfigure");
+        l->add_appender(std::make_shared<NullLogAppender>());
+        return l;
+    }();
+    static std::atomic<bool> s_stop{false};
+    static std::atomic<uint64_t> s_reconfigs{0};
+    static std::thread s_storm;
+    if (state.thread_index() == 0 && state.range(0)) {
+        s_stop.store(false);
+        s_reconfigs.store(0);
+        s_storm = std::thread([]() {
+            auto extra = std::make_shared<NullLogAppender>();
+            while (!s_stop.load(std::memory_order_relaxed)) {
+                logger->add_appender(extra, lckl::LogLevel::ERROR);
+                logger->set_appender_level(extra, lckl::LogLevel::FATAL);
+                logger->del_appender(extra);
+                logger->set_routes(logger->get_routes());
+                s_reconfigs.fetch_add(4, std::memory_order_relaxed);
+            }
+        });
+    }
+    int64_t i = 0;
+    for (auto _ : state) {
+        LCKL_LOG_INFO(logger) << "request done id=" << i << " cost=" << 1.25 << "ms";
+        ++i;
+    }
+    if (state.thread_index() == 0) {
+        if (state.range(0)) {
+            s_stop.store(true);
+            s_storm.join();
+            state.counters["reconfigs"] = benchmark::Counter(s_reconfigs.load(), benchmark::Counter::kIsRate);
+        }
+        state.SetLabel(state.range(0) ? "storm" : "idle");
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reconfigure)->Arg(0)->Arg(1)->Threads(1)->Threads(4)->UseRealTime();
+
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    lckl::DeferredLogBackend::flush();
+    benchmark::Shutdown();
+    auto stats = lckl::LogEventPool::get_stats();
+    printf("LogEventPool created=%llu acquired=%llu\n"
+          ,(unsigned long long)stats.created, (unsigned long long)stats.acquired);
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "async_appender.h"
+#include "log_crash.h"
+#include "log_metrics.h"
+#include <chrono>
+
+namespace lckl {
+
+//后台线程单次写出的最大记录数
+static const size_t s_max_batch = 1024;
+//每个线程缓存的格式化器数量
+static const size_t s_formatter_cache_size = 8;
+
+namespace {
+
+/**
+ * @brief 调用线程缓存的格式化器，按Appender的id直接映射
+ * @details 版本不变时不必加锁获取格式化器，生产者之间不在入队前争用同一把锁
+ */
+struct FormatterCache {
+    uint64_t id = 0;
+    uint32_t version = 0;
+    LogFormatter::ptr formatter;
+};
+
+thread_local FormatterCache t_formatters[s_formatter_cache_size];
+
+}
+
+AsyncLogAppender::AsyncLogAppender(LogAppender::ptr sink, size_t capacity
+                                  ,OverflowPolicy policy, bool deferred)
+    :m_sink(sink)
+    ,m_policy(policy)
+    ,m_deferred(deferred)
+    ,m_id(LogContext::new_key())
+    ,m_queue(capacity) {
+    LogAppender::set_formatter(sink->get_formatter());
+    m_thread = std::thread(&AsyncLogAppender::run, this);
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    stop();
+}
+
+void AsyncLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    if (m_deferred) {
+        //跨线程交给后台线程，此时才持有日志器的引用
+        push([&](Record& r) {
+            r.logger = logger->shared_from_this();
+            r.level = level;
+            r.event = event;
+            if (event->get_logger() != logger.get()) {
+                r.source = event->get_logger()->shared_from_this();
+            }
+        });
+        return;
+    }
+    uint32_t version = get_formatter_version();
+    FormatterCache& cache = t_formatters[m_id % s_formatter_cache_size];
+    if (cache.id != m_id || cache.version != version) {
+        cache.formatter = get_formatter();
+        cache.id = m_id;
+        cache.version = version;
+    }
+    //入队时下游只调用write，不会替换缓存中的格式化器
+    LogFormatter* formatter = cache.formatter.get();
+    if (!formatter) {
+        return;
+    }
+    //直接格式化到槽位的字符串中，复用其已申请的内存
+    push([&](Record& r) {
+        r.text.clear();
+        formatter->format(r.text, logger, level, *event);
+    });
+}
+
+void AsyncLogAppender::write(const char* data, size_t len) {
+    push([&](Record& r) {
+        r.text.assign(data, len);
+    });
+}
+
+template<class F>
+void AsyncLogAppender::push(F&& f) {
+    uint64_t begin = LogMetrics::timer_begin();
+    for (int spin = 0; ; ++spin) {
+        if (m_stopping.load(std::memory_order_acquire)) {
+            Record r;
+            f(r);
+            write_direct(r);
+            return;
+        }
+        if (m_queue.push(f)) {
+            break;
+        }
+        if (m_policy == DROP_NEWEST) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            LogMetrics::add(LogMetrics::DROPPED);
+            return;
+        } else if (m_policy == DROP_OLDEST) {
+            if (m_queue.pop([](Record& r) {
+                    r.logger.reset();
+                    r.event.reset();
+                    r.source.reset();
+                    r.text.clear();
+                })) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                LogMetrics::add(LogMetrics::DROPPED);
+            }
+        } else if (spin < 64) {
+            std::this_thread::yield();
+        } else {
+            m_waiters.fetch_add(1);
+            wake_consumer();
+            {
+                std::unique_lock<std::mutex> lock(m_wait_mutex);
+                m_producer_cond.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            m_waiters.fetch_sub(1);
+        }
+    }
+    LogMetrics::add(LogMetrics::ENQUEUED);
+    LogMetrics::timer_end(LogMetrics::ENQUEUE_NS, begin);
+    //与后台线程设置m_sleeping、stop设置m_stopping配对，保证不会丢失唤醒和记录
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        wake_consumer();
+    }
+    if (m_stopping.load(std::memory_order_relaxed)) {
+        //入队前还未停止，stop的最后一次drain可能已经错过这条记录
+        drain_direct();
+    }
+}
+
+void AsyncLogAppender::drain_direct() {
+    bool written = false;
+    Record record;
+    while (m_queue.pop([&](Record& r) {
+                record.logger.swap(r.logger);
+                record.level = r.level;
+                record.event.swap(r.event);
+                record.source.swap(r.source);
+                record.text.swap(r.text);
+                r.text.clear();
+            })) {
+        write_direct(record);
+        record.logger.reset();
+        record.event.reset();
+        record.source.reset();
+        written = true;
+    }
+    if (written) {
+        m_sink->flush();
+    }
+}
+
+void AsyncLogAppender::write_direct(const Record& record) {
+    if (record.event) {
+        m_sink->log(record.logger, record.level, record.event);
+    } else {
+        m_sink->write(record.text.data(), record.text.size());
+    }
+}
+
+void AsyncLogAppender::flush() {
+    size_t target = m_queue.get_enqueue_pos();
+    m_waiters.fetch_add(1);
+    while (m_done_pos.load(std::memory_order_acquire) < target
+            && !m_stopping.load(std::memory_order_acquire)) {
+        wake_consumer();
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_producer_cond.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    m_waiters.fetch_sub(1);
+    m_sink->flush();
+}
+
+void AsyncLogAppender::crash_flush() {
+    //下游缓冲中的日志比队列中的早
+    LogCrashHandler::flush_appender(m_sink.get());
+    //后台线程已出队、尚未写给下游的一批
+    if (!m_batch.empty()) {
+        m_sink->crash_write(m_batch.data(), m_batch.size());
+    }
+    m_queue.for_each([this](const Record& r) {
+        if (r.event) {
+            LogCrashHandler::Line line;
+            LogCrashHandler::format_event(line, r.level, *r.event);
+            m_sink->crash_write(line.data(), line.size());
+        } else if (!r.text.empty()) {
+            m_sink->crash_write(r.text.data(), r.text.size());
+        }
+    });
+}
+
+void AsyncLogAppender::crash_write(const char* data, size_t len) {
+    m_sink->crash_write(data, len);
+}
+
+bool AsyncLogAppender::needs_message() const {
+    return m_deferred ? m_sink->needs_message() : LogAppender::needs_message();
+}
+
+void AsyncLogAppender::on_exit() {
+    flush();
+    m_sink->on_exit();
+}
+
+void AsyncLogAppender::set_formatter(LogFormatter::ptr val) {
+    LogAppender::set_formatter(val);
+    if (!m_deferred) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    LogFormatter::ptr current = m_sink->get_formatter();
+    if (!current || current == m_sink_formatter) {
+        m_sink->set_formatter(val);
+        m_sink_formatter = val;
+    }
+}
+
+void AsyncLogAppender::stop() {
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    //与push入队后检查m_stopping配对：要么这里能取到记录，要么生产者自己写出
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_consumer();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    //后台线程退出前仍在入队的记录，占用了槽位还未写完的记录由其生产者写出
+    while (drain()) {
+    }
+    m_sink->flush();
+}
+
+void AsyncLogAppender::wake_consumer() {
+    std::lock_guard<std::mutex> lock(m_wait_mutex);
+    m_consumer_cond.notify_one();
+}
+
+size_t AsyncLogAppender::drain() {
+    if (size_t depth = m_queue.size()) {
+        LogMetrics::record(LogMetrics::QUEUE_DEPTH, depth);
+    }
+    size_t n = 0;
+    Record record;
+    m_batch.clear();
+    while (n < s_max_batch && m_queue.pop([&](Record& r) {
+                if (r.event) {
+                    record.logger.swap(r.logger);
+                    record.level = r.level;
+                    record.event.swap(r.event);
+                    record.source.swap(r.source);
+                } else {
+                    m_batch.append(r.text);
+                    r.text.clear();
+                }
+            })) {
+        ++n;
+        if (record.event) {
+            //保持顺序，先写出之前合并的文本
+            if (!m_batch.empty()) {
+                m_sink->write(m_batch.data(), m_batch.size());
+                m_batch.clear();
+            }
+            m_sink->log(record.logger, record.level, record.event);
+            record.logger.reset();
+            record.event.reset();
+            record.source.reset();
+        }
+    }
+    if (!m_batch.empty()) {
+        m_sink->write(m_batch.data(), m_batch.size());
+        //写出后清空，崩溃时非空的m_batch一定是尚未写出的
+        m_batch.clear();
+    }
+    m_done_pos.store(m_queue.get_dequeue_pos(), std::memory_order_release);
+    if (m_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_wait_mutex);
+        m_producer_cond.notify_all();
+    }
+    return n;
+}
+
+void AsyncLogAppender::run() {
+    for (;;) {
+        if (drain()) {
+            continue;
+        }
+        m_sink->on_tick();
+        if (m_stopping.load(std::memory_order_acquire)) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_queue.empty() && !m_stopping.load(std::memory_order_acquire)) {
+            m_consumer_cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+}
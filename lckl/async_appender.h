@@ -0,0 +1,275 @@
+#ifndef __ASYNC_APPENDER_H__
+#define __ASYNC_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace lckl {
+
+/**
+ * @brief 有界无锁多生产者队列(Vyukov)
+ * @details 每个槽位带序号，生产者通过CAS占用写入位置。
+ *          正常只有后台线程出队，DROP_OLDEST策略下生产者也会出队丢弃最旧的记录
+ */
+template<class T>
+class LogRingBuffer {
+public:
+    /**
+     * @brief Construct a new Log Ring Buffer object
+     *
+     * @param capacity 容量，向上取整为2的幂
+     */
+    LogRingBuffer(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        m_mask = n - 1;
+        m_cells = std::vector<Cell>(n);
+        for (size_t i = 0; i < n; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 入队，队列满时返回false
+     * @param f 在占用的槽位上写入数据 void(T&)
+     */
+    template<class F>
+    bool push(F&& f) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        f(cell->data);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 出队，队列空时返回false
+     * @param f 读取槽位上的数据 void(T&)
+     */
+    template<class F>
+    bool pop(F&& f) {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        f(cell->data);
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 依次访问队列中已写入的记录，不出队
+     * @details 只用于崩溃时写出，不与生产者和消费者同步，结果是尽力而为的
+     * @param f 读取槽位上的数据 void(const T&)
+     */
+    template<class F>
+    void for_each(F&& f) const {
+        size_t end = m_enqueue_pos.load(std::memory_order_acquire);
+        for (size_t pos = m_dequeue_pos.load(std::memory_order_acquire); pos != end; ++pos) {
+            const Cell& cell = m_cells[pos & m_mask];
+            if (cell.seq.load(std::memory_order_acquire) == pos + 1) {
+                f(cell.data);
+            }
+        }
+    }
+
+    /**
+     * @brief 已占用的入队位置总数
+     */
+    size_t get_enqueue_pos() const { return m_enqueue_pos.load(std::memory_order_acquire); }
+    /**
+     * @brief 已占用的出队位置总数
+     */
+    size_t get_dequeue_pos() const { return m_dequeue_pos.load(std::memory_order_acquire); }
+    /**
+     * @brief 队列中的记录数(近似值)
+     */
+    size_t size() const {
+        size_t e = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t d = m_dequeue_pos.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+        Cell() : seq(0) {}
+        Cell(Cell&& o) : seq(o.seq.load()), data(std::move(o.data)) {}
+    };
+
+    std::vector<Cell> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_enqueue_pos{0};
+    alignas(64) std::atomic<size_t> m_dequeue_pos{0};
+};
+
+/**
+ * @brief 异步日志输出器
+ * @details 调用线程只把记录放入有界无锁队列，由后台线程批量写入下游Appender。
+ *          记录可以在调用线程格式化为文本，也可以保存事件由后台线程格式化
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    /**
+     * @brief 队列满时的处理策略
+     */
+    enum OverflowPolicy {
+        //等待队列有空位
+        BLOCK = 0,
+        //丢弃新的记录
+        DROP_NEWEST,
+        //丢弃最旧的记录
+        DROP_OLDEST
+    };
+
+    /**
+     * @brief Construct a new Async Log Appender object
+     *
+     * @param sink 下游Appender，只由后台线程调用
+     * @param capacity 队列容量
+     * @param policy 队列满时的处理策略
+     * @param deferred 为true时由后台线程格式化，否则在调用线程格式化
+     */
+    AsyncLogAppender(LogAppender::ptr sink, size_t capacity = 8192
+                    ,OverflowPolicy policy = BLOCK, bool deferred = false);
+    ~AsyncLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 等待调用前入队的记录全部写入下游，并刷新下游
+     */
+    void flush() override;
+    /**
+     * @brief deferred模式下由下游格式化，取决于下游
+     */
+    bool needs_message() const override;
+    /**
+     * @brief deferred模式下由下游格式化，下游没有自己的格式化器时一并设置给下游
+     */
+    void set_formatter(LogFormatter::ptr val) override;
+    /**
+     * @brief 写完队列中的记录后调用下游的on_exit
+     */
+    void on_exit() override;
+    /**
+     * @brief 先写出下游的缓冲，再把队列中的记录交给下游的crash_write
+     * @details deferred模式下的事件按LogCrashHandler的固定格式输出
+     */
+    void crash_flush() override;
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 写完剩余记录后停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 丢弃的记录数
+     */
+    uint64_t get_dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    /**
+     * @brief 队列中的记录数
+     */
+    size_t get_queue_size() const { return m_queue.size(); }
+    LogAppender::ptr get_sink() const { return m_sink; }
+    OverflowPolicy get_policy() const { return m_policy; }
+
+private:
+    /**
+     * @brief 队列中的一条记录
+     */
+    struct Record {
+        std::shared_ptr<Logger> logger;
+        LogLevel::Level level = LogLevel::UNKNOWN;
+        //deferred模式下的事件
+        LogEvent::ptr event;
+        //事件不持有创建它的日志器，由后台线程格式化时在此保持其有效
+        std::shared_ptr<Logger> source;
+        //已格式化的日志文本
+        std::string text;
+    };
+
+    template<class F>
+    void push(F&& f);
+    /**
+     * @brief 后台线程已停止时直接写入下游
+     */
+    void write_direct(const Record& record);
+    /**
+     * @brief 停止后由生产者取出队列中剩余的记录直接写入下游并刷新
+     */
+    void drain_direct();
+    void run();
+    /**
+     * @brief 后台线程写出一批记录，返回记录数
+     */
+    size_t drain();
+    void wake_consumer();
+
+private:
+    LogAppender::ptr m_sink;
+    OverflowPolicy m_policy;
+    bool m_deferred;
+    //用于区分调用线程缓存的格式化器属于哪个Appender
+    uint64_t m_id;
+    LogRingBuffer<Record> m_queue;
+    //deferred模式下设置给下游的格式化器，下游的格式化器不是它时说明下游有自己的格式化器
+    LogFormatter::ptr m_sink_formatter;
+
+    //此位置之前的记录都已写出或丢弃，用于flush
+    std::atomic<size_t> m_done_pos{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_stopping{false};
+    //后台线程是否在等待
+    std::atomic<bool> m_sleeping{false};
+    //等待中的生产者/flush调用数
+    std::atomic<int> m_waiters{0};
+
+    std::mutex m_wait_mutex;
+    std::condition_variable m_consumer_cond;
+    std::condition_variable m_producer_cond;
+    std::thread m_thread;
+    //后台线程的批量写缓冲
+    std::string m_batch;
+};
+
+}
+
+#endif // !__ASYNC_APPENDER_H__
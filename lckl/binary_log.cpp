@@ -0,0 +1,458 @@
+#include "binary_log.h"
+#include "deferred_log.h"
+#include "log_crash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace lckl {
+
+namespace binary_log {
+
+namespace {
+
+template<class T>
+bool read_raw(const char*& p, const char* end, T& v) {
+    if (p + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+bool get_varint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t c = *p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+bool pack_args(std::string& out, const char* types, const char* args, size_t len) {
+    const char* p = args;
+    const char* end = args + len;
+    for (; *types; ++types) {
+        switch (*types) {
+#define XX(code, type, expr) \
+        case code: { \
+            type v; \
+            if (!read_raw(p, end, v)) { \
+                return false; \
+            } \
+            expr; \
+            break; \
+        }
+        XX('i', int32_t, put_varint(out, zigzag(v)));
+        XX('I', int64_t, put_varint(out, zigzag(v)));
+        XX('u', uint32_t, put_varint(out, v));
+        XX('U', uint64_t, put_varint(out, v));
+        XX('p', uint64_t, put_varint(out, v));
+        XX('d', double, out.append((const char*)&v, sizeof(v)));
+        XX('D', long double, out.append((const char*)&v, sizeof(v)));
+#undef XX
+        case 's': {
+            uint32_t n;
+            if (!read_raw(p, end, n) || p + n > end) {
+                return false;
+            }
+            put_varint(out, n);
+            out.append(p, n);
+            p += n;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool unpack_args(std::string& out, const char* types, const char* data, size_t len) {
+    const char* p = data;
+    const char* end = data + len;
+    uint64_t v;
+    for (; *types; ++types) {
+        switch (*types) {
+#define XX(code, type, expr) \
+        case code: { \
+            if (!get_varint(p, end, v)) { \
+                return false; \
+            } \
+            type s = (type)(expr); \
+            out.append((const char*)&s, sizeof(s)); \
+            break; \
+        }
+        XX('i', int32_t, unzigzag(v));
+        XX('I', int64_t, unzigzag(v));
+        XX('u', uint32_t, v);
+        XX('U', uint64_t, v);
+        XX('p', uint64_t, v);
+#undef XX
+        case 'd':
+        case 'D': {
+            size_t n = *types == 'd' ? sizeof(double) : sizeof(long double);
+            if (p + n > end) {
+                return false;
+            }
+            out.append(p, n);
+            p += n;
+            break;
+        }
+        case 's': {
+            if (!get_varint(p, end, v) || v > (uint64_t)(end - p)) {
+                return false;
+            }
+            uint32_t n = v;
+            out.append((const char*)&n, sizeof(n));
+            out.append(p, n);
+            p += n;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return p == end;
+}
+
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string& filename, size_t buffer_size)
+    :m_filename(filename)
+    ,m_buffer_size(buffer_size) {
+    m_buffer.reserve(buffer_size + 4096);
+    reopen();
+}
+
+BinaryLogAppender::~BinaryLogAppender() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_buffer();
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+uint32_t BinaryLogAppender::get_string_id(const char* str, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    auto it = m_strings.find(std::string(str, len));
+    if (it != m_strings.end()) {
+        return it->second;
+    }
+    uint32_t id = m_strings.size() + 1;
+    m_strings.emplace(std::string(str, len), id);
+    m_buffer.push_back((char)binary_log::STRING);
+    binary_log::put_varint(m_buffer, id);
+    binary_log::put_varint(m_buffer, len);
+    m_buffer.append(str, len);
+    return id;
+}
+
+uint32_t BinaryLogAppender::get_static_id(const char* str) {
+    if (!str || !*str) {
+        return 0;
+    }
+    auto it = m_static_ids.find(str);
+    if (it != m_static_ids.end() && *it->second.second == str) {
+        return it->second.first;
+    }
+    uint32_t id = get_string_id(str, strlen(str));
+    m_static_ids[str] = std::make_pair(id, &m_strings.find(str)->first);
+    return id;
+}
+
+void BinaryLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    //与文本格式的%c一致，取事件所属的日志器而不是转发到此的日志器
+    const std::string& name = event->get_logger()->get_name();
+    const std::string& threadname = event->get_threadname();
+    uint64_t time = event->get_time() * 1000000 + event->get_usec();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t logger_id = get_static_id(name.c_str());
+    uint32_t threadname_id = get_static_id(threadname.c_str());
+    uint32_t file_id = get_static_id(event->get_file());
+    uint32_t fmt_id = 0;
+    uint32_t types_id = 0;
+    if (event->get_fmt()) {
+        fmt_id = get_static_id(event->get_fmt());
+        types_id = get_static_id(event->get_arg_types());
+    }
+
+    std::string_view trace_id = event->get_trace_id();
+    if (!trace_id.empty()) {
+        m_buffer.push_back((char)binary_log::TRACE);
+        binary_log::put_varint(m_buffer, trace_id.size());
+        m_buffer.append(trace_id.data(), trace_id.size());
+    }
+    m_buffer.push_back((char)binary_log::RECORD);
+    m_buffer.push_back((char)level);
+    binary_log::put_varint(m_buffer, binary_log::zigzag((int64_t)(time - m_last_time)));
+    m_last_time = time;
+    binary_log::put_varint(m_buffer, event->get_elapse());
+    binary_log::put_varint(m_buffer, event->get_threadid());
+    binary_log::put_varint(m_buffer, event->get_fiberid());
+    binary_log::put_varint(m_buffer, logger_id);
+    binary_log::put_varint(m_buffer, threadname_id);
+    binary_log::put_varint(m_buffer, file_id);
+    binary_log::put_varint(m_buffer, (uint32_t)event->get_line());
+
+    bool packed = false;
+    if (fmt_id) {
+        //参数不完整时退回文本消息
+        std::string_view args = event->get_args();
+        m_packed.clear();
+        packed = binary_log::pack_args(m_packed, event->get_arg_types()
+                                      ,args.data(), args.size());
+        if (packed) {
+            binary_log::put_varint(m_buffer, fmt_id);
+            binary_log::put_varint(m_buffer, types_id);
+            binary_log::put_varint(m_buffer, m_packed.size());
+            m_buffer.append(m_packed);
+        }
+    }
+    if (!packed) {
+        std::string_view content = event->get_content_view();
+        binary_log::put_varint(m_buffer, 0);
+        binary_log::put_varint(m_buffer, content.size());
+        m_buffer.append(content.data(), content.size());
+    }
+    if (m_buffer.size() >= m_buffer_size) {
+        flush_buffer();
+    }
+}
+
+void BinaryLogAppender::write(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.push_back((char)binary_log::RAW);
+    binary_log::put_varint(m_buffer, len);
+    m_buffer.append(data, len);
+    if (m_buffer.size() >= m_buffer_size) {
+        flush_buffer();
+    }
+}
+
+void BinaryLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_buffer();
+}
+
+void BinaryLogAppender::crash_flush() {
+    LogCrashHandler::write_fd(m_fd, m_buffer.data(), m_buffer.size());
+}
+
+void BinaryLogAppender::crash_write(const char* data, size_t len) {
+    char head[1 + 10];
+    size_t n = 0;
+    head[n++] = (char)binary_log::RAW;
+    uint64_t v = len;
+    while (v >= 0x80) {
+        head[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    head[n++] = (char)v;
+    LogCrashHandler::write_fd(m_fd, head, n);
+    LogCrashHandler::write_fd(m_fd, data, len);
+}
+
+void BinaryLogAppender::flush_buffer() {
+    const char* p = m_buffer.data();
+    size_t left = m_buffer.size();
+    while (left > 0 && m_fd != -1) {
+        ssize_t rt = ::write(m_fd, p, left);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        m_written.fetch_add(rt, std::memory_order_relaxed);
+        p += rt;
+        left -= rt;
+    }
+    m_buffer.clear();
+}
+
+bool BinaryLogAppender::reopen() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_buffer();
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    //新的一段，字符串表和时间基准重新开始
+    m_strings.clear();
+    m_static_ids.clear();
+    m_last_time = 0;
+    m_buffer.append(binary_log::MAGIC, sizeof(binary_log::MAGIC));
+    return m_fd != -1;
+}
+
+BinaryLogReader::BinaryLogReader(std::istream& is)
+    :m_is(is) {
+}
+
+bool BinaryLogReader::read_varint(uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = m_is.get();
+        if (c == EOF) {
+            m_error = true;
+            return false;
+        }
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    m_error = true;
+    return false;
+}
+
+bool BinaryLogReader::read_bytes(std::string& out, size_t len) {
+    out.resize(len);
+    if (len && !m_is.read(&out[0], len)) {
+        m_error = true;
+        return false;
+    }
+    return true;
+}
+
+const std::string* BinaryLogReader::get_string(uint64_t id) {
+    if (id >= m_strings.size()) {
+        m_error = true;
+        return nullptr;
+    }
+    return &m_strings[id];
+}
+
+bool BinaryLogReader::read_segment_header() {
+    char buf[sizeof(binary_log::MAGIC) - 1];
+    if (!m_is.read(buf, sizeof(buf)) || memcmp(buf, binary_log::MAGIC + 1, sizeof(buf))) {
+        m_error = true;
+        return false;
+    }
+    m_strings.clear();
+    m_strings.emplace_back();
+    m_last_time = 0;
+    m_trace_id.clear();
+    return true;
+}
+
+bool BinaryLogReader::next(Entry& entry) {
+    while (!m_error) {
+        int tag = m_is.get();
+        if (tag == EOF) {
+            return false;
+        }
+        if (tag == binary_log::MAGIC[0]) {
+            read_segment_header();
+            continue;
+        }
+        if (m_strings.empty()) {
+            //文件不是以段头开始
+            m_error = true;
+            return false;
+        }
+        uint64_t v, len;
+        switch (tag) {
+        case binary_log::STRING: {
+            if (!read_varint(v) || !read_varint(len)) {
+                return false;
+            }
+            if (v != m_strings.size()) {
+                m_error = true;
+                return false;
+            }
+            m_strings.emplace_back();
+            if (!read_bytes(m_strings.back(), len)) {
+                return false;
+            }
+            break;
+        }
+        case binary_log::TRACE:
+            if (!read_varint(len) || len > LogContext::TRACE_ID_SIZE) {
+                m_error = true;
+                return false;
+            }
+            if (!read_bytes(m_trace_id, len)) {
+                return false;
+            }
+            break;
+        case binary_log::RAW:
+            entry.raw = true;
+            entry.fmt = entry.types = nullptr;
+            entry.trace_id.clear();
+            return read_varint(len) && read_bytes(entry.text, len);
+        case binary_log::RECORD: {
+            entry.raw = false;
+            entry.trace_id.swap(m_trace_id);
+            m_trace_id.clear();
+            int level = m_is.get();
+            uint64_t f[8];
+            for (auto& i : f) {
+                if (!read_varint(i)) {
+                    return false;
+                }
+            }
+            entry.level = (LogLevel::Level)level;
+            m_last_time += binary_log::unzigzag(f[0]);
+            entry.time = m_last_time;
+            entry.elapse = f[1];
+            entry.threadid = f[2];
+            entry.fiberid = f[3];
+            entry.logger = get_string(f[4]);
+            entry.threadname = get_string(f[5]);
+            entry.file = get_string(f[6]);
+            entry.line = (int32_t)f[7];
+            if (m_error || !read_varint(v)) {
+                return false;
+            }
+            if (v == 0) {
+                entry.fmt = entry.types = nullptr;
+                entry.args.clear();
+                return read_varint(len) && read_bytes(entry.text, len);
+            }
+            entry.fmt = get_string(v);
+            if (!read_varint(v) || !(entry.types = get_string(v))
+                    || !read_varint(len) || !read_bytes(m_packed, len)) {
+                return false;
+            }
+            entry.args.clear();
+            entry.text.clear();
+            if (!binary_log::unpack_args(entry.args, entry.types->c_str()
+                                        ,m_packed.data(), m_packed.size())) {
+                m_error = true;
+                return false;
+            }
+            return true;
+        }
+        default:
+            m_error = true;
+            return false;
+        }
+    }
+    return false;
+}
+
+void BinaryLogReader::format_message(LogStream& out, const Entry& entry) {
+    if (entry.fmt) {
+        DeferredLogBackend::format_message(out, entry.fmt->c_str(), entry.types->c_str()
+                                          ,entry.args.data(), entry.args.size());
+    } else {
+        out.append(entry.text.data(), entry.text.size());
+    }
+}
+
+}
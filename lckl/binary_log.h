@@ -0,0 +1,215 @@
+#ifndef __BINARY_LOG_H__
+#define __BINARY_LOG_H__
+
+#include "log.h"
+#include <deque>
+#include <istream>
+#include <unordered_map>
+
+namespace lckl {
+
+/**
+ * @brief 二进制日志文件格式
+ * @details 文件由若干段组成，每段以MAGIC开头，之后是一串以标签字节开头的条目：
+ *          STRING  定义字符串表项: varint id, varint长度, 内容
+ *          RECORD  一条日志: 级别(1字节), zigzag varint时间差(微秒，相对上一条),
+ *                  varint运行时间/线程id/协程id/日志器名id/线程名id/文件名id/行号,
+ *                  varint格式id(0表示文本消息: varint长度+内容；
+ *                  否则后跟varint类型编码id、varint参数长度和按类型压缩的参数)
+ *          RAW     直接写入的文本: varint长度, 内容
+ *          TRACE   其后一条RECORD的跟踪id: varint长度, 内容，没有跟踪id的记录不写
+ *          字符串(printf格式、文件名、日志器名、线程名、参数类型编码)在段内只写一次，
+ *          记录中只引用id，id从1开始，0表示空串。跟踪id几乎不重复，直接写在记录前面而不进字符串表，
+ *          避免字符串表在一段内无限增长。每次打开文件都开始新的一段
+ */
+namespace binary_log {
+
+//段头
+static const char MAGIC[8] = {'L', 'C', 'K', 'L', 'B', 'I', 'N', 1};
+
+enum Tag : uint8_t {
+    STRING = 1,
+    RECORD = 2,
+    RAW = 3,
+    TRACE = 4
+};
+
+inline void put_varint(std::string& out, uint64_t v) {
+    char buf[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    out.append(buf, n);
+}
+
+inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * @brief 把DeferredArg编码的参数压缩写入out，整数用varint
+ * @return 成功返回true，参数不完整返回false
+ */
+bool pack_args(std::string& out, const char* types, const char* args, size_t len);
+/**
+ * @brief pack_args的逆过程，还原为DeferredArg编码
+ * @return 成功返回true，数据和类型不符返回false
+ */
+bool unpack_args(std::string& out, const char* types, const char* data, size_t len);
+
+}
+
+/**
+ * @brief 二进制日志输出器
+ * @details 不做文本格式化，日志按binary_log格式写入文件，重复的文件名、
+ *          日志器名和printf格式只写一次id，时间以微秒差值保存。
+ *          延迟日志(LCKL_LOG_DEFERRED)保存原始参数而不是格式化后的消息。
+ *          文件用tools/lckl_decode按任意LogFormatter模式还原为文本
+ */
+class BinaryLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+
+    /**
+     * @brief Construct a new Binary Log Appender object
+     *
+     * @param filename 文件路径
+     * @param buffer_size 写缓冲区大小，写满后写入文件
+     */
+    BinaryLogAppender(const std::string& filename, size_t buffer_size = 64 * 1024);
+    ~BinaryLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 把缓冲区写入文件
+     */
+    void flush() override;
+    /**
+     * @brief 不经过格式化器，总是记录日志内容
+     */
+    bool needs_message() const override { return true; }
+    /**
+     * @brief 写出缓冲区，最后一条记录可能不完整
+     */
+    void crash_flush() override;
+    /**
+     * @brief 作为RAW记录写出
+     */
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 重新打开日志文件，开始新的一段
+     * @return 成功返回true
+     */
+    bool reopen();
+
+    /**
+     * @brief 已写入文件的字节数
+     */
+    uint64_t get_written() const { return m_written.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief 返回字符串的id，第一次出现时写入字符串表
+     */
+    uint32_t get_string_id(const char* str, size_t len);
+    /**
+     * @brief 按指针查找长期有效字符串(__FILE__、printf格式等)的id
+     */
+    uint32_t get_static_id(const char* str);
+    void flush_buffer();
+
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    size_t m_buffer_size;
+    std::string m_buffer;
+    //当前段的字符串表
+    std::unordered_map<std::string, uint32_t> m_strings;
+    //指针到id的缓存，命中时仍比较内容，防止地址被复用
+    std::unordered_map<const char*, std::pair<uint32_t, const std::string*>> m_static_ids;
+    //上一条记录的时间，微秒
+    uint64_t m_last_time = 0;
+    //压缩参数的临时缓冲
+    std::string m_packed;
+    std::atomic<uint64_t> m_written{0};
+};
+
+/**
+ * @brief 二进制日志读取器
+ */
+class BinaryLogReader {
+public:
+    /**
+     * @brief 读出的一条条目
+     */
+    struct Entry {
+        //为true时是直接写入的文本，只有text有效
+        bool raw = false;
+        LogLevel::Level level = LogLevel::UNKNOWN;
+        //时间戳，微秒
+        uint64_t time = 0;
+        uint32_t elapse = 0;
+        uint32_t threadid = 0;
+        uint32_t fiberid = 0;
+        int32_t line = 0;
+        //以下字符串指向读取器的字符串表，读取器销毁前有效
+        const std::string* logger = nullptr;
+        const std::string* threadname = nullptr;
+        const std::string* file = nullptr;
+        //延迟日志的printf格式，文本消息为nullptr
+        const std::string* fmt = nullptr;
+        const std::string* types = nullptr;
+        //延迟日志的参数，DeferredArg编码
+        std::string args;
+        //文本消息
+        std::string text;
+        //跟踪id，没有时为空
+        std::string trace_id;
+    };
+
+    BinaryLogReader(std::istream& is);
+
+    /**
+     * @brief 读取下一条日志，字符串表条目在内部处理
+     * @return 文件结束或格式错误返回false
+     */
+    bool next(Entry& entry);
+    /**
+     * @brief 是否因格式错误停止
+     */
+    bool is_error() const { return m_error; }
+
+    /**
+     * @brief 把条目的消息写入out，延迟日志按printf格式还原
+     */
+    static void format_message(LogStream& out, const Entry& entry);
+
+private:
+    bool read_varint(uint64_t& v);
+    bool read_bytes(std::string& out, size_t len);
+    const std::string* get_string(uint64_t id);
+    bool read_segment_header();
+
+private:
+    std::istream& m_is;
+    bool m_error = false;
+    //字符串表，下标为id，deque保证元素地址不变
+    std::deque<std::string> m_strings;
+    uint64_t m_last_time = 0;
+    std::string m_packed;
+    //TRACE条目读出的跟踪id，交给下一条RECORD
+    std::string m_trace_id;
+};
+
+}
+
+#endif // !__BINARY_LOG_H__
@@ -0,0 +1,401 @@
+#include "buffered_appender.h"
+#include "log_crash.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lckl {
+
+//每个线程最多积压的待写缓冲区数，超出时等待后台线程
+static const size_t s_max_pending = 4;
+
+namespace {
+
+/**
+ * @brief 一块待写出的缓冲区
+ */
+struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+}
+
+/**
+ * @brief 单个线程或协程的缓冲区
+ * @details mutex只在所属线程写日志和后台线程交换缓冲区时竞争
+ */
+struct BufferedFileLogAppender::ThreadBuffer {
+    ThreadBuffer(size_t cap)
+        :capacity(cap)
+        ,current(new char[cap])
+        ,spare(new char[cap]) {
+    }
+
+    std::mutex mutex;
+    //等待后台线程写出积压的缓冲区
+    std::condition_variable cond;
+    size_t capacity;
+    //正在写入的缓冲区
+    std::unique_ptr<char[]> current;
+    size_t size = 0;
+    //备用缓冲区
+    std::unique_ptr<char[]> spare;
+    //已写满、等待写出的缓冲区
+    std::vector<Block> full;
+    //所属线程已退出或协程的日志上下文已析构
+    bool detached = false;
+    //所属Appender已销毁
+    bool closed = false;
+    //所属线程/协程缓存的格式化器，版本不变时不必加锁获取
+    LogFormatter::ptr formatter;
+    uint32_t formatter_version = 0;
+};
+
+namespace {
+
+struct ThreadBufferRef {
+    uint64_t id;
+    std::shared_ptr<BufferedFileLogAppender::ThreadBuffer> tb;
+};
+
+/**
+ * @brief 当前线程在各个Appender中的缓冲区，线程退出时交由后台线程回收
+ */
+struct ThreadBufferList {
+    ~ThreadBufferList() {
+        for (auto& i : refs) {
+            std::lock_guard<std::mutex> lock(i.tb->mutex);
+            i.tb->detached = true;
+        }
+    }
+    std::vector<ThreadBufferRef> refs;
+};
+
+thread_local ThreadBufferList t_buffers;
+
+/**
+ * @brief 协程在一个Appender中的缓冲区，日志上下文析构时交由后台线程回收
+ */
+struct FiberBuffer : public LogContext::Local {
+    FiberBuffer(std::shared_ptr<BufferedFileLogAppender::ThreadBuffer> v) : tb(v) {}
+    ~FiberBuffer() {
+        std::lock_guard<std::mutex> lock(tb->mutex);
+        tb->detached = true;
+    }
+    std::shared_ptr<BufferedFileLogAppender::ThreadBuffer> tb;
+};
+
+}
+
+BufferedFileLogAppender::BufferedFileLogAppender(const std::string& filename
+                                                ,size_t buffer_size, uint32_t flush_interval
+                                                ,size_t fiber_buffer_size)
+    :m_filename(filename)
+    ,m_buffer_size(buffer_size)
+    ,m_flush_interval(flush_interval)
+    ,m_fiber_buffer_size(fiber_buffer_size)
+    ,m_id(LogContext::new_key()) {
+    reopen();
+    m_thread = std::thread(&BufferedFileLogAppender::run, this);
+}
+
+BufferedFileLogAppender::~BufferedFileLogAppender() {
+    stop();
+    std::lock_guard<std::mutex> lock(m_buffers_mutex);
+    for (auto& i : m_buffers) {
+        std::lock_guard<std::mutex> tb_lock(i->mutex);
+        i->closed = true;
+        i->current.reset();
+        i->spare.reset();
+        i->size = 0;
+        i->full.clear();
+        i->cond.notify_all();
+    }
+    m_buffers.clear();
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+std::shared_ptr<BufferedFileLogAppender::ThreadBuffer> BufferedFileLogAppender::add_buffer(size_t capacity) {
+    auto tb = std::make_shared<ThreadBuffer>(capacity);
+    std::lock_guard<std::mutex> lock(m_buffers_mutex);
+    m_buffers.push_back(tb);
+    return tb;
+}
+
+BufferedFileLogAppender::ThreadBuffer* BufferedFileLogAppender::get_fiber_buffer(LogContext* context) {
+    if (LogContext::Local* local = context->get_local(m_id)) {
+        return static_cast<FiberBuffer*>(local)->tb.get();
+    }
+    auto tb = add_buffer(m_fiber_buffer_size);
+    context->set_local(m_id, std::unique_ptr<LogContext::Local>(new FiberBuffer(tb)));
+    return tb.get();
+}
+
+BufferedFileLogAppender::ThreadBuffer* BufferedFileLogAppender::get_thread_buffer() {
+    if (m_fiber_buffer_size) {
+        if (LogContext* context = get_log_context()) {
+            return get_fiber_buffer(context);
+        }
+    }
+    auto& refs = t_buffers.refs;
+    for (size_t i = 0; i < refs.size(); ++i) {
+        if (refs[i].id == m_id) {
+            return refs[i].tb.get();
+        }
+    }
+    //顺便清理已销毁Appender的缓冲区
+    for (auto it = refs.begin(); it != refs.end();) {
+        bool closed;
+        {
+            std::lock_guard<std::mutex> lock(it->tb->mutex);
+            closed = it->tb->closed;
+        }
+        it = closed ? refs.erase(it) : it + 1;
+    }
+    auto tb = add_buffer(m_buffer_size);
+    refs.push_back(ThreadBufferRef{m_id, tb});
+    return tb.get();
+}
+
+void BufferedFileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    ThreadBuffer* tb = get_thread_buffer();
+    std::unique_lock<std::mutex> lock(tb->mutex);
+    if (tb->closed) {
+        return;
+    }
+    uint32_t version = get_formatter_version();
+    if (!tb->formatter || tb->formatter_version != version) {
+        tb->formatter = get_formatter();
+        tb->formatter_version = version;
+    }
+    LogFormatter* formatter = tb->formatter.get();
+    if (!formatter) {
+        return;
+    }
+    size_t len = formatter->format(tb->current.get() + tb->size, tb->capacity - tb->size
+                                  ,logger, level, *event);
+    if (tb->size + len <= tb->capacity) {
+        tb->size += len;
+        return;
+    }
+    //缓冲区放不下，整条日志重新格式化到新缓冲区，保证一条日志不被拆开
+    rotate(tb, lock);
+    if (tb->closed) {
+        return;
+    }
+    //两次格式化之间时间可能跨秒，长度以实际写入的为准
+    if (len <= tb->capacity) {
+        len = formatter->format(tb->current.get(), tb->capacity, logger, level, *event);
+        tb->size = std::min(len, tb->capacity);
+    } else {
+        Block b;
+        b.data.reset(new char[len]);
+        b.capacity = len;
+        b.size = std::min(formatter->format(b.data.get(), len, logger, level, *event), len);
+        tb->full.push_back(std::move(b));
+    }
+}
+
+void BufferedFileLogAppender::write(const char* data, size_t len) {
+    ThreadBuffer* tb = get_thread_buffer();
+    std::unique_lock<std::mutex> lock(tb->mutex);
+    if (tb->closed) {
+        return;
+    }
+    if (tb->size + len > tb->capacity) {
+        rotate(tb, lock);
+        if (tb->closed) {
+            return;
+        }
+    }
+    if (len <= tb->capacity) {
+        memcpy(tb->current.get() + tb->size, data, len);
+        tb->size += len;
+    } else {
+        Block b;
+        b.data.reset(new char[len]);
+        memcpy(b.data.get(), data, len);
+        b.size = b.capacity = len;
+        tb->full.push_back(std::move(b));
+    }
+}
+
+void BufferedFileLogAppender::rotate(ThreadBuffer* tb, std::unique_lock<std::mutex>& lock) {
+    if (tb->size > 0) {
+        while (tb->full.size() >= s_max_pending && !tb->closed
+                && !m_stopping.load(std::memory_order_acquire)) {
+            m_cond.notify_one();
+            tb->cond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        if (tb->closed) {
+            return;
+        }
+        Block b;
+        b.data = std::move(tb->current);
+        b.size = tb->size;
+        b.capacity = tb->capacity;
+        tb->full.push_back(std::move(b));
+        tb->size = 0;
+        if (tb->spare) {
+            tb->current = std::move(tb->spare);
+        } else {
+            tb->current.reset(new char[tb->capacity]);
+        }
+    }
+    m_cond.notify_one();
+}
+
+void BufferedFileLogAppender::crash_flush() {
+    for (auto& tb : m_buffers) {
+        for (auto& b : tb->full) {
+            LogCrashHandler::write_fd(m_fd, b.data.get(), b.size);
+        }
+        if (tb->current && tb->size) {
+            LogCrashHandler::write_fd(m_fd, tb->current.get(), std::min(tb->size, tb->capacity));
+        }
+    }
+}
+
+void BufferedFileLogAppender::crash_write(const char* data, size_t len) {
+    LogCrashHandler::write_fd(m_fd, data, len);
+}
+
+void BufferedFileLogAppender::flush_buffers() {
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    std::vector<std::shared_ptr<ThreadBuffer>> tbs;
+    {
+        std::lock_guard<std::mutex> lock(m_buffers_mutex);
+        tbs = m_buffers;
+    }
+
+    //取走各线程的缓冲区，有备用缓冲区时直接交换
+    std::vector<std::pair<ThreadBuffer*, Block>> blocks;
+    for (auto& tb : tbs) {
+        std::lock_guard<std::mutex> lock(tb->mutex);
+        for (auto& b : tb->full) {
+            blocks.push_back(std::make_pair(tb.get(), std::move(b)));
+        }
+        tb->full.clear();
+        if (tb->size > 0 && tb->current) {
+            Block b;
+            b.data = std::move(tb->current);
+            b.size = tb->size;
+            b.capacity = tb->capacity;
+            blocks.push_back(std::make_pair(tb.get(), std::move(b)));
+            tb->size = 0;
+            if (tb->spare) {
+                tb->current = std::move(tb->spare);
+            } else {
+                tb->current.reset(new char[tb->capacity]);
+            }
+        }
+        tb->cond.notify_all();
+    }
+
+    //一次writev写出，超过IOV_MAX时分批
+    size_t i = 0;
+    while (i < blocks.size() && m_fd != -1) {
+        struct iovec iov[IOV_MAX];
+        int n = 0;
+        for (; i < blocks.size() && n < IOV_MAX; ++i, ++n) {
+            iov[n].iov_base = blocks[i].second.data.get();
+            iov[n].iov_len = blocks[i].second.size;
+        }
+        struct iovec* p = iov;
+        while (n > 0) {
+            ssize_t rt = writev(m_fd, p, n);
+            m_writev_count.fetch_add(1, std::memory_order_relaxed);
+            if (rt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            m_written.fetch_add(rt, std::memory_order_relaxed);
+            //处理部分写入
+            while (n > 0 && (size_t)rt >= p->iov_len) {
+                rt -= p->iov_len;
+                ++p;
+                --n;
+            }
+            if (n > 0) {
+                p->iov_base = (char*)p->iov_base + rt;
+                p->iov_len -= rt;
+            }
+        }
+    }
+
+    //写完的缓冲区还给对应线程作为备用
+    for (auto& i : blocks) {
+        ThreadBuffer* tb = i.first;
+        if (i.second.capacity != tb->capacity) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(tb->mutex);
+        if (!tb->spare && !tb->closed) {
+            tb->spare = std::move(i.second.data);
+        }
+    }
+
+    //回收已退出线程的缓冲区
+    std::lock_guard<std::mutex> lock(m_buffers_mutex);
+    for (auto it = m_buffers.begin(); it != m_buffers.end();) {
+        std::lock_guard<std::mutex> tb_lock((*it)->mutex);
+        if ((*it)->detached && (*it)->size == 0 && (*it)->full.empty()) {
+            it = m_buffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void BufferedFileLogAppender::flush() {
+    flush_buffers();
+}
+
+bool BufferedFileLogAppender::reopen() {
+    std::lock_guard<std::mutex> lock(m_flush_mutex);
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    return m_fd != -1;
+}
+
+void BufferedFileLogAppender::stop() {
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wait_mutex);
+        m_cond.notify_one();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    flush_buffers();
+}
+
+void BufferedFileLogAppender::run() {
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        {
+            std::unique_lock<std::mutex> lock(m_wait_mutex);
+            m_cond.wait_for(lock, std::chrono::milliseconds(m_flush_interval));
+        }
+        flush_buffers();
+    }
+}
+
+}
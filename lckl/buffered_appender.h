@@ -0,0 +1,121 @@
+#ifndef __BUFFERED_APPENDER_H__
+#define __BUFFERED_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace lckl {
+
+/**
+ * @brief 按线程缓冲的文件Appender
+ * @details 每个写日志的线程持有一块大缓冲区(默认4MB)，日志直接格式化到其中，
+ *          写满后换用备用缓冲区。后台线程按周期取走所有线程的缓冲区，
+ *          用一次writev写入文件后再还给各线程，单条日志不再有跨线程同步和系统调用。
+ *          不同线程的日志按缓冲区整体写出，文件内只保证同一线程的日志有序。
+ *          开启按协程缓冲后，设置了日志上下文(set_log_context)的协程使用自己的缓冲区，
+ *          协程在线程间迁移时它的日志依然有序
+ */
+class BufferedFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<BufferedFileLogAppender> ptr;
+
+    /**
+     * @brief Construct a new Buffered File Log Appender object
+     *
+     * @param filename 文件路径
+     * @param buffer_size 每个线程缓冲区大小
+     * @param flush_interval 刷新周期，毫秒
+     * @param fiber_buffer_size 每个协程缓冲区大小，为0时不按协程缓冲
+     */
+    BufferedFileLogAppender(const std::string& filename
+                           ,size_t buffer_size = 4 * 1024 * 1024
+                           ,uint32_t flush_interval = 1000
+                           ,size_t fiber_buffer_size = 0);
+    ~BufferedFileLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 把所有线程已缓冲的日志写入文件
+     */
+    void flush() override;
+    /**
+     * @brief 依次写出各线程已写满和正在写入的缓冲区
+     */
+    void crash_flush() override;
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 重新打开日志文件
+     * @return 成功返回true
+     */
+    bool reopen();
+    /**
+     * @brief 写完所有缓冲后停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 已写入文件的字节数
+     */
+    uint64_t get_written() const { return m_written.load(std::memory_order_relaxed); }
+    /**
+     * @brief writev调用次数
+     */
+    uint64_t get_writev_count() const { return m_writev_count.load(std::memory_order_relaxed); }
+
+public:
+    struct ThreadBuffer;
+
+private:
+    /**
+     * @brief 返回当前协程或线程的缓冲区
+     */
+    ThreadBuffer* get_thread_buffer();
+    ThreadBuffer* get_fiber_buffer(LogContext* context);
+    /**
+     * @brief 新建一个缓冲区并登记，供后台线程写出
+     */
+    std::shared_ptr<ThreadBuffer> add_buffer(size_t capacity);
+    /**
+     * @brief 当前缓冲区放不下一条日志时换用备用缓冲区
+     */
+    void rotate(ThreadBuffer* tb, std::unique_lock<std::mutex>& lock);
+    /**
+     * @brief 取走所有线程的缓冲区并写入文件
+     */
+    void flush_buffers();
+    void run();
+
+private:
+    //文件路径
+    std::string m_filename;
+    //文件描述符
+    int m_fd = -1;
+    size_t m_buffer_size;
+    uint32_t m_flush_interval;
+    size_t m_fiber_buffer_size;
+    //用于区分线程和协程的缓冲区属于哪个Appender
+    uint64_t m_id;
+
+    //所有线程的缓冲区
+    std::mutex m_buffers_mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+
+    //保证同一时间只有一个线程写文件
+    std::mutex m_flush_mutex;
+    std::mutex m_wait_mutex;
+    std::condition_variable m_cond;
+    std::atomic<bool> m_stopping{false};
+    std::thread m_thread;
+
+    std::atomic<uint64_t> m_written{0};
+    std::atomic<uint64_t> m_writev_count{0};
+};
+
+}
+
+#endif // !__BUFFERED_APPENDER_H__
@@ -0,0 +1,588 @@
+#include "compress_appender.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LCKL_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef LCKL_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace lckl {
+
+//等待压缩的块数上限，超过时写日志的线程等待
+static const size_t s_max_pending = 4;
+//块的预留空间，最后一条日志可以超出frame_size
+static const size_t s_block_slack = 64 * 1024;
+
+static const uint32_t s_zstd_magic = 0xFD2FB528;
+static const uint32_t s_lz4_magic = 0x184D2204;
+static const uint32_t s_skippable_magic = 0x184D2A50;
+//zstd seekable格式
+static const uint32_t s_seek_table_magic = 0x184D2A5E;
+static const uint32_t s_seek_footer_magic = 0x8F92EAB1;
+static const size_t s_seek_footer_size = 9;
+//扫描文件时读取窗口的上限
+static const size_t s_max_scan_window = 256 * 1024 * 1024;
+
+namespace {
+
+uint32_t get_le32(const char* p) {
+    const uint8_t* u = (const uint8_t*)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+void put_le32(std::string& out, uint32_t v) {
+    char buf[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+    out.append(buf, 4);
+}
+
+uint32_t frame_magic(LogCompressor::Codec codec) {
+    return codec == LogCompressor::ZSTD ? s_zstd_magic : s_lz4_magic;
+}
+
+#ifdef LCKL_HAVE_ZSTD
+class ZstdCompressor : public LogCompressor {
+public:
+    ZstdCompressor(int level) {
+        m_ctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, level ? level : ZSTD_CLEVEL_DEFAULT);
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_checksumFlag, 1);
+    }
+    ~ZstdCompressor() {
+        ZSTD_freeCCtx(m_ctx);
+    }
+
+    Codec get_codec() const override { return ZSTD; }
+
+    size_t bound(size_t len) const override {
+        return ZSTD_compressBound(len);
+    }
+
+    size_t compress(char* dst, size_t cap, const char* src, size_t len) override {
+        //一次压缩整块，帧头默认记录原始长度
+        size_t n = ZSTD_compress2(m_ctx, dst, cap, src, len);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+
+    size_t parse_frame(const char* data, size_t len, uint64_t& raw) const override {
+        size_t n = ZSTD_findFrameCompressedSize(data, len);
+        if (ZSTD_isError(n)) {
+            return 0;
+        }
+        unsigned long long size = ZSTD_getFrameContentSize(data, n);
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+            return 0;
+        }
+        raw = size;
+        return n;
+    }
+
+private:
+    ZSTD_CCtx* m_ctx;
+};
+#endif
+
+#ifdef LCKL_HAVE_LZ4
+uint64_t get_le64(const char* p) {
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+class Lz4Compressor : public LogCompressor {
+public:
+    Lz4Compressor(int level) {
+        LZ4F_createCompressionContext(&m_ctx, LZ4F_VERSION);
+        memset(&m_prefs, 0, sizeof(m_prefs));
+        m_prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+        m_prefs.frameInfo.blockMode = LZ4F_blockLinked;
+        m_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        m_prefs.compressionLevel = level;
+    }
+    ~Lz4Compressor() {
+        LZ4F_freeCompressionContext(m_ctx);
+    }
+
+    Codec get_codec() const override { return LZ4; }
+
+    size_t bound(size_t len) const override {
+        return LZ4F_compressFrameBound(len, &m_prefs);
+    }
+
+    size_t compress(char* dst, size_t cap, const char* src, size_t len) override {
+        m_prefs.frameInfo.contentSize = len;
+        size_t pos = LZ4F_compressBegin(m_ctx, dst, cap, &m_prefs);
+        if (LZ4F_isError(pos)) {
+            return 0;
+        }
+        size_t n = LZ4F_compressUpdate(m_ctx, dst + pos, cap - pos, src, len, nullptr);
+        if (LZ4F_isError(n)) {
+            return 0;
+        }
+        pos += n;
+        n = LZ4F_compressEnd(m_ctx, dst + pos, cap - pos, nullptr);
+        return LZ4F_isError(n) ? 0 : pos + n;
+    }
+
+    size_t parse_frame(const char* data, size_t len, uint64_t& raw) const override {
+        //魔数(4) FLG(1) BD(1) [原始长度(8)] [字典ID(4)] 头校验(1)
+        if (len < 7 || get_le32(data) != s_lz4_magic) {
+            return 0;
+        }
+        uint8_t flg = data[4];
+        if ((flg >> 6) != 1 || !(flg & 0x08)) {
+            return 0;
+        }
+        size_t pos = 6;
+        if (len < pos + 8) {
+            return 0;
+        }
+        raw = get_le64(data + pos);
+        pos += 8;
+        if (flg & 0x01) {
+            pos += 4;
+        }
+        pos += 1;
+        //数据块: 长度(4)，最高位表示未压缩，0表示结束
+        while (true) {
+            if (len < pos + 4) {
+                return 0;
+            }
+            uint32_t block = get_le32(data + pos);
+            pos += 4;
+            if (block == 0) {
+                break;
+            }
+            pos += (block & 0x7FFFFFFF) + ((flg & 0x10) ? 4 : 0);
+        }
+        if (flg & 0x04) {
+            pos += 4;
+        }
+        return pos <= len ? pos : 0;
+    }
+
+private:
+    LZ4F_cctx* m_ctx = nullptr;
+    LZ4F_preferences_t m_prefs;
+};
+#endif
+
+}
+
+LogCompressor::ptr LogCompressor::create(Codec codec, int level) {
+    switch (codec) {
+#ifdef LCKL_HAVE_ZSTD
+        case ZSTD:
+            return ptr(new ZstdCompressor(level));
+#endif
+#ifdef LCKL_HAVE_LZ4
+        case LZ4:
+            return ptr(new Lz4Compressor(level));
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+bool LogCompressor::is_supported(Codec codec) {
+    switch (codec) {
+#ifdef LCKL_HAVE_ZSTD
+        case ZSTD:
+            return true;
+#endif
+#ifdef LCKL_HAVE_LZ4
+        case LZ4:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* LogCompressor::to_string(Codec codec) {
+    switch (codec) {
+#define XX(name) \
+        case name: \
+            return #name;
+    XX(ZSTD);
+    XX(LZ4);
+#undef XX
+        default:
+            return "UNKNOWN";
+    }
+}
+
+CompressedFileLogAppender::CompressedFileLogAppender(const std::string& filename, LogCompressor::Codec codec
+                                                    ,size_t frame_size, int level, uint32_t flush_interval)
+    :m_filename(filename)
+    ,m_frame_size(std::max(frame_size, (size_t)4096))
+    ,m_flush_interval(flush_interval)
+    ,m_compressor(LogCompressor::create(codec, level)) {
+    m_current.reserve(m_frame_size + s_block_slack);
+    {
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        open_file();
+    }
+    m_last_submit = get_elapse_ms();
+    m_running = true;
+    m_thread = std::thread(&CompressedFileLogAppender::run, this);
+}
+
+CompressedFileLogAppender::~CompressedFileLogAppender() {
+    stop();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        submit_current(lock, false);
+    }
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    close_file();
+}
+
+void CompressedFileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_formatter) {
+        return;
+    }
+    m_formatter->format(m_current, logger, level, *event);
+    if (m_current.size() >= m_frame_size) {
+        submit_current(lock, true);
+    }
+}
+
+void CompressedFileLogAppender::write(const char* data, size_t len) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_current.append(data, len);
+    if (m_current.size() >= m_frame_size) {
+        submit_current(lock, true);
+    }
+}
+
+void CompressedFileLogAppender::submit_current(std::unique_lock<std::mutex>& lock, bool wait) {
+    while (wait && m_running && m_full.size() >= s_max_pending) {
+        m_done_cond.wait(lock);
+    }
+    if (m_current.empty()) {
+        return;
+    }
+    std::string next;
+    if (!m_free.empty()) {
+        next.swap(m_free.back());
+        m_free.pop_back();
+    } else {
+        next.reserve(m_frame_size + s_block_slack);
+    }
+    ++m_submitted;
+    m_last_submit = get_elapse_ms();
+    if (m_running) {
+        m_full.push_back(std::move(m_current));
+        m_current.swap(next);
+        m_cond.notify_one();
+        return;
+    }
+    //后台线程已停止，持有m_mutex直接写入，保证块的顺序
+    write_frame(m_current);
+    m_current.clear();
+    m_free.push_back(std::move(next));
+    ++m_done;
+}
+
+void CompressedFileLogAppender::flush() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        submit_current(lock, false);
+        uint64_t target = m_submitted;
+        while (m_running && m_done < target) {
+            m_done_cond.wait(lock);
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    write_table();
+}
+
+bool CompressedFileLogAppender::reopen() {
+    flush();
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    close_file();
+    return open_file();
+}
+
+void CompressedFileLogAppender::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            return;
+        }
+        m_stopping = true;
+        m_cond.notify_one();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void CompressedFileLogAppender::write_frame(const std::string& block) {
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    if (m_fd == -1) {
+        return;
+    }
+    m_raw_bytes.fetch_add(block.size(), std::memory_order_relaxed);
+    if (m_has_table) {
+        //先截掉跳表，写到一半崩溃时重新打开会扫描重建
+        int rt = ftruncate(m_fd, m_data_end);
+        (void)rt;
+        m_has_table = false;
+    }
+    if (!m_compressor) {
+        if (write_all(block.data(), block.size())) {
+            m_written.fetch_add(block.size(), std::memory_order_relaxed);
+        }
+        return;
+    }
+    size_t cap = m_compressor->bound(block.size());
+    if (m_out.size() < cap) {
+        m_out.resize(cap);
+    }
+    size_t len = m_compressor->compress(&m_out[0], cap, block.data(), block.size());
+    if (len && write_all(m_out.data(), len)) {
+        m_entries.push_back({(uint32_t)len, (uint32_t)block.size()});
+        m_written.fetch_add(len, std::memory_order_relaxed);
+        m_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool CompressedFileLogAppender::write_all(const char* data, size_t len) {
+    uint64_t begin = m_data_end;
+    while (len > 0) {
+        ssize_t n = pwrite(m_fd, data, len, m_data_end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            //不完整的帧会让后面的帧都无法解压
+            int rt = ftruncate(m_fd, begin);
+            (void)rt;
+            m_data_end = begin;
+            return false;
+        }
+        data += n;
+        len -= n;
+        m_data_end += n;
+    }
+    return true;
+}
+
+void CompressedFileLogAppender::write_table() {
+    if (m_fd == -1 || !m_compressor || !m_seekable || m_has_table || m_entries.empty()) {
+        return;
+    }
+    //skippable帧头(8) 每帧的压缩长度和原始长度(8) 帧数(4) 描述符(1) 魔数(4)
+    std::string table;
+    table.reserve(8 + m_entries.size() * 8 + s_seek_footer_size);
+    put_le32(table, s_seek_table_magic);
+    put_le32(table, m_entries.size() * 8 + s_seek_footer_size);
+    for (auto& i : m_entries) {
+        put_le32(table, i.compressed);
+        put_le32(table, i.raw);
+    }
+    put_le32(table, m_entries.size());
+    table.push_back(0);
+    put_le32(table, s_seek_footer_magic);
+
+    uint64_t end = m_data_end;
+    if (write_all(table.data(), table.size())) {
+        m_has_table = true;
+    }
+    m_data_end = end;
+}
+
+bool CompressedFileLogAppender::open_file() {
+    m_fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    m_entries.clear();
+    m_seekable = m_compressor != nullptr;
+    m_has_table = false;
+    m_data_end = 0;
+    if (m_fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st)) {
+        return true;
+    }
+    m_data_end = st.st_size;
+    if (!m_compressor || st.st_size == 0) {
+        return true;
+    }
+    if (read_seek_table(m_fd, m_entries)) {
+        m_data_end = 0;
+        for (auto& i : m_entries) {
+            m_data_end += i.compressed;
+        }
+        m_has_table = true;
+    } else {
+        scan_frames(st.st_size);
+    }
+    return true;
+}
+
+void CompressedFileLogAppender::close_file() {
+    if (m_fd == -1) {
+        return;
+    }
+    write_table();
+    close(m_fd);
+    m_fd = -1;
+}
+
+void CompressedFileLogAppender::scan_frames(uint64_t size) {
+    m_entries.clear();
+    std::string buf;
+    size_t max_frame = m_compressor->bound(m_frame_size + s_block_slack);
+    size_t window = std::max(max_frame, (size_t)1024 * 1024);
+    uint64_t pos = 0;
+    while (pos < size) {
+        size_t avail = std::min((uint64_t)window, size - pos);
+        buf.resize(avail);
+        ssize_t n = pread(m_fd, &buf[0], avail, pos);
+        if (n != (ssize_t)avail) {
+            m_seekable = false;
+            return;
+        }
+        size_t offset = 0;
+        while (offset + 8 <= avail) {
+            const char* p = buf.data() + offset;
+            uint32_t magic = get_le32(p);
+            uint64_t len = 0;
+            uint64_t raw = 0;
+            if ((magic & 0xFFFFFFF0) == s_skippable_magic) {
+                len = 8 + (uint64_t)get_le32(p + 4);
+                if (pos + offset + len > size) {
+                    break;
+                }
+            } else {
+                len = m_compressor->parse_frame(p, avail - offset, raw);
+                if (len == 0) {
+                    break;
+                }
+            }
+            if (len > UINT32_MAX || raw > UINT32_MAX) {
+                m_seekable = false;
+                return;
+            }
+            m_entries.push_back({(uint32_t)len, (uint32_t)raw});
+            offset += len;
+        }
+        if (offset > 0) {
+            pos += offset;
+            continue;
+        }
+        if (avail < size - pos && window < s_max_scan_window) {
+            //帧比读取窗口大
+            window *= 2;
+            continue;
+        }
+        //只剩一个写了一半的帧时截掉，否则是无法识别的数据，保留原内容
+        uint32_t magic = frame_magic(m_compressor->get_codec());
+        size_t head = std::min(avail, (size_t)4);
+        bool partial = avail == size - pos && avail <= max_frame;
+        for (size_t i = 0; partial && i < head; ++i) {
+            partial = (uint8_t)buf[i] == ((magic >> (i * 8)) & 0xFF);
+        }
+        if (partial) {
+            int rt = ftruncate(m_fd, pos);
+            (void)rt;
+            m_data_end = pos;
+        } else {
+            m_seekable = false;
+        }
+        return;
+    }
+}
+
+bool CompressedFileLogAppender::read_seek_table(int fd, std::vector<SeekEntry>& entries) {
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t)(8 + s_seek_footer_size)) {
+        return false;
+    }
+    uint64_t size = st.st_size;
+    char footer[s_seek_footer_size];
+    if (pread(fd, footer, sizeof(footer), size - sizeof(footer)) != (ssize_t)sizeof(footer)
+            || get_le32(footer + 5) != s_seek_footer_magic) {
+        return false;
+    }
+    uint64_t count = get_le32(footer);
+    uint8_t desc = footer[4];
+    //最高位表示每项带4字节校验，保留位必须为0
+    if (desc & 0x7C) {
+        return false;
+    }
+    size_t entry_size = (desc & 0x80) ? 12 : 8;
+    uint64_t table_size = 8 + count * entry_size + s_seek_footer_size;
+    if (table_size > size) {
+        return false;
+    }
+    std::string buf(table_size, '\0');
+    if (pread(fd, &buf[0], table_size, size - table_size) != (ssize_t)table_size
+            || get_le32(&buf[0]) != s_seek_table_magic
+            || get_le32(&buf[4]) != table_size - 8) {
+        return false;
+    }
+    std::vector<SeekEntry> tmp;
+    tmp.reserve(count);
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        const char* p = buf.data() + 8 + i * entry_size;
+        tmp.push_back({get_le32(p), get_le32(p + 4)});
+        total += tmp.back().compressed;
+    }
+    //跳表必须覆盖它之前的所有数据
+    if (total != size - table_size) {
+        return false;
+    }
+    entries.swap(tmp);
+    return true;
+}
+
+void CompressedFileLogAppender::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        if (m_full.empty()) {
+            if (m_stopping) {
+                if (m_current.empty()) {
+                    break;
+                }
+                submit_current(lock, false);
+                continue;
+            }
+            m_cond.wait_for(lock, std::chrono::milliseconds(m_flush_interval));
+            if (m_full.empty() && !m_current.empty()
+                    && get_elapse_ms() - m_last_submit >= m_flush_interval) {
+                submit_current(lock, false);
+            }
+            continue;
+        }
+        std::string block = std::move(m_full.front());
+        m_full.pop_front();
+        lock.unlock();
+        write_frame(block);
+        block.clear();
+        lock.lock();
+        ++m_done;
+        if (m_free.size() < s_max_pending) {
+            m_free.push_back(std::move(block));
+        }
+        m_done_cond.notify_all();
+    }
+    m_running = false;
+    m_done_cond.notify_all();
+}
+
+}
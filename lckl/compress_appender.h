@@ -0,0 +1,208 @@
+#ifndef __COMPRESS_APPENDER_H__
+#define __COMPRESS_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+namespace lckl {
+
+/**
+ * @brief 块压缩算法
+ * @details 编译时定义LCKL_HAVE_ZSTD/LCKL_HAVE_LZ4并链接-lzstd/-llz4后可用
+ */
+class LogCompressor {
+public:
+    typedef std::unique_ptr<LogCompressor> ptr;
+
+    enum Codec {
+        ZSTD = 0,
+        LZ4 = 1
+    };
+
+    /**
+     * @brief 创建压缩器，算法未编译进来时返回nullptr
+     * @param level 压缩级别，0表示算法的默认级别
+     */
+    static ptr create(Codec codec, int level = 0);
+    /**
+     * @brief 算法是否可用
+     */
+    static bool is_supported(Codec codec);
+    static const char* to_string(Codec codec);
+
+    virtual ~LogCompressor() {}
+    virtual Codec get_codec() const = 0;
+    /**
+     * @brief 压缩len字节后的最大长度
+     */
+    virtual size_t bound(size_t len) const = 0;
+    /**
+     * @brief 把一块数据压缩成一个独立的帧，帧头记录原始长度
+     * @return 帧长度，失败返回0
+     */
+    virtual size_t compress(char* dst, size_t cap, const char* src, size_t len) = 0;
+    /**
+     * @brief 解析data开头的一个帧
+     * @param[out] raw 帧的原始长度
+     * @return 帧长度，数据不完整或不是该算法的帧返回0
+     */
+    virtual size_t parse_frame(const char* data, size_t len, uint64_t& raw) const = 0;
+};
+
+/**
+ * @brief 压缩写入的文件Appender
+ * @details 日志格式化到当前块，块写满frame_size或到达刷新周期时交给后台线程，
+ *          后台线程把每块压缩成一个独立的zstd/lz4帧追加到文件，写日志的线程不做压缩。
+ *          flush和关闭文件时在末尾写入zstd seekable格式的跳表(skippable帧，记录每帧压缩前后的长度)，
+ *          下一帧写入前截掉。zstd -d / lz4 -d 可以直接解压整个文件，读取工具根据跳表只解压需要的帧。
+ *          打开已有文件时读取末尾的跳表继续追加；没有跳表时(进程崩溃)逐帧扫描重建，
+ *          末尾不完整的帧被截掉，遇到无法识别的数据时保留原文件内容，该文件不再写跳表。
+ *          stop之后的日志在写日志的线程中直接压缩写入
+ */
+class CompressedFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<CompressedFileLogAppender> ptr;
+
+    /**
+     * @brief 跳表的一项
+     */
+    struct SeekEntry {
+        uint32_t compressed;
+        uint32_t raw;
+    };
+
+    /**
+     * @brief Construct a new Compressed File Log Appender object
+     *
+     * @param filename 文件路径
+     * @param codec 压缩算法，不可用时直接写入未压缩的日志
+     * @param frame_size 每帧压缩前的大小
+     * @param level 压缩级别，0表示算法的默认级别
+     * @param flush_interval 未写满的块最长等待时间，毫秒
+     */
+    CompressedFileLogAppender(const std::string& filename
+                             ,LogCompressor::Codec codec = LogCompressor::ZSTD
+                             ,size_t frame_size = 1024 * 1024
+                             ,int level = 0
+                             ,uint32_t flush_interval = 1000);
+    ~CompressedFileLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 压缩并写入已缓冲的日志，然后写入跳表
+     */
+    void flush() override;
+    /**
+     * @brief 写完缓冲的日志和跳表后重新打开日志文件
+     * @return 成功返回true
+     */
+    bool reopen();
+    /**
+     * @brief 写完所有缓冲后停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 是否在压缩
+     */
+    bool is_compressed() const { return m_compressor != nullptr; }
+    /**
+     * @brief 压缩前的字节数
+     */
+    uint64_t get_raw_bytes() const { return m_raw_bytes.load(std::memory_order_relaxed); }
+    /**
+     * @brief 写入文件的字节数，不含跳表
+     */
+    uint64_t get_written() const { return m_written.load(std::memory_order_relaxed); }
+    /**
+     * @brief 写入的帧数
+     */
+    uint64_t get_frame_count() const { return m_frames.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 读取文件末尾的跳表
+     * @return 文件末尾没有有效的跳表时返回false
+     */
+    static bool read_seek_table(int fd, std::vector<SeekEntry>& entries);
+
+private:
+    /**
+     * @brief 当前块交给后台线程，调用方持有m_mutex
+     * @param wait 待压缩的块过多时是否等待
+     */
+    void submit_current(std::unique_lock<std::mutex>& lock, bool wait);
+    /**
+     * @brief 压缩一块并写入文件
+     */
+    void write_frame(const std::string& block);
+    /**
+     * @brief 从m_data_end开始写入，失败时截掉写了一半的数据
+     */
+    bool write_all(const char* data, size_t len);
+    /**
+     * @brief 在文件末尾写入跳表，调用方持有m_file_mutex
+     */
+    void write_table();
+    /**
+     * @brief 打开文件并恢复已有帧的跳表，调用方持有m_file_mutex
+     */
+    bool open_file();
+    /**
+     * @brief 写入跳表并关闭文件，调用方持有m_file_mutex
+     */
+    void close_file();
+    /**
+     * @brief 没有跳表时逐帧扫描文件
+     */
+    void scan_frames(uint64_t size);
+    void run();
+
+private:
+    std::string m_filename;
+    size_t m_frame_size;
+    uint32_t m_flush_interval;
+    LogCompressor::ptr m_compressor;
+
+    //以下由m_mutex保护
+    std::string m_current;
+    //等待压缩的块
+    std::deque<std::string> m_full;
+    std::vector<std::string> m_free;
+    uint64_t m_submitted = 0;
+    uint64_t m_done = 0;
+    uint64_t m_last_submit = 0;
+    bool m_stopping = false;
+    bool m_running = false;
+    //通知后台线程有新的块
+    std::condition_variable m_cond;
+    //通知等待的写日志线程和flush有块已写完
+    std::condition_variable m_done_cond;
+
+    //以下由m_file_mutex保护
+    std::mutex m_file_mutex;
+    int m_fd = -1;
+    //最后一帧的结束位置，跳表写在这之后
+    uint64_t m_data_end = 0;
+    //文件末尾是否可以写跳表
+    bool m_seekable = true;
+    //文件当前是否以跳表结尾
+    bool m_has_table = false;
+    std::vector<SeekEntry> m_entries;
+    //压缩输出缓冲区
+    std::string m_out;
+
+    std::thread m_thread;
+    std::atomic<uint64_t> m_raw_bytes{0};
+    std::atomic<uint64_t> m_written{0};
+    std::atomic<uint64_t> m_frames{0};
+};
+
+}
+
+#endif // !__COMPRESS_APPENDER_H__
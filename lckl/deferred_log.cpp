@@ -0,0 +1,673 @@
+#include "deferred_log.h"
+#include "log_crash.h"
+#include "log_metrics.h"
+#include "log_pool.h"
+#include "util.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+
+namespace lckl {
+
+namespace {
+
+uint64_t get_realtime_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 单个线程的字节环形缓冲区，所属线程写、后台线程读
+ */
+struct DeferredBuffer {
+    DeferredBuffer(size_t cap)
+        :data(new char[cap])
+        ,capacity(cap)
+        ,mask(cap - 1) {
+    }
+
+    std::unique_ptr<char[]> data;
+    size_t capacity;
+    size_t mask;
+    uint32_t threadid = 0;
+    //所属线程已退出
+    std::atomic<bool> detached{false};
+
+    //生产者写入位置
+    alignas(64) std::atomic<uint64_t> tail{0};
+    //生产者缓存的读取位置
+    uint64_t cached_head = 0;
+    //预留中的记录提交后的写入位置
+    uint64_t pending_tail = 0;
+
+    //消费者读取位置
+    alignas(64) std::atomic<uint64_t> head{0};
+};
+
+/**
+ * @brief 后台线程和所有线程缓冲区
+ */
+struct DeferredState {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<DeferredBuffer>> buffers;
+    //buffers变化时递增，后台线程据此更新本地副本
+    std::atomic<uint64_t> version{0};
+
+    std::atomic<size_t> buffer_size{1024 * 1024};
+    std::atomic<int> policy{DeferredLogBackend::BLOCK};
+    std::atomic<uint64_t> dropped{0};
+
+    std::once_flag start_flag;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+DeferredState& get_state() {
+    //不析构，线程退出晚于静态对象析构时依然可用
+    return *Singleton<DeferredState>::get_instance();
+}
+
+//后台线程启动后才有缓冲区，崩溃处理据此判断，不在信号处理函数中创建单例
+std::atomic<DeferredState*> s_started{nullptr};
+
+thread_local DeferredBuffer* t_buffer = nullptr;
+
+//线程退出阶段的日志直接丢弃
+thread_local bool t_exited = false;
+
+struct DeferredBufferHolder {
+    ~DeferredBufferHolder() {
+        if (buffer) {
+            buffer->detached.store(true, std::memory_order_release);
+        }
+        t_buffer = nullptr;
+        t_exited = true;
+    }
+    std::shared_ptr<DeferredBuffer> buffer;
+};
+thread_local DeferredBufferHolder t_buffer_holder;
+
+size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+/**
+ * @brief 处理一条记录
+ */
+void process_record(const DeferredRecord* r) {
+    const DeferredSite* site = r->site;
+    Logger* logger = r->logger;
+    LogMetrics::add_event(logger->get_metrics_id(), site->level);
+    LogEvent::ptr event = LogEventPool::acquire(logger, site->level
+                            ,site->file, site->line, r->elapse, r->threadid, 0
+                            ,r->time / 1000000, r->threadname, r->time % 1000000);
+    const char* args = (const char*)(r + 1);
+    size_t len = r->size - sizeof(DeferredRecord);
+    event->set_args(site->fmt, r->types, args, len);
+    DeferredLogBackend::format_message(event->get_ss(), site->fmt, r->types, args, len);
+    logger->log(site->level, event);
+}
+
+/**
+ * @brief 处理一个缓冲区中的记录，返回处理的记录数
+ */
+size_t consume(DeferredBuffer* b, size_t max) {
+    uint64_t head = b->head.load(std::memory_order_relaxed);
+    uint64_t tail = b->tail.load(std::memory_order_acquire);
+    size_t n = 0;
+    while (head != tail && n < max) {
+        size_t pos = head & b->mask;
+        size_t contig = b->capacity - pos;
+        //末尾放不下头部，记录从头开始
+        if (contig < sizeof(DeferredRecord)) {
+            head += contig;
+            continue;
+        }
+        const DeferredRecord* r = (const DeferredRecord*)(b->data.get() + pos);
+        if (r->site) {
+            process_record(r);
+            ++n;
+        }
+        head += r->size;
+        //每条记录处理完就推进，flush据此判断
+        b->head.store(head, std::memory_order_release);
+    }
+    b->head.store(head, std::memory_order_release);
+    return n;
+}
+
+void run() {
+    DeferredState& s = get_state();
+    std::vector<std::shared_ptr<DeferredBuffer>> buffers;
+    uint64_t version = (uint64_t)-1;
+    int idle = 0;
+    for (;;) {
+        if (version != s.version.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            buffers = s.buffers;
+            version = s.version.load(std::memory_order_relaxed);
+        }
+        size_t n = 0;
+        bool reap = false;
+        for (auto& b : buffers) {
+            n += consume(b.get(), 256);
+            if (b->detached.load(std::memory_order_acquire)
+                    && b->head.load(std::memory_order_relaxed) == b->tail.load(std::memory_order_acquire)) {
+                reap = true;
+            }
+        }
+        //回收已退出线程的空缓冲区
+        if (reap) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (auto it = s.buffers.begin(); it != s.buffers.end();) {
+                DeferredBuffer* b = it->get();
+                if (b->detached.load(std::memory_order_acquire)
+                        && b->head.load(std::memory_order_relaxed) == b->tail.load(std::memory_order_acquire)) {
+                    it = s.buffers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            s.version.fetch_add(1, std::memory_order_release);
+        }
+        if (n) {
+            idle = 0;
+            continue;
+        }
+        if (s.stopping.load(std::memory_order_acquire)) {
+            break;
+        }
+        //空闲时先让出CPU，持续空闲再休眠，生产者不需要唤醒后台线程
+        if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+}
+
+void stop() {
+    DeferredState& s = get_state();
+    DeferredLogBackend::flush();
+    s.stopping.store(true, std::memory_order_release);
+    if (s.thread.joinable()) {
+        s.thread.join();
+    }
+    //后台线程最后写入的日志可能还在异步Appender的队列中
+    LoggerManager::get_instance()->flush_all();
+}
+
+DeferredBuffer* create_buffer() {
+    DeferredState& s = get_state();
+    std::call_once(s.start_flag, [&s]() {
+        s.thread = std::thread(run);
+        s_started.store(&s, std::memory_order_release);
+        //进程退出前写完剩余日志
+        atexit(stop);
+    });
+    size_t cap = 4096;
+    while (cap < s.buffer_size.load(std::memory_order_relaxed)) {
+        cap <<= 1;
+    }
+    auto b = std::make_shared<DeferredBuffer>(cap);
+    b->threadid = get_thread_id();
+    t_buffer_holder.buffer = b;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.buffers.push_back(b);
+        s.version.fetch_add(1, std::memory_order_release);
+    }
+    return b.get();
+}
+
+}
+
+char* DeferredLogBackend::reserve(size_t size) {
+    DeferredBuffer* b = t_buffer;
+    if (!b) {
+        if (t_exited || get_state().stopping.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        b = t_buffer = create_buffer();
+    }
+    size_t need = align8(size);
+    uint64_t tail = b->tail.load(std::memory_order_relaxed);
+    size_t pos = tail & b->mask;
+    size_t contig = b->capacity - pos;
+    size_t pad = contig < need ? contig : 0;
+    if (pad + need > b->capacity) {
+        get_state().dropped.fetch_add(1, std::memory_order_relaxed);
+        LogMetrics::add(LogMetrics::DROPPED);
+        return nullptr;
+    }
+    while (tail + pad + need - b->cached_head > b->capacity) {
+        b->cached_head = b->head.load(std::memory_order_acquire);
+        if (tail + pad + need - b->cached_head <= b->capacity) {
+            break;
+        }
+        if (get_state().policy.load(std::memory_order_relaxed) == DROP
+                || get_state().stopping.load(std::memory_order_relaxed)) {
+            get_state().dropped.fetch_add(1, std::memory_order_relaxed);
+            LogMetrics::add(LogMetrics::DROPPED);
+            return nullptr;
+        }
+        std::this_thread::yield();
+    }
+    //末尾放不下这条记录，放填充后从头开始；不足一个头部时不写填充
+    if (pad >= sizeof(DeferredRecord)) {
+        DeferredRecord* r = (DeferredRecord*)(b->data.get() + pos);
+        r->size = pad;
+        r->site = nullptr;
+    }
+    char* p = b->data.get() + ((tail + pad) & b->mask);
+    ((DeferredRecord*)p)->size = need;
+    b->pending_tail = tail + pad + need;
+    return p;
+}
+
+void DeferredLogBackend::commit(DeferredRecord* record) {
+    DeferredBuffer* b = t_buffer;
+    record->threadid = b->threadid;
+    record->threadname = get_thread_context().threadname;
+    record->time = get_realtime_us();
+    record->elapse = get_elapse_ms();
+    b->tail.store(b->pending_tail, std::memory_order_release);
+}
+
+void DeferredLogBackend::flush() {
+    DeferredState& s = get_state();
+    std::vector<std::pair<std::shared_ptr<DeferredBuffer>, uint64_t>> targets;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto& b : s.buffers) {
+            targets.push_back(std::make_pair(b, b->tail.load(std::memory_order_acquire)));
+        }
+    }
+    for (auto& i : targets) {
+        while (i.first->head.load(std::memory_order_acquire) < i.second
+                && s.thread.joinable() && !s.stopping.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+void DeferredLogBackend::set_buffer_size(size_t size) {
+    get_state().buffer_size.store(size, std::memory_order_relaxed);
+}
+
+void DeferredLogBackend::set_policy(OverflowPolicy policy) {
+    get_state().policy.store(policy, std::memory_order_relaxed);
+}
+
+uint64_t DeferredLogBackend::get_dropped() {
+    return get_state().dropped.load(std::memory_order_relaxed);
+}
+
+namespace {
+
+/**
+ * @brief 读取下一个参数，参数已用完返回false
+ */
+struct ArgReader {
+    const char* types;
+    const char* p;
+    const char* end;
+
+    bool next(char& type) {
+        if (!*types) {
+            return false;
+        }
+        type = *types++;
+        return true;
+    }
+    template<class T>
+    T read() {
+        T v = T();
+        if (p + sizeof(T) <= end) {
+            memcpy(&v, p, sizeof(T));
+        }
+        p += sizeof(T);
+        return v;
+    }
+    int64_t read_int(char type) {
+        switch (type) {
+        case 'i': return read<int32_t>();
+        case 'I': return read<int64_t>();
+        case 'u': return read<uint32_t>();
+        case 'U': return (int64_t)read<uint64_t>();
+        case 'p': return (int64_t)read<uint64_t>();
+        case 'd': return (int64_t)read<double>();
+        case 'D': return (int64_t)read<long double>();
+        case 's': {
+            uint32_t len = read<uint32_t>();
+            p += len;
+            return 0;
+        }
+        default: return 0;
+        }
+    }
+};
+
+template<class T>
+void append_spec(LogStream& out, const std::string& spec, T v) {
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), spec.c_str(), v);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < sizeof(buf)) {
+        out.append(buf, len);
+        return;
+    }
+    char* p = out.reserve(len + 1);
+    snprintf(p, len + 1, spec.c_str(), v);
+    out.commit(len);
+}
+
+}
+
+void DeferredLogBackend::format_message(LogStream& out, const char* fmt, const char* types
+                                       ,const char* args, size_t len) {
+    ArgReader reader{types, args, args + len};
+    const char* p = fmt;
+    while (*p) {
+        const char* begin = p;
+        while (*p && *p != '%') {
+            ++p;
+        }
+        out.append(begin, p - begin);
+        if (!*p) {
+            break;
+        }
+        if (p[1] == '%') {
+            out.append("%", 1);
+            p += 2;
+            continue;
+        }
+
+        //%[flags][width][.precision][length]conversion
+        std::string spec("%");
+        const char* spec_begin = p++;
+        while (*p && strchr("-+ #0'", *p)) {
+            spec.append(1, *p++);
+        }
+        char type;
+        bool ok = true;
+        for (int part = 0; part < 2 && ok; ++part) {
+            if (part == 1) {
+                if (*p != '.') {
+                    break;
+                }
+                spec.append(1, *p++);
+            }
+            if (*p == '*') {
+                ++p;
+                if (!reader.next(type)) {
+                    ok = false;
+                    break;
+                }
+                spec.append(std::to_string(reader.read_int(type)));
+            }
+            while (*p >= '0' && *p <= '9') {
+                spec.append(1, *p++);
+            }
+        }
+        //长度修饰按实际保存的类型重新生成
+        while (*p && strchr("hlLqjzt", *p)) {
+            ++p;
+        }
+        char conv = *p;
+        if (!conv) {
+            out.append(spec_begin, p - spec_begin);
+            break;
+        }
+        ++p;
+        if (!ok || !reader.next(type)) {
+            out.append(spec_begin, p - spec_begin);
+            continue;
+        }
+
+        switch (conv) {
+        case 'c':
+            append_spec(out, spec + 'c', (int)reader.read_int(type));
+            break;
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            //32位参数按int输出，与printf对%u/%x的解释一致
+            if (type == 'i' || type == 'u') {
+                append_spec(out, spec + conv, (int)reader.read_int(type));
+            } else {
+                append_spec(out, spec + "ll" + conv, (long long)reader.read_int(type));
+            }
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (type == 'D') {
+                append_spec(out, spec + 'L' + conv, reader.read<long double>());
+            } else if (type == 'd') {
+                append_spec(out, spec + conv, reader.read<double>());
+            } else {
+                append_spec(out, spec + conv, (double)reader.read_int(type));
+            }
+            break;
+        case 's':
+            if (type == 's') {
+                uint32_t n = reader.read<uint32_t>();
+                if (reader.p + n > reader.end) {
+                    n = reader.p > reader.end ? 0 : reader.end - reader.p;
+                }
+                if (spec.size() == 1) {
+                    out.append(reader.p, n);
+                } else {
+                    append_spec(out, spec + 's', std::string(reader.p, n).c_str());
+                }
+                reader.p += n;
+            } else {
+                reader.read_int(type);
+                out.append("(?)", 3);
+            }
+            break;
+        case 'p':
+            append_spec(out, spec + 'p', (void*)(uintptr_t)reader.read_int(type));
+            break;
+        default:
+            //不支持的转换(如%n)原样输出
+            reader.read_int(type);
+            out.append(spec_begin, p - spec_begin);
+            break;
+        }
+    }
+}
+
+
+namespace {
+
+/**
+ * @brief 崩溃时把一条记录组装为一行并按路由写出，不使用snprintf
+ */
+void crash_format(const DeferredRecord* r) {
+    const DeferredSite* site = r->site;
+    LogCrashHandler::Line line;
+    LogCrashHandler::format_prefix(line, r->time, r->threadid, r->threadname, site->level
+                                  ,r->logger->get_name(), site->file, site->line);
+    const char* args = (const char*)(r + 1);
+    ArgReader reader{r->types, args, args + (r->size - sizeof(DeferredRecord))};
+    const char* p = site->fmt;
+    while (*p) {
+        const char* begin = p;
+        while (*p && *p != '%') {
+            ++p;
+        }
+        line.append(begin, p - begin);
+        if (!*p) {
+            break;
+        }
+        if (p[1] == '%') {
+            line.append("%", 1);
+            p += 2;
+            continue;
+        }
+
+        //宽度和标志忽略，精度只用于浮点数
+        const char* spec_begin = p++;
+        while (*p && strchr("-+ #0'", *p)) {
+            ++p;
+        }
+        int precision = -1;
+        char type;
+        bool ok = true;
+        for (int part = 0; part < 2 && ok; ++part) {
+            if (part == 1) {
+                if (*p != '.') {
+                    break;
+                }
+                ++p;
+            }
+            int v = 0;
+            if (*p == '*') {
+                ++p;
+                if (!reader.next(type)) {
+                    ok = false;
+                    break;
+                }
+                v = (int)reader.read_int(type);
+            }
+            while (*p >= '0' && *p <= '9') {
+                v = v * 10 + (*p++ - '0');
+            }
+            if (part == 1) {
+                precision = v;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p)) {
+            ++p;
+        }
+        char conv = *p;
+        if (!conv) {
+            line.append(spec_begin, p - spec_begin);
+            break;
+        }
+        ++p;
+        if (!ok || !reader.next(type)) {
+            line.append(spec_begin, p - spec_begin);
+            continue;
+        }
+
+        //32位参数与printf一样按int解释
+        bool narrow = type == 'i' || type == 'u';
+        switch (conv) {
+        case 'c': {
+            char c = (char)reader.read_int(type);
+            line.append(&c, 1);
+            break;
+        }
+        case 'd':
+        case 'i': {
+            int64_t v = reader.read_int(type);
+            line.append_int(narrow ? (int32_t)v : v);
+            break;
+        }
+        case 'u': {
+            uint64_t v = reader.read_int(type);
+            line.append_uint(narrow ? (uint32_t)v : v);
+            break;
+        }
+        //八进制也按十六进制输出
+        case 'o':
+        case 'x':
+        case 'X': {
+            uint64_t v = reader.read_int(type);
+            line.append_hex(narrow ? (uint32_t)v : v);
+            break;
+        }
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double v;
+            if (type == 'D') {
+                v = (double)reader.read<long double>();
+            } else if (type == 'd') {
+                v = reader.read<double>();
+            } else {
+                v = (double)reader.read_int(type);
+            }
+            line.append_double(v, precision < 0 ? 6 : precision);
+            break;
+        }
+        case 's':
+            if (type == 's') {
+                uint32_t n = reader.read<uint32_t>();
+                if (reader.p + n > reader.end) {
+                    n = reader.p > reader.end ? 0 : reader.end - reader.p;
+                }
+                line.append(reader.p, n);
+                reader.p += n;
+            } else {
+                reader.read_int(type);
+                line.append("(?)", 3);
+            }
+            break;
+        case 'p':
+            line.append("0x", 2);
+            line.append_hex(reader.read_int(type));
+            break;
+        default:
+            reader.read_int(type);
+            line.append(spec_begin, p - spec_begin);
+            break;
+        }
+    }
+    line.end();
+    r->logger->crash_write(site->level, line.data(), line.size());
+}
+
+}
+
+void DeferredLogBackend::crash_flush() {
+    DeferredState* s = s_started.load(std::memory_order_acquire);
+    if (!s) {
+        return;
+    }
+    for (auto& b : s->buffers) {
+        uint64_t head = b->head.load(std::memory_order_acquire);
+        uint64_t tail = b->tail.load(std::memory_order_acquire);
+        while (head < tail) {
+            size_t pos = head & b->mask;
+            size_t contig = b->capacity - pos;
+            if (contig < sizeof(DeferredRecord)) {
+                head += contig;
+                continue;
+            }
+            const DeferredRecord* r = (const DeferredRecord*)(b->data.get() + pos);
+            if (r->size == 0 || r->size > b->capacity) {
+                break;
+            }
+            if (r->site) {
+                crash_format(r);
+            }
+            head += r->size;
+        }
+    }
+}
+
+}
@@ -0,0 +1,248 @@
+#ifndef __DEFERRED_LOG_H__
+#define __DEFERRED_LOG_H__
+
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+/**
+ * @brief 延迟格式化的日志宏，fmt为printf格式
+ * @details 调用线程只拷贝参数和调用点信息到线程的环形缓冲区，消息格式化和
+ *          LogFormatter都在后台线程执行。参数只能是整数、浮点数、指针和C字符串，
+ *          字符串内容会被拷贝。logger必须在后台线程处理完之前保持有效
+ */
+#define LCKL_LOG_DEFERRED(logger, level, fmt, ...) \
+    do { \
+        if (!(level < LCKL_LOG_MIN_LEVEL) && !__builtin_expect(!(logger)->is_enabled(level), 1)) { \
+            static const lckl::DeferredSite LCKL_deferred_site = {fmt, __FILE__, __LINE__, level}; \
+            (void)sizeof(printf(fmt, ##__VA_ARGS__)); \
+            lckl::DeferredLogBackend::log(&LCKL_deferred_site, &*(logger), ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LCKL_LOG_DEFERRED_DEBUG(logger, fmt, ...) LCKL_LOG_DEFERRED(logger, lckl::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_DEFERRED_INFO(logger, fmt, ...) LCKL_LOG_DEFERRED(logger, lckl::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_DEFERRED_WARN(logger, fmt, ...) LCKL_LOG_DEFERRED(logger, lckl::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_DEFERRED_ERROR(logger, fmt, ...) LCKL_LOG_DEFERRED(logger, lckl::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_DEFERRED_FATAL(logger, fmt, ...) LCKL_LOG_DEFERRED(logger, lckl::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace lckl {
+
+/**
+ * @brief 日志调用点的静态信息，由日志宏在编译期常量初始化
+ */
+struct DeferredSite {
+    //printf格式
+    const char* fmt;
+    //文件名
+    const char* file;
+    //行号
+    int32_t line;
+    //日志级别
+    LogLevel::Level level;
+};
+
+/**
+ * @brief 参数类型编码
+ * @details 'i' int32, 'I' int64, 'u' uint32, 'U' uint64, 'd' double,
+ *          'D' long double, 'p' 指针, 's' 字符串(uint32长度+内容)
+ */
+template<class T, class Enable = void>
+struct DeferredArg {
+    static_assert(sizeof(T) == 0, "deferred log arguments must be integers, floats, pointers or C strings");
+};
+
+template<class T>
+struct DeferredArg<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+    //按printf的参数提升规则保存
+    typedef typename std::conditional<std::is_enum<T>::value, std::underlying_type<T>, std::common_type<T>>::type::type base_type;
+    static const bool is_signed = std::is_signed<base_type>::value || sizeof(base_type) < sizeof(int);
+    static const bool is_wide = sizeof(base_type) > 4;
+    static const char code = is_wide ? (is_signed ? 'I' : 'U') : (is_signed ? 'i' : 'u');
+    typedef typename std::conditional<is_wide
+                ,typename std::conditional<is_signed, int64_t, uint64_t>::type
+                ,typename std::conditional<is_signed, int32_t, uint32_t>::type>::type store_type;
+
+    static size_t size(T) { return sizeof(store_type); }
+    static char* encode(char* p, T v) {
+        store_type s = (store_type)v;
+        memcpy(p, &s, sizeof(s));
+        return p + sizeof(s);
+    }
+};
+
+template<class T>
+struct DeferredArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static const bool is_long = sizeof(T) > sizeof(double);
+    static const char code = is_long ? 'D' : 'd';
+    typedef typename std::conditional<is_long, long double, double>::type store_type;
+
+    static size_t size(T) { return sizeof(store_type); }
+    static char* encode(char* p, T v) {
+        store_type s = v;
+        memcpy(p, &s, sizeof(s));
+        return p + sizeof(s);
+    }
+};
+
+template<class T>
+struct DeferredArg<T*, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type> {
+    static const char code = 'p';
+
+    static size_t size(T*) { return sizeof(uint64_t); }
+    static char* encode(char* p, T* v) {
+        uint64_t s = (uint64_t)(uintptr_t)v;
+        memcpy(p, &s, sizeof(s));
+        return p + sizeof(s);
+    }
+};
+
+template<class T>
+struct DeferredArg<T*, typename std::enable_if<std::is_same<typename std::remove_cv<T>::type, char>::value>::type> {
+    static const char code = 's';
+
+    static size_t size(const char* v) { return sizeof(uint32_t) + (v ? strlen(v) : 6); }
+    static char* encode(char* p, const char* v) {
+        if (!v) {
+            v = "(null)";
+        }
+        uint32_t len = strlen(v);
+        memcpy(p, &len, sizeof(len));
+        memcpy(p + sizeof(len), v, len);
+        return p + sizeof(len) + len;
+    }
+};
+
+template<>
+struct DeferredArg<std::nullptr_t> : public DeferredArg<const void*> {
+};
+
+/**
+ * @brief 参数类型编码串
+ */
+template<class... Args>
+struct DeferredArgTypes {
+    static constexpr char value[] = {DeferredArg<Args>::code..., '\0'};
+};
+
+/**
+ * @brief 环形缓冲区中一条记录的头部
+ */
+struct DeferredRecord {
+    //记录总长度，包括头部；site为空表示缓冲区末尾的填充
+    uint32_t size;
+    //线程id
+    uint32_t threadid;
+    //运行时间，毫秒，与普通日志一样取自get_elapse_ms()
+    uint32_t elapse;
+    //调用点
+    const DeferredSite* site;
+    //参数类型编码
+    const char* types;
+    //日志器
+    Logger* logger;
+    //线程名，指向常驻字符串
+    const std::string* threadname;
+    //时间戳，微秒
+    uint64_t time;
+};
+
+/**
+ * @brief 延迟格式化的后台
+ * @details 每个线程一个单生产者单消费者的字节环形缓冲区，后台线程轮询所有
+ *          线程的缓冲区，还原参数后格式化消息并交给日志器输出
+ */
+class DeferredLogBackend {
+public:
+    /**
+     * @brief 缓冲区满时的处理策略
+     */
+    enum OverflowPolicy {
+        //等待后台线程取走记录
+        BLOCK = 0,
+        //丢弃这条日志
+        DROP
+    };
+
+    /**
+     * @brief 写入一条日志
+     */
+    template<class... Args>
+    static void log(const DeferredSite* site, Logger* logger, Args... args) {
+        size_t size = sizeof(DeferredRecord) + args_size(args...);
+        char* p = reserve(size);
+        if (!p) {
+            return;
+        }
+        DeferredRecord* r = (DeferredRecord*)p;
+        r->site = site;
+        r->types = DeferredArgTypes<typename std::decay<Args>::type...>::value;
+        r->logger = logger;
+        encode(p + sizeof(DeferredRecord), args...);
+        commit(r);
+        //FATAL之后进程可能马上退出，等待后台线程交给日志器(日志器会同步刷新)
+        if (site->level == LogLevel::FATAL) {
+            flush();
+        }
+    }
+
+    /**
+     * @brief 按printf格式和编码后的参数格式化消息
+     *
+     * @param out 输出
+     * @param fmt printf格式
+     * @param types 参数类型编码
+     * @param args 编码后的参数
+     * @param len 参数长度
+     */
+    static void format_message(LogStream& out, const char* fmt, const char* types
+                              ,const char* args, size_t len);
+
+    /**
+     * @brief 等待调用前写入的日志全部交给日志器
+     */
+    static void flush();
+    /**
+     * @brief 设置每个线程缓冲区的大小，只影响之后创建的缓冲区
+     */
+    static void set_buffer_size(size_t size);
+    /**
+     * @brief 设置缓冲区满时的处理策略
+     */
+    static void set_policy(OverflowPolicy policy);
+    /**
+     * @brief 因缓冲区满丢弃的日志数
+     */
+    static uint64_t get_dropped();
+    /**
+     * @brief 崩溃时把所有线程缓冲区中的记录按LogCrashHandler的固定格式写给日志器
+     * @details 只使用异步信号安全的函数，参数按printf格式简化输出(忽略宽度和标志)
+     */
+    static void crash_flush();
+
+private:
+    static size_t args_size() { return 0; }
+    template<class T, class... Args>
+    static size_t args_size(T v, Args... args) {
+        return DeferredArg<typename std::decay<T>::type>::size(v) + args_size(args...);
+    }
+    static void encode(char*) {}
+    template<class T, class... Args>
+    static void encode(char* p, T v, Args... args) {
+        encode(DeferredArg<typename std::decay<T>::type>::encode(p, v), args...);
+    }
+
+    /**
+     * @brief 在当前线程的缓冲区中预留size字节，失败返回nullptr
+     */
+    static char* reserve(size_t size);
+    /**
+     * @brief 填写时间和线程信息后提交记录
+     */
+    static void commit(DeferredRecord* record);
+};
+
+}
+
+#endif // !__DEFERRED_LOG_H__
@@ -1,8 +1,22 @@
 #include "log.h"
+#include "log_crash.h"
+#include "log_metrics.h"
+#include "log_pool.h"
+#include "util.h"
+#include <algorithm>
+#include <fcntl.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <iostream>
 #include <map>
 #include <functional>
+#include <tuple>
+#include <time.h>
+#include <string.h>
+#include <charconv>
+#include <cmath>
+#include <unistd.h>
 
 namespace lckl {
 
@@ -50,16 +64,53 @@ LogLevel::Level LogLevel::from_string(const std::string& str) {
 LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
                   ,const char* file, int32_t line, uint32_t elapse
                   ,uint32_t threadid, uint32_t fiberid, uint64_t time
-                  ,const std::string& threadname)
-    :m_file(file)
+                  ,const std::string& threadname, uint32_t usec)
+    :m_time(time)
+    ,m_file(file)
+    ,m_logger(logger.get())
+    ,m_threadname(intern_thread_name(threadname))
     ,m_line(line)
     ,m_elapse(elapse)
     ,m_threadid(threadid)
     ,m_fiberid(fiberid)
-    ,m_time(time)
-    ,m_threadname(threadname)
-    ,m_logger(logger)
+    ,m_usec(usec)
     ,m_level(level) {
+    static_assert(offsetof(LogEvent, m_ss) == HEADER_SIZE, "LogEvent header must fill one cache line");
+}
+
+void LogEvent::reset(Logger* logger, LogLevel::Level level
+                    ,const char* file, int32_t line, uint32_t elapse
+                    ,uint32_t threadid, uint32_t fiberid, uint64_t time
+                    ,const std::string* threadname, uint32_t usec) {
+    m_time = time;
+    m_file = file;
+    m_logger = logger;
+    m_threadname = threadname;
+    m_fmt = nullptr;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadid = threadid;
+    m_fiberid = fiberid;
+    m_usec = usec;
+    m_level = level;
+    m_ss.clear();
+    //少用的字段通常为空，避免无谓地写入它们所在的缓存行
+    if (m_arg_types || !m_args.empty()) {
+        m_arg_types = nullptr;
+        m_args.clear();
+    }
+    if (!m_fields.empty()) {
+        m_fields.clear();
+        m_field_data.clear();
+    }
+    if (m_trace_id_len) {
+        m_trace_id_len = 0;
+    }
+}
+
+void LogEvent::set_trace_id(std::string_view v) {
+    m_trace_id_len = std::min(v.size(), LogContext::TRACE_ID_SIZE);
+    memcpy(m_trace_id, v.data(), m_trace_id_len);
 }
 
 void LogEvent::format(const char* fmt, ...) {
@@ -69,48 +120,521 @@ void LogEvent::format(const char* fmt, ...) {
     va_end(al);
 }
 
+void LogEvent::set_args(const char* fmt, const char* types, const char* args, size_t len) {
+    m_fmt = fmt;
+    m_arg_types = types;
+    m_args.assign(args, len);
+}
+
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if (len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+    m_ss.append_format(fmt, al);
+}
+
+namespace {
+
+/**
+ * @brief 一个(秒, 时间格式)的缓存项
+ */
+struct DateCacheEntry {
+    //时间格式
+    std::string fmt;
+    //秒级时间戳，-1表示无效
+    time_t sec = -1;
+    //缓存的时间文本
+    char text[64];
+    size_t len = 0;
+    //毫秒/微秒字段在text中的位置和宽度
+    uint8_t frac_pos[4];
+    uint8_t frac_width[4];
+    uint8_t frac_count = 0;
+};
+
+//每个线程缓存的时间格式数，同一线程通常只使用一两种格式
+static const size_t s_date_cache_size = 4;
+
+/**
+ * @brief 重新生成缓存文本，仅在秒或格式变化时调用
+ */
+void fill_date_cache(DateCacheEntry& e, const char* fmt, time_t sec) {
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    e.len = 0;
+    e.frac_count = 0;
+
+    //按%L/%f切分格式，分段交给strftime
+    std::string seg;
+    auto flush = [&]() {
+        if (!seg.empty()) {
+            e.len += strftime(e.text + e.len, sizeof(e.text) - e.len, seg.c_str(), &tm);
+            seg.clear();
+        }
+    };
+    for (const char* p = fmt; *p; ++p) {
+        if (p[0] == '%' && p[1] != '\0') {
+            if (p[1] == 'L' || p[1] == 'f') {
+                uint8_t width = p[1] == 'L' ? 3 : 6;
+                flush();
+                if (e.frac_count < sizeof(e.frac_pos) && e.len + width < sizeof(e.text)) {
+                    e.frac_pos[e.frac_count] = e.len;
+                    e.frac_width[e.frac_count] = width;
+                    ++e.frac_count;
+                    memset(e.text + e.len, '0', width);
+                    e.len += width;
+                }
+            } else {
+                seg.append(p, 2);
+            }
+            ++p;
+            continue;
+        }
+        seg.append(1, *p);
+    }
+    flush();
+    e.text[e.len] = '\0';
+    e.sec = sec;
+}
+
+}
+
+const char* LogDateCache::format(const char* fmt, time_t sec, uint32_t usec, size_t& len) {
+    static thread_local DateCacheEntry s_entries[s_date_cache_size];
+    static thread_local size_t s_next = 0;
+
+    DateCacheEntry* e = nullptr;
+    for (size_t i = 0; i < s_date_cache_size; ++i) {
+        if (s_entries[i].sec != -1 && s_entries[i].fmt == fmt) {
+            e = &s_entries[i];
+            break;
+        }
+    }
+    if (!e) {
+        e = &s_entries[s_next];
+        s_next = (s_next + 1) % s_date_cache_size;
+        e->fmt = fmt;
+        e->sec = -1;
     }
+    if (e->sec != sec) {
+        fill_date_cache(*e, fmt, sec);
+    }
+
+    for (uint8_t i = 0; i < e->frac_count; ++i) {
+        uint32_t v = e->frac_width[i] == 3 ? usec / 1000 : usec;
+        char* p = e->text + e->frac_pos[i] + e->frac_width[i];
+        for (uint8_t j = 0; j < e->frac_width[i]; ++j) {
+            *--p = '0' + v % 10;
+            v /= 10;
+        }
+    }
+    len = e->len;
+    return e->text;
+}
+
+LogEvent::ptr LogEvent::create(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+                              ,const char* file, int32_t line) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const ThreadContext& ctx = get_thread_context();
+    const LogContext* context = ctx.context;
+    LogMetrics::add_event(logger->get_metrics_id(), level);
+    LogEvent::ptr event = LogEventPool::acquire(logger.get(), level, file, line, get_elapse_ms()
+                                ,ctx.threadid, context ? context->get_fiberid() : ctx.fiberid, ts.tv_sec
+                                ,ctx.threadname, ts.tv_nsec / 1000);
+    if (context && context->get_trace_id().size()) {
+        event->set_trace_id(context->get_trace_id());
+    }
+    return event;
 }
 
 LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e){
 }
 
-std::stringstream& LogEventWrap::get_ss() { 
+LogEventWrap::~LogEventWrap() {
+    m_event->get_logger()->log(m_event->get_level(), m_event);
+}
+
+LogStream& LogEventWrap::get_ss() { 
     return m_event->get_ss();
 }
 
+bool LogEventWrap::is_message_needed() const {
+    return m_event->get_logger()->needs_message(m_event->get_level());
+}
+
 
-LogFormatter::LogFormatter(const std::string& pattern) 
-    : m_pattern(pattern) {
+LogFormatter::LogFormatter(const std::string& pattern, Style style)
+    :m_pattern(pattern)
+    ,m_style(style) {
     init();
 }
 
-std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for (auto& i : m_items) {
-        i->format(ss, logger, level, event);
+std::string LogFormatter::format(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    return format(logger, level, *event);
+}
+
+namespace {
+
+/**
+ * @brief 记录一次format调用
+ */
+inline void add_format_metrics(uint64_t begin, size_t len) {
+    LogMetrics::add(LogMetrics::FORMAT_CALLS);
+    LogMetrics::add(LogMetrics::FORMAT_BYTES, len);
+    LogMetrics::timer_end(LogMetrics::FORMAT_NS, begin);
+}
+
+}
+
+std::ostream& LogFormatter::format_items(std::ostream& ofs, const Logger::ptr& logger, LogLevel::Level level
+                                        ,const LogEvent& event, uint64_t begin) const {
+    //先格式化到字符串再一次写入流，统计的字节数是实际写入的长度
+    std::string str;
+    run_items(str, logger, level, event);
+    ofs.write(str.data(), str.size());
+    add_format_metrics(begin, str.size());
+    return ofs;
+}
+
+std::ostream& LogFormatter::format(std::ostream& ofs, const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    uint64_t begin = LogMetrics::timer_begin();
+    if (m_compiled) {
+        detail::OstreamSink sink{ofs};
+        run(sink, level, *event);
+        add_format_metrics(begin, sink.len);
+        return ofs;
     }
-    return ss.str();
+    return format_items(ofs, logger, level, *event, begin);
+}
+
+std::string LogFormatter::format(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+    std::string str;
+    format(str, logger, level, event);
+    return str;
 }
 
-std::ostream& LogFormatter::format(std::ostream& ofs, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    for (auto& i : m_items) {
-        i->format(ofs, logger, level, event);
+std::ostream& LogFormatter::format(std::ostream& ofs, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+    uint64_t begin = LogMetrics::timer_begin();
+    if (m_compiled) {
+        detail::OstreamSink sink{ofs};
+        run(sink, level, event);
+        add_format_metrics(begin, sink.len);
+        return ofs;
+    }
+    return format_items(ofs, logger, level, event, begin);
+}
+
+size_t LogFormatter::format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+    uint64_t begin = LogMetrics::timer_begin();
+    size_t pos = out.size();
+    if (m_compiled) {
+        detail::StringSink sink{out};
+        run(sink, level, event);
+    } else {
+        run_items(out, logger, level, event);
+    }
+    add_format_metrics(begin, out.size() - pos);
+    return out.size() - pos;
+}
+
+size_t LogFormatter::format(char* buf, size_t size, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+    if (m_compiled) {
+        uint64_t begin = LogMetrics::timer_begin();
+        detail::SpanSink sink{buf, size, 0};
+        run(sink, level, event);
+        add_format_metrics(begin, sink.len);
+        return sink.len;
+    }
+    //FormatItem只能追加到字符串，先格式化到线程内的临时缓冲
+    static thread_local std::string t_buf;
+    t_buf.clear();
+    format(t_buf, logger, level, event);
+    memcpy(buf, t_buf.data(), t_buf.size() < size ? t_buf.size() : size);
+    return t_buf.size();
+}
+
+template<class Out, class Event>
+void LogFormatter::run_items(Out& out, const Logger::ptr& logger, LogLevel::Level level, const Event& event) const {
+    if (__builtin_expect(!LogMetrics::is_item_timing(), 1)) {
+        for (auto& i : m_items) {
+            i->format(out, logger, level, event);
+        }
+        return;
+    }
+    for (size_t i = 0; i < m_items.size(); ++i) {
+        uint64_t begin = LogMetrics::now_ns();
+        m_items[i]->format(out, logger, level, event);
+        LogMetrics::add_item(m_item_types[i], LogMetrics::now_ns() - begin);
+    }
+}
+
+namespace detail {
+
+static const uint64_t s_ones = 0x0101010101010101ULL;
+static const uint64_t s_highs = 0x8080808080808080ULL;
+
+/**
+ * @brief 8字节中是否有值小于n的字节(n <= 128)，可能误报，不会漏报
+ */
+inline uint64_t swar_less(uint64_t w, uint8_t n) {
+    return (w - s_ones * n) & ~w & s_highs;
+}
+
+/**
+ * @brief 8字节中是否有等于c的字节，可能误报，不会漏报
+ */
+inline uint64_t swar_equal(uint64_t w, uint8_t c) {
+    return swar_less(w ^ (s_ones * c), 1);
+}
+
+inline bool json_need_escape(uint8_t c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+inline bool logfmt_need_quote(uint8_t c) {
+    return c <= ' ' || c == '=' || c == '"' || c == '\\';
+}
+
+/**
+ * @brief 按JSON字符串规则转义，不加引号
+ * @details 每次检查8字节，整段不需要转义的文本一次追加
+ */
+template<class Sink>
+void sink_json_escaped(Sink& sink, const char* data, size_t len) {
+    static const char s_hex[] = "0123456789abcdef";
+    const char* p = data;
+    const char* end = data + len;
+    const char* run = p;
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            if (!(swar_less(w, 0x20) | swar_equal(w, '"') | swar_equal(w, '\\'))) {
+                p += 8;
+                continue;
+            }
+        }
+        uint8_t c = *p;
+        if (!json_need_escape(c)) {
+            ++p;
+            continue;
+        }
+        sink.append(run, p - run);
+        char buf[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t n = 2;
+        switch (c) {
+        case '"': buf[1] = '"'; break;
+        case '\\': buf[1] = '\\'; break;
+        case '\n': buf[1] = 'n'; break;
+        case '\r': buf[1] = 'r'; break;
+        case '\t': buf[1] = 't'; break;
+        case '\b': buf[1] = 'b'; break;
+        case '\f': buf[1] = 'f'; break;
+        default:
+            buf[1] = 'u';
+            buf[2] = '0';
+            buf[3] = '0';
+            buf[4] = s_hex[c >> 4];
+            buf[5] = s_hex[c & 0xF];
+            n = 6;
+        }
+        sink.append(buf, n);
+        run = ++p;
+    }
+    sink.append(run, p - run);
+}
+
+/**
+ * @brief 按logfmt规则输出值，含空格、=、引号、反斜杠、控制字符或为空时加引号转义
+ */
+template<class Sink>
+void sink_logfmt_value(Sink& sink, const char* data, size_t len) {
+    bool quote = len == 0;
+    size_t i = 0;
+    for (; !quote && i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        quote = swar_less(w, 0x21) | swar_equal(w, '=') | swar_equal(w, '"') | swar_equal(w, '\\');
+    }
+    for (; !quote && i < len; ++i) {
+        quote = logfmt_need_quote(data[i]);
+    }
+    if (!quote) {
+        sink.append(data, len);
+        return;
+    }
+    sink.append("\"", 1);
+    sink_json_escaped(sink, data, len);
+    sink.append("\"", 1);
+}
+
+template<class Sink>
+inline void sink_text(Sink& sink, uint8_t escape, const char* data, size_t len) {
+    switch (escape) {
+    case LogFormatter::FormatOp::ESCAPE_JSON:
+        sink_json_escaped(sink, data, len);
+        break;
+    case LogFormatter::FormatOp::ESCAPE_LOGFMT:
+        sink_logfmt_value(sink, data, len);
+        break;
+    default:
+        sink.append(data, len);
+    }
+}
+
+template<class Sink>
+void sink_double(Sink& sink, double v, bool json) {
+    //JSON不支持nan和inf
+    if (json && !std::isfinite(v)) {
+        sink.append("null", 4);
+        return;
+    }
+    char buf[32];
+    auto rt = std::to_chars(buf, buf + sizeof(buf), v);
+    sink.append(buf, rt.ptr - buf);
+}
+
+/**
+ * @brief 输出结构化字段
+ * @param separator 第一个字段前是否需要分隔符
+ */
+template<class Sink>
+void sink_fields(Sink& sink, uint8_t escape, bool separator, const LogEvent& event) {
+    bool json = escape == LogFormatter::FormatOp::ESCAPE_JSON;
+    for (auto& f : event.get_fields()) {
+        if (separator) {
+            sink.append(json ? "," : " ", 1);
+        }
+        separator = true;
+        if (json) {
+            sink.append("\"", 1);
+            sink_json_escaped(sink, f.key, strlen(f.key));
+            sink.append("\":", 2);
+        } else {
+            sink_cstr(sink, f.key);
+            sink.append("=", 1);
+        }
+        switch (f.type) {
+        case LogField::INT64:
+            sink_int(sink, f.i);
+            break;
+        case LogField::UINT64:
+            sink_int(sink, f.u);
+            break;
+        case LogField::DOUBLE:
+            sink_double(sink, f.d, json);
+            break;
+        case LogField::BOOL:
+            sink.append(f.b ? "true" : "false", f.b ? 4 : 5);
+            break;
+        case LogField::STRING: {
+            std::string_view str = event.get_field_string(f);
+            if (json) {
+                sink.append("\"", 1);
+                sink_json_escaped(sink, str.data(), str.size());
+                sink.append("\"", 1);
+            } else {
+                sink_logfmt_value(sink, str.data(), str.size());
+            }
+            break;
+        }
+        }
+    }
+}
+
+}
+
+template<class Sink>
+void LogFormatter::run(Sink& sink, LogLevel::Level level, const LogEvent& event) const {
+    if (__builtin_expect(LogMetrics::is_item_timing(), 0)) {
+        run_ops<true>(sink, level, event);
+    } else {
+        run_ops<false>(sink, level, event);
+    }
+}
+
+template<bool Timed, class Sink>
+void LogFormatter::run_ops(Sink& sink, LogLevel::Level level, const LogEvent& event) const {
+    static_assert(FormatOp::FIELDS + 1 == LogMetrics::ITEM_COUNT, "LogMetrics::ITEM_COUNT");
+    const char* pool = m_pool.data();
+    for (const FormatOp& op : m_ops) {
+        uint64_t begin = Timed ? LogMetrics::now_ns() : 0;
+        switch (op.type) {
+        case FormatOp::STRING:
+            sink.append(pool + op.offset, op.len);
+            break;
+        case FormatOp::MESSAGE: {
+            std::string_view content = event.get_content_view();
+            detail::sink_text(sink, op.escape, content.data(), content.size());
+            break;
+        }
+        case FormatOp::LEVEL:
+            detail::sink_cstr(sink, LogLevel::to_string(level));
+            break;
+        case FormatOp::ELAPSE:
+            detail::sink_int(sink, event.get_elapse());
+            break;
+        case FormatOp::NAME: {
+            const std::string& name = event.get_logger()->get_name();
+            detail::sink_text(sink, op.escape, name.data(), name.size());
+            break;
+        }
+        case FormatOp::THREADID:
+            detail::sink_cached_id(sink, number_format::THREAD_ID, event.get_threadid());
+            break;
+        case FormatOp::DATE: {
+            //参数在池中以'\0'结尾
+            size_t len;
+            const char* str = LogDateCache::format(pool + op.offset, event.get_time(), event.get_usec(), len);
+            detail::sink_text(sink, op.escape, str, len);
+            break;
+        }
+        case FormatOp::FILENAME: {
+            const char* file = event.get_file();
+            detail::sink_text(sink, op.escape, file, file ? strlen(file) : 0);
+            break;
+        }
+        case FormatOp::LINE:
+            detail::sink_int(sink, event.get_line());
+            break;
+        case FormatOp::FIBERID:
+            detail::sink_cached_id(sink, number_format::FIBER_ID, event.get_fiberid());
+            break;
+        case FormatOp::THREADNAME: {
+            const std::string& name = event.get_threadname();
+            detail::sink_text(sink, op.escape, name.data(), name.size());
+            break;
+        }
+        case FormatOp::TRACEID: {
+            std::string_view id = event.get_trace_id();
+            detail::sink_text(sink, op.escape, id.data(), id.size());
+            break;
+        }
+        case FormatOp::FIELDS:
+            detail::sink_fields(sink, op.escape, op.len, event);
+            break;
+        }
+        if (Timed) {
+            LogMetrics::add_item(op.type, LogMetrics::now_ns() - begin);
+        }
     }
-    return ofs;
+}
+
+void LogFormatter::FormatItem::format(std::string& out, const Logger::ptr& logger
+                                     ,LogLevel::Level level, const LogEvent& event) {
+    std::ostringstream os;
+    format(os, logger, level, LogEvent::ptr(LogEvent::ptr(), const_cast<LogEvent*>(&event)));
+    out.append(os.str());
 }
 
 class MessageFormatItem : public LogFormatter::FormatItem {
 public:
     MessageFormatItem(const std::string& str = "") {}
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->get_content();
+        std::string_view content = event->get_content_view();
+        os.write(content.data(), content.size());
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string_view content = event.get_content_view();
+        out.append(content.data(), content.size());
     }
 };
 
@@ -120,13 +644,21 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << LogLevel::to_string(level);
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.append(LogLevel::to_string(level));
+    }
 };
 
 class ElapseFormatItem : public LogFormatter::FormatItem {
 public:
     ElapseFormatItem(const std::string& str = "") {}
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->get_elapse();
+        char buf[number_format::INT_SIZE];
+        os.write(buf, number_format::format_integer(buf, event->get_elapse()) - buf);
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        detail::StringSink sink{out};
+        detail::sink_int(sink, event.get_elapse());
     }
 };
 
@@ -136,13 +668,21 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << event->get_logger()->get_name();
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.append(event.get_logger()->get_name());
+    }
 };
 
 class ThreadidFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadidFormatItem(const std::string& str = "") {}
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->get_threadid();
+        std::string_view text = number_format::cached_id_text(number_format::THREAD_ID, event->get_threadid());
+        os.write(text.data(), text.size());
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string_view text = number_format::cached_id_text(number_format::THREAD_ID, event.get_threadid());
+        out.append(text.data(), text.size());
     }
 };
 
@@ -150,7 +690,25 @@ class FiberidFormatItem : public LogFormatter::FormatItem {
 public:
     FiberidFormatItem(const std::string& str = "") {}
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->get_fiberid();
+        std::string_view text = number_format::cached_id_text(number_format::FIBER_ID, event->get_fiberid());
+        os.write(text.data(), text.size());
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string_view text = number_format::cached_id_text(number_format::FIBER_ID, event.get_fiberid());
+        out.append(text.data(), text.size());
+    }
+};
+
+class TraceidFormatItem : public LogFormatter::FormatItem {
+public:
+    TraceidFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+        std::string_view id = event->get_trace_id();
+        os.write(id.data(), id.size());
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string_view id = event.get_trace_id();
+        out.append(id.data(), id.size());
     }
 };
 
@@ -160,6 +718,9 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << event->get_threadname();
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.append(event.get_threadname());
+    }
 };
 
 class DateFormatItem : public LogFormatter::FormatItem {
@@ -171,12 +732,14 @@ public:
         }
     }
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        struct tm tm;
-        time_t time = event->get_time();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        size_t len;
+        const char* str = LogDateCache::format(m_format.c_str(), event->get_time(), event->get_usec(), len);
+        os.write(str, len);
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        size_t len;
+        const char* str = LogDateCache::format(m_format.c_str(), event.get_time(), event.get_usec(), len);
+        out.append(str, len);
     }
 private:
     std::string m_format;
@@ -188,13 +751,22 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << event->get_file();
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        detail::StringSink sink{out};
+        detail::sink_cstr(sink, event.get_file());
+    }
 };
 
 class LineFormatItem : public LogFormatter::FormatItem {
 public:
     LineFormatItem(const std::string& str = "") {}
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->get_line();
+        char buf[number_format::INT_SIZE];
+        os.write(buf, number_format::format_integer(buf, event->get_line()) - buf);
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        detail::StringSink sink{out};
+        detail::sink_int(sink, event.get_line());
     }
 };
 
@@ -204,6 +776,9 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << std::endl;
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.push_back('\n');
+    }
 };
 
 class StringFormatItem : public LogFormatter::FormatItem {
@@ -212,6 +787,9 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << m_string;
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.append(m_string);
+    }
 private:    
     std::string m_string;
 };
@@ -222,8 +800,53 @@ public:
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         os << '\t';
     }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        out.push_back('\t');
+    }
+};
+
+class FieldsFormatItem : public LogFormatter::FormatItem {
+public:
+    FieldsFormatItem(const std::string& str = "") {}
+    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+        detail::OstreamSink sink{os};
+        detail::sink_fields(sink, LogFormatter::FormatOp::ESCAPE_LOGFMT, false, *event);
+    }
+    void format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) {
+        detail::StringSink sink{out};
+        detail::sink_fields(sink, LogFormatter::FormatOp::ESCAPE_LOGFMT, false, event);
+    }
 };
 
+namespace {
+
+/**
+ * @brief %项到编译指令的映射，%T和%n编译为字面量
+ */
+const std::map<std::string, LogFormatter::FormatOp::Type>& get_format_ops() {
+    typedef LogFormatter::FormatOp FormatOp;
+    static const std::map<std::string, FormatOp::Type> s_format_ops = {
+#define XX(str, T) \
+    {#str, FormatOp::T}
+        XX(m, MESSAGE),
+        XX(p, LEVEL),
+        XX(r, ELAPSE),
+        XX(c, NAME),
+        XX(t, THREADID),
+        XX(d, DATE),
+        XX(f, FILENAME),
+        XX(l, LINE),
+        XX(F, FIBERID),
+        XX(N, THREADNAME),
+        XX(I, TRACEID),
+        XX(x, FIELDS),
+#undef XX
+    };
+    return s_format_ops;
+}
+
+}
+
 //%xxx %xxx{xxx} %%
 void LogFormatter::init() {
     //str   format  type
@@ -240,6 +863,7 @@ void LogFormatter::init() {
         //%%转义为%
         if (i+1 < m_pattern.size() && m_pattern[i+1] == '%') {
             nstr.append(1, '%');
+            ++i;
             continue;
         }
 
@@ -253,7 +877,7 @@ void LogFormatter::init() {
             //格式状态非0 && 不是字母 && 不是{和}
             //即碰到了空格，%xxxx格式
             if (!fmt_status && !isalpha(m_pattern[n]) 
-                    && m_pattern[n] != '}' && m_pattern[n] != '}') {
+                    && m_pattern[n] != '{' && m_pattern[n] != '}') {
                 str = m_pattern.substr(i+1, n-i-1);
                 break;
             }
@@ -324,9 +948,14 @@ void LogFormatter::init() {
         XX(T, TabFormatItem),               //T:Tab
         XX(F, FiberidFormatItem),           //F:协程id
         XX(N, ThreadnameFormatItem),        //N:线程名称
+        XX(I, TraceidFormatItem),           //I:跟踪id
+        XX(x, FieldsFormatItem),            //x:结构化字段
 #undef XX
     };
+    const std::map<std::string, FormatOp::Type>& ops = get_format_ops();
     for (auto& i : vec) {
+        auto op = std::get<2>(i) ? ops.find(std::get<0>(i)) : ops.end();
+        m_item_types.push_back(op == ops.end() ? FormatOp::STRING : op->second);
         if (std::get<2>(i) == 0) {
             m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
         }
@@ -341,8 +970,511 @@ void LogFormatter::init() {
             }
         }
     }
+    m_has_message = std::find(m_item_types.begin(), m_item_types.end(), FormatOp::MESSAGE) != m_item_types.end();
+    compile(vec);
 }
 
+void LogFormatter::compile(const std::vector<std::tuple<std::string, std::string, int>>& vec) {
+    const std::map<std::string, FormatOp::Type>& s_format_ops = get_format_ops();
+    if (m_style != PATTERN) {
+        m_compiled = true;
+        compile_structured(vec);
+        return;
+    }
 
+    m_ops.clear();
+    m_pool.clear();
+    //追加字面量，与前一条字面量指令相邻时直接合并
+    auto add_string = [this](const std::string& str) {
+        if (!m_ops.empty() && m_ops.back().type == FormatOp::STRING
+                && m_ops.back().offset + m_ops.back().len == m_pool.size()) {
+            m_ops.back().len += str.size();
+        } else {
+            m_ops.push_back(FormatOp{FormatOp::STRING, FormatOp::ESCAPE_NONE, (uint32_t)m_pool.size(), (uint32_t)str.size()});
+        }
+        m_pool.append(str);
+    };
 
-}
\ No newline at end of file
+    for (auto& i : vec) {
+        const std::string& str = std::get<0>(i);
+        if (std::get<2>(i) == 0) {
+            add_string(str);
+        } else if (str == "T") {
+            add_string("\t");
+        } else if (str == "n") {
+            add_string("\n");
+        } else {
+            auto it = s_format_ops.find(str);
+            if (it == s_format_ops.end()) {
+                add_string("<<error_format %" + str + ">>");
+            } else if (it->second == FormatOp::DATE) {
+                std::string fmt = std::get<1>(i);
+                if (fmt.empty()) {
+                    fmt = "%Y-%m-%d %H:%M:%S";
+                }
+                m_ops.push_back(FormatOp{FormatOp::DATE, FormatOp::ESCAPE_NONE, (uint32_t)m_pool.size(), (uint32_t)fmt.size()});
+                m_pool.append(fmt);
+                m_pool.append(1, '\0');
+            } else if (it->second == FormatOp::FIELDS) {
+                m_ops.push_back(FormatOp{FormatOp::FIELDS, FormatOp::ESCAPE_LOGFMT, 0, 0});
+            } else {
+                m_ops.push_back(FormatOp{it->second, FormatOp::ESCAPE_NONE, 0, 0});
+            }
+        }
+    }
+}
+
+void LogFormatter::compile_structured(const std::vector<std::tuple<std::string, std::string, int>>& vec) {
+    struct Member {
+        FormatOp::Type type;
+        const char* key;
+        //值是否是需要转义的字符串
+        bool text;
+    };
+    static const std::map<std::string, Member> s_members = {
+#define XX(str, T, key, text) \
+    {#str, Member{FormatOp::T, key, text}}
+        XX(d, DATE, "time", true),
+        XX(p, LEVEL, "level", false),
+        XX(r, ELAPSE, "elapse", false),
+        XX(c, NAME, "logger", true),
+        XX(t, THREADID, "thread", false),
+        XX(N, THREADNAME, "thread_name", true),
+        XX(F, FIBERID, "fiber", false),
+        XX(I, TRACEID, "trace_id", true),
+        XX(f, FILENAME, "file", true),
+        XX(l, LINE, "line", false),
+        XX(m, MESSAGE, "msg", true),
+        XX(x, FIELDS, "", false),
+#undef XX
+    };
+
+    bool json = m_style == JSON;
+    FormatOp::Escape escape = json ? FormatOp::ESCAPE_JSON : FormatOp::ESCAPE_LOGFMT;
+    m_ops.clear();
+    m_pool.clear();
+    auto add_string = [this](const std::string& str) {
+        if (!m_ops.empty() && m_ops.back().type == FormatOp::STRING
+                && m_ops.back().offset + m_ops.back().len == m_pool.size()) {
+            m_ops.back().len += str.size();
+        } else {
+            m_ops.push_back(FormatOp{FormatOp::STRING, FormatOp::ESCAPE_NONE, (uint32_t)m_pool.size(), (uint32_t)str.size()});
+        }
+        m_pool.append(str);
+    };
+
+    if (json) {
+        add_string("{");
+    }
+    bool first = true;
+    bool fields = false;
+    for (auto& i : vec) {
+        const std::string& str = std::get<0>(i);
+        if (std::get<2>(i) == 0 || str == "T" || str == "n") {
+            continue;
+        }
+        auto it = s_members.find(str);
+        if (it == s_members.end()) {
+            m_error = true;
+            continue;
+        }
+        const Member& m = it->second;
+        if (m.type == FormatOp::FIELDS) {
+            fields = true;
+            continue;
+        }
+        std::string head = first ? "" : (json ? "," : " ");
+        head += json ? std::string("\"") + m.key + "\":" : std::string(m.key) + "=";
+        //JSON中字符串和级别加引号，logfmt的字符串按需加引号
+        bool quoted = json && (m.text || m.type == FormatOp::LEVEL);
+        add_string(quoted ? head + "\"" : head);
+        FormatOp::Escape e = m.text ? escape : FormatOp::ESCAPE_NONE;
+        if (m.type == FormatOp::DATE) {
+            std::string fmt = std::get<1>(i);
+            if (fmt.empty()) {
+                fmt = "%Y-%m-%dT%H:%M:%S.%f%z";
+            }
+            m_ops.push_back(FormatOp{FormatOp::DATE, e, (uint32_t)m_pool.size(), (uint32_t)fmt.size()});
+            m_pool.append(fmt);
+            m_pool.append(1, '\0');
+        } else {
+            m_ops.push_back(FormatOp{m.type, e, 0, 0});
+        }
+        if (quoted) {
+            add_string("\"");
+        }
+        first = false;
+    }
+    if (fields) {
+        m_ops.push_back(FormatOp{FormatOp::FIELDS, escape, 0, first ? 0u : 1u});
+    }
+    add_string(json ? "}\n" : "\n");
+}
+
+void LogAppender::set_formatter(LogFormatter::ptr val) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_formatter = val;
+    m_needs_message.store(!val || val->has_message(), std::memory_order_relaxed);
+    m_formatter_version.fetch_add(1, std::memory_order_release);
+}
+
+LogFormatter::ptr LogAppender::get_formatter() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_formatter;
+}
+
+void StdoutLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_formatter) {
+        m_formatter->format(std::cout, logger, level, event);
+    }
+}
+
+void StdoutLogAppender::write(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::cout.write(data, len);
+}
+
+void StdoutLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::cout.flush();
+}
+
+void StdoutLogAppender::crash_write(const char* data, size_t len) {
+    LogCrashHandler::write_fd(STDOUT_FILENO, data, len);
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename)
+    :m_filename(filename)
+    ,m_filestream(&m_filebuf) {
+    reopen();
+}
+
+FileLogAppender::~FileLogAppender() {
+    if (m_crash_fd != -1) {
+        close(m_crash_fd);
+    }
+}
+
+void FileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_formatter) {
+        m_formatter->format(m_filestream, logger, level, event);
+    }
+}
+
+void FileLogAppender::write(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_filestream.write(data, len);
+}
+
+void FileLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_filestream.flush();
+}
+
+void FileLogAppender::crash_flush() {
+    size_t len;
+    const char* data = m_filebuf.get_pending(len);
+    if (data && len) {
+        LogCrashHandler::write_fd(m_crash_fd, data, len);
+    }
+}
+
+void FileLogAppender::crash_write(const char* data, size_t len) {
+    LogCrashHandler::write_fd(m_crash_fd, data, len);
+}
+
+bool FileLogAppender::reopen() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_filebuf.is_open()) {
+        m_filebuf.close();
+    }
+    if (m_crash_fd != -1) {
+        close(m_crash_fd);
+    }
+    m_filestream.clear();
+    if (!m_filebuf.open(m_filename, std::ios::out | std::ios::app)) {
+        m_filestream.setstate(std::ios::failbit);
+    }
+    m_crash_fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    return !!m_filestream;
+}
+
+Logger::Logger(const std::string& name)
+    :m_name(name)
+    ,m_metrics_id(LogMetrics::register_logger(name))
+    ,m_level(LogLevel::DEBUG)
+    ,m_routes(new RouteTable)
+    ,m_self(Logger::ptr(), this) {
+    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+}
+
+Logger::~Logger() {
+    //写日志时持有日志器的引用，析构时不会有读端
+    delete m_routes.load(std::memory_order_relaxed);
+}
+
+void Logger::log(LogLevel::Level level, const LogEvent::ptr& event) {
+    if (!is_enabled(level)) {
+        return;
+    }
+    bool to_root = false;
+    {
+        LogRcu::ReadGuard guard;
+        const RouteTable* table = m_routes.load(std::memory_order_acquire);
+        if (table->routes.empty() && m_root) {
+            to_root = true;
+        } else if ((unsigned)level <= LogLevel::FATAL) {
+            for (LogAppender* i : table->levels[level]) {
+                i->log(m_self, level, event);
+            }
+        }
+    }
+    if (to_root) {
+        m_root->log(level, event);
+        return;
+    }
+    //flush可能等待后台线程，离开读区间后再调用
+    if (level == LogLevel::FATAL) {
+        LoggerManager::get_instance()->flush_all();
+    }
+}
+
+bool Logger::needs_message(LogLevel::Level level) const {
+    LogRcu::ReadGuard guard;
+    const RouteTable* table = m_routes.load(std::memory_order_acquire);
+    if (table->routes.empty()) {
+        return m_root && m_root->needs_message(level);
+    }
+    if ((unsigned)level > LogLevel::FATAL) {
+        return false;
+    }
+    for (LogAppender* i : table->levels[level]) {
+        if (level >= i->get_level() && i->needs_message()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::on_exit() {
+    std::vector<Route> routes = get_routes();
+    for (auto& i : routes) {
+        i.appender->on_exit();
+    }
+}
+
+void Logger::crash_flush() {
+    //崩溃处理中不进入读区间，路由表正被替换时可能读到已释放的表
+    const RouteTable* table = m_routes.load(std::memory_order_acquire);
+    for (auto& i : table->routes) {
+        LogCrashHandler::flush_appender(i.appender.get(), true);
+    }
+}
+
+void Logger::crash_write(LogLevel::Level level, const char* data, size_t len) {
+    const RouteTable* table = m_routes.load(std::memory_order_acquire);
+    if (table->routes.empty()) {
+        if (m_root) {
+            m_root->crash_write(level, data, len);
+        }
+        return;
+    }
+    if ((unsigned)level > LogLevel::FATAL) {
+        return;
+    }
+    for (LogAppender* i : table->levels[level]) {
+        if (level >= i->get_level()) {
+            i->crash_write(data, len);
+        }
+    }
+}
+
+void Logger::debug(const LogEvent::ptr& event) {
+    log(LogLevel::DEBUG, event);
+}
+
+void Logger::info(const LogEvent::ptr& event) {
+    log(LogLevel::INFO, event);
+}
+
+void Logger::warn(const LogEvent::ptr& event) {
+    log(LogLevel::WARN, event);
+}
+
+void Logger::error(const LogEvent::ptr& event) {
+    log(LogLevel::ERROR, event);
+}
+
+void Logger::fatal(const LogEvent::ptr& event) {
+    log(LogLevel::FATAL, event);
+}
+
+void Logger::publish(std::vector<Route>&& routes) {
+    RouteTable* table = new RouteTable;
+    table->routes.swap(routes);
+    for (auto& i : table->routes) {
+        for (int l = i.level; l <= LogLevel::FATAL; ++l) {
+            table->levels[l].push_back(i.appender.get());
+        }
+    }
+    LogRcu::retire(m_routes.exchange(table, std::memory_order_acq_rel));
+}
+
+void Logger::add_appender(LogAppender::ptr appender, LogLevel::Level level) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!appender->get_formatter()) {
+        appender->set_formatter(m_formatter);
+    }
+    std::vector<Route> routes = m_routes.load(std::memory_order_relaxed)->routes;
+    routes.push_back(Route{appender, level});
+    publish(std::move(routes));
+}
+
+void Logger::del_appender(LogAppender::ptr appender) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Route> routes = m_routes.load(std::memory_order_relaxed)->routes;
+    for (auto it = routes.begin(); it != routes.end(); ++it) {
+        if (it->appender == appender) {
+            routes.erase(it);
+            publish(std::move(routes));
+            break;
+        }
+    }
+}
+
+void Logger::clear_appenders() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    publish(std::vector<Route>());
+}
+
+bool Logger::set_appender_level(LogAppender::ptr appender, LogLevel::Level level) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Route> routes = m_routes.load(std::memory_order_relaxed)->routes;
+    for (auto& i : routes) {
+        if (i.appender == appender) {
+            i.level = level;
+            publish(std::move(routes));
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::set_routes(const std::vector<Route>& routes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Route> copy;
+    for (auto& i : routes) {
+        if (!i.appender) {
+            continue;
+        }
+        if (!i.appender->get_formatter()) {
+            i.appender->set_formatter(m_formatter);
+        }
+        copy.push_back(i);
+    }
+    publish(std::move(copy));
+}
+
+std::vector<Logger::Route> Logger::get_routes() const {
+    LogRcu::ReadGuard guard;
+    return m_routes.load(std::memory_order_acquire)->routes;
+}
+
+void Logger::flush() {
+    uint64_t begin = LogMetrics::timer_begin();
+    //flush可能等待后台线程，不在读区间内调用
+    std::vector<Route> routes = get_routes();
+    for (auto& i : routes) {
+        i.appender->flush();
+    }
+    LogMetrics::add(LogMetrics::FLUSHES);
+    LogMetrics::timer_end(LogMetrics::FLUSH_NS, begin);
+}
+
+void Logger::set_formatter(LogFormatter::ptr val) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_formatter = val;
+}
+
+void Logger::set_formatter(const std::string& val) {
+    LogFormatter::ptr formatter(new LogFormatter(val));
+    if (formatter->is_error()) {
+        std::cout << "Logger set_formatter name=" << m_name
+                  << " value=" << val << " invalid formatter" << std::endl;
+        return;
+    }
+    set_formatter(formatter);
+}
+
+LogFormatter::ptr Logger::get_formatter() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_formatter;
+}
+
+LoggerManager::LoggerManager() {
+    m_root.reset(new Logger);
+    m_root->add_appender(LogAppender::ptr(new StdoutLogAppender));
+    m_snapshots.emplace_back(new LoggerMap{{m_root->get_name(), m_root}});
+    m_loggers.store(m_snapshots.back().get(), std::memory_order_release);
+    //实例不析构，退出时只需要写完缓冲的日志
+    atexit([]() {
+        LoggerManager::get_instance()->flush_all();
+        LoggerManager::get_instance()->exit_all();
+    });
+}
+
+void LoggerManager::flush_all() {
+    const LoggerMap* loggers = m_loggers.load(std::memory_order_acquire);
+    for (auto& i : *loggers) {
+        i.second->flush();
+    }
+}
+
+void LoggerManager::exit_all() {
+    const LoggerMap* loggers = m_loggers.load(std::memory_order_acquire);
+    for (auto& i : *loggers) {
+        i.second->on_exit();
+    }
+}
+
+void LoggerManager::crash_flush() {
+    const LoggerMap* loggers = m_loggers.load(std::memory_order_acquire);
+    for (auto& i : *loggers) {
+        i.second->crash_flush();
+    }
+}
+
+Logger::ptr LoggerManager::find_logger(const std::string& name) const {
+    const LoggerMap* loggers = m_loggers.load(std::memory_order_acquire);
+    auto it = loggers->find(name);
+    return it == loggers->end() ? nullptr : it->second;
+}
+
+Logger::ptr LoggerManager::get_logger(const std::string& name) {
+    if (Logger::ptr logger = find_logger(name)) {
+        return logger;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const LoggerMap* loggers = m_loggers.load(std::memory_order_relaxed);
+    auto it = loggers->find(name);
+    if (it != loggers->end()) {
+        return it->second;
+    }
+    Logger::ptr logger(new Logger(name));
+    logger->m_root = m_root;
+    std::unique_ptr<LoggerMap> snapshot(new LoggerMap(*loggers));
+    (*snapshot)[name] = logger;
+    m_loggers.store(snapshot.get(), std::memory_order_release);
+    m_snapshots.push_back(std::move(snapshot));
+    return logger;
+}
+
+}
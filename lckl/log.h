@@ -4,7 +4,107 @@
 #include <string>
 #include <memory>
 #include <sstream>
+#include <fstream>
+#include <mutex>
 #include <vector>
+#include "log_stream.h"
+#include <tuple>
+#include <stdint.h>
+#include <time.h>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include <string.h>
+#include <type_traits>
+#include "number_format.h"
+#include "log_rcu.h"
+#include "singleton.h"
+#include "util.h"
+
+/**
+ * @brief 编译期最低日志级别，低于该级别的日志语句在编译后被完全移除
+ */
+#ifndef LCKL_LOG_MIN_LEVEL
+#define LCKL_LOG_MIN_LEVEL 1
+#endif
+
+/**
+ * @brief 使用流式方式将日志级别level的日志写入到logger
+ * @details 先判断级别再构造事件，未开启的级别只有一次原子读和一次分支
+ */
+#define LCKL_LOG_LEVEL(logger, level) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1)) {} \
+    else lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).get_ss()
+
+#define LCKL_LOG_DEBUG(logger) LCKL_LOG_LEVEL(logger, lckl::LogLevel::DEBUG)
+#define LCKL_LOG_INFO(logger) LCKL_LOG_LEVEL(logger, lckl::LogLevel::INFO)
+#define LCKL_LOG_WARN(logger) LCKL_LOG_LEVEL(logger, lckl::LogLevel::WARN)
+#define LCKL_LOG_ERROR(logger) LCKL_LOG_LEVEL(logger, lckl::LogLevel::ERROR)
+#define LCKL_LOG_FATAL(logger) LCKL_LOG_LEVEL(logger, lckl::LogLevel::FATAL)
+
+/**
+ * @brief 使用格式化方式将日志级别level的日志写入到logger
+ */
+#define LCKL_LOG_FMT_LEVEL(logger, level, fmt, ...) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1)) {} \
+    else lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).get_event()->format(fmt, ##__VA_ARGS__)
+
+#define LCKL_LOG_FMT_DEBUG(logger, fmt, ...) LCKL_LOG_FMT_LEVEL(logger, lckl::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_INFO(logger, fmt, ...) LCKL_LOG_FMT_LEVEL(logger, lckl::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_WARN(logger, fmt, ...) LCKL_LOG_FMT_LEVEL(logger, lckl::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_ERROR(logger, fmt, ...) LCKL_LOG_FMT_LEVEL(logger, lckl::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_FATAL(logger, fmt, ...) LCKL_LOG_FMT_LEVEL(logger, lckl::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+/**
+ * @brief 带结构化字段的日志，返回LogEvent&
+ * @details LCKL_LOG_KV_INFO(logger).with("user", id).with("cost_ms", 1.25).get_ss() << "request done";
+ */
+#define LCKL_LOG_KV_LEVEL(logger, level) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1)) {} \
+    else (*lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).get_event())
+
+#define LCKL_LOG_KV_DEBUG(logger) LCKL_LOG_KV_LEVEL(logger, lckl::LogLevel::DEBUG)
+#define LCKL_LOG_KV_INFO(logger) LCKL_LOG_KV_LEVEL(logger, lckl::LogLevel::INFO)
+#define LCKL_LOG_KV_WARN(logger) LCKL_LOG_KV_LEVEL(logger, lckl::LogLevel::WARN)
+#define LCKL_LOG_KV_ERROR(logger) LCKL_LOG_KV_LEVEL(logger, lckl::LogLevel::ERROR)
+#define LCKL_LOG_KV_FATAL(logger) LCKL_LOG_KV_LEVEL(logger, lckl::LogLevel::FATAL)
+
+/**
+ * @brief 参数惰性求值的日志
+ * @details 参数可以是无参的可调用对象(结果用operator<<写入)、接受LogStream&的可调用对象或普通值，
+ *          级别判断通过且该级别的某个Appender的模板含%m时才求值，例如
+ *          LCKL_LOG_LAZY_DEBUG(logger, "state: ", [&]() { return obj.dump(); });
+ */
+#define LCKL_LOG_LAZY_LEVEL(logger, level, ...) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1)) {} \
+    else lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).lazy(__VA_ARGS__)
+
+#define LCKL_LOG_LAZY_DEBUG(logger, ...) LCKL_LOG_LAZY_LEVEL(logger, lckl::LogLevel::DEBUG, __VA_ARGS__)
+#define LCKL_LOG_LAZY_INFO(logger, ...) LCKL_LOG_LAZY_LEVEL(logger, lckl::LogLevel::INFO, __VA_ARGS__)
+#define LCKL_LOG_LAZY_WARN(logger, ...) LCKL_LOG_LAZY_LEVEL(logger, lckl::LogLevel::WARN, __VA_ARGS__)
+#define LCKL_LOG_LAZY_ERROR(logger, ...) LCKL_LOG_LAZY_LEVEL(logger, lckl::LogLevel::ERROR, __VA_ARGS__)
+#define LCKL_LOG_LAZY_FATAL(logger, ...) LCKL_LOG_LAZY_LEVEL(logger, lckl::LogLevel::FATAL, __VA_ARGS__)
+
+/**
+ * @brief 获取主日志器
+ */
+#define LCKL_LOG_ROOT() lckl::LoggerManager::get_instance()->get_root()
+
+/**
+ * @brief 获取名称为name的日志器，不存在时创建
+ */
+#define LCKL_LOG_NAME(name) lckl::LoggerManager::get_instance()->get_logger(name)
+
+/**
+ * @brief 获取名称为name的日志器，结果缓存在调用点的函数内静态变量中
+ * @details 每个调用点只查找一次，之后只有一次静态变量初始化检查，
+ *          name必须是常量，调用点之间互不影响
+ */
+#define LCKL_LOG_NAME_CACHED(name) \
+    ([]() -> const lckl::Logger::ptr& { \
+        static const lckl::Logger::ptr s_lckl_logger = LCKL_LOG_NAME(name); \
+        return s_lckl_logger; \
+    }())
 
 namespace lckl {
 
@@ -43,17 +143,52 @@ public:
     static LogLevel::Level from_string(const std::string& str);
 };
 
+/**
+ * @brief 日志的结构化字段
+ * @details 字符串值拷贝到事件的字段缓冲区，这里只记录偏移和长度
+ */
+struct LogField {
+    enum Type : uint8_t {
+        INT64 = 0,
+        UINT64,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+    struct Str {
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    //字段名，需长期有效(通常是字符串字面量)
+    const char* key;
+    Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+        Str str;
+    };
+};
+
 /**
  * @brief 日志事件
+ * @details 按缓存行布局：格式化每条日志都要读取的固定字段放在对齐的第一个64字节行内，
+ *          日志内容缓冲区紧随其后，延迟日志参数和结构化字段等少用的字段放在最后。
+ *          日志器和线程名只保存指针，不持有日志器的引用，创建和释放事件时
+ *          不会对多个线程共享的引用计数做原子加减
  */
-class LogEvent {
+class alignas(64) LogEvent {
 public:
     typedef std::shared_ptr<LogEvent> ptr;
+    //固定字段所占的字节数，日志内容从此偏移开始
+    static const size_t HEADER_SIZE = 64;
 
     /**
      * @brief Construct a new Log Event object
      * 
-     * @param logger 日志器
+     * @param logger 日志器，事件只保存指针，使用期间需保持有效
      * @param level 日志级别
      * @param file 文件名
      * @param line 行号
@@ -61,12 +196,25 @@ public:
      * @param threadid 线程号
      * @param fiberid 协程号
      * @param time 时间戳
-     * @param threadname 线程名
+     * @param threadname 线程名，会被换成intern_thread_name()返回的常驻字符串
+     * @param usec 时间戳的微秒部分
      */
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
             ,const char* file, int32_t line, uint32_t elapse
             ,uint32_t threadid, uint32_t fiberid, uint64_t time
-            ,const std::string& threadname);
+            ,const std::string& threadname, uint32_t usec = 0);
+
+    /**
+     * @brief 从当前线程的事件池创建事件，填充线程、协程和时间信息
+     * @details 有日志上下文时协程id和跟踪id取自当前上下文
+     * 
+     * @param logger 日志器
+     * @param level 日志级别
+     * @param file 文件名
+     * @param line 行号
+     */
+    static LogEvent::ptr create(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+                               ,const char* file, int32_t line);
     
     /**
      * @brief Get the file name
@@ -92,26 +240,43 @@ public:
      * @brief Get the time
      */
     uint64_t get_time() const { return m_time; }
+    /**
+     * @brief Get the 时间戳的微秒部分
+     */
+    uint32_t get_usec() const { return m_usec; }
     /**
      * @brief Get the threadname 
      */
-    const std::string& get_threadname() const { return m_threadname; }
+    const std::string& get_threadname() const { return *m_threadname; }
     /**
      * @brief Get the 日志内容字符串流 
      */
-    std::stringstream& get_ss() { return m_ss; }
+    LogStream& get_ss() { return m_ss; }
     /**
      * @brief 返回日志内容
     */
    std::string get_content() const { return m_ss.str(); }
+    /**
+     * @brief 返回日志内容，不拷贝
+     */
+    std::string_view get_content_view() const { return m_ss.view(); }
     /**
      * @brief Get the logger
+     * @details 不持有引用，需要在事件之后继续使用日志器时用shared_from_this()
      */
-    std::shared_ptr<Logger> get_logger() const { return m_logger; }
+    Logger* get_logger() const { return m_logger; }
     /**
      * @brief Get the level 
      */
     LogLevel::Level get_level() const { return m_level; }
+    /**
+     * @brief 跟踪id，为空表示没有
+     */
+    std::string_view get_trace_id() const { return std::string_view(m_trace_id, m_trace_id_len); }
+    /**
+     * @brief 设置跟踪id，超出LogContext::TRACE_ID_SIZE的部分被截断
+     */
+    void set_trace_id(std::string_view v);
     /**
      * @brief 格式化写入日志内容
      */
@@ -120,10 +285,103 @@ public:
      * @brief 格式化写入日志内容
      */
     void format(const char* fmt, va_list al);
+    /**
+     * @brief 保存延迟日志的printf格式和编码后的参数，供二进制Appender原样落盘
+     *
+     * @param fmt printf格式，需长期有效
+     * @param types 参数类型编码，需长期有效
+     * @param args 编码后的参数，会被拷贝
+     * @param len 参数长度
+     */
+    void set_args(const char* fmt, const char* types, const char* args, size_t len);
+    /**
+     * @brief 延迟日志的printf格式，普通日志为nullptr
+     */
+    const char* get_fmt() const { return m_fmt; }
+    /**
+     * @brief 延迟日志的参数类型编码
+     */
+    const char* get_arg_types() const { return m_arg_types; }
+    /**
+     * @brief 延迟日志编码后的参数
+     */
+    std::string_view get_args() const { return m_args; }
+
+    /**
+     * @brief 添加结构化字段
+     * @details 支持整数、枚举、浮点数、bool和字符串，字符串会被拷贝。
+     *          字段和字符串值存放在事件内的缓冲区中，事件从池中复用时保留已申请的内存
+     *
+     * @param key 字段名，需长期有效
+     */
+    template<class T>
+    LogEvent& with(const char* key, const T& v) {
+        typedef typename std::decay<T>::type type;
+        LogField f;
+        f.key = key;
+        if constexpr (std::is_same<type, bool>::value) {
+            f.type = LogField::BOOL;
+            f.b = v;
+        } else if constexpr (std::is_floating_point<type>::value) {
+            f.type = LogField::DOUBLE;
+            f.d = v;
+        } else if constexpr (std::is_enum<type>::value || std::is_signed<type>::value) {
+            f.type = LogField::INT64;
+            f.i = (int64_t)v;
+        } else if constexpr (std::is_integral<type>::value) {
+            f.type = LogField::UINT64;
+            f.u = v;
+        } else {
+            std::string_view str;
+            if constexpr (std::is_pointer<type>::value) {
+                const char* p = v;
+                str = p ? std::string_view(p) : std::string_view();
+            } else {
+                str = v;
+            }
+            f.type = LogField::STRING;
+            f.str.offset = m_field_data.size();
+            f.str.len = str.size();
+            m_field_data.append(str.data(), str.size());
+        }
+        m_fields.push_back(f);
+        return *this;
+    }
+    /**
+     * @brief 结构化字段
+     */
+    const std::vector<LogField>& get_fields() const { return m_fields; }
+    /**
+     * @brief 字符串字段的值
+     */
+    std::string_view get_field_string(const LogField& f) const {
+        return std::string_view(m_field_data.data() + f.str.offset, f.str.len);
+    }
 
 private:
+    friend class LogEventPool;
+    /**
+     * @brief 复用事件对象时重新初始化，保留内容缓冲区已申请的内存
+     * @param logger 日志器，只保存指针
+     * @param threadname 常驻的线程名，只保存指针
+     */
+    void reset(Logger* logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t threadid, uint32_t fiberid, uint64_t time
+            ,const std::string* threadname, uint32_t usec);
+
+private:
+    //固定字段，共HEADER_SIZE字节
+    //时间戳
+    uint64_t m_time = 0;
     //文件名
     const char* m_file;
+    //日志器，不持有引用
+    Logger* m_logger;
+    //线程名，指向常驻字符串
+    const std::string* m_threadname;
+    //延迟日志的printf格式
+    const char* m_fmt = nullptr;
     //行号
     int32_t m_line = 0;
     //程序运行的时间
@@ -132,18 +390,107 @@ private:
     uint32_t m_threadid = 0;
     //协程id
     uint32_t m_fiberid = 0;
-    //时间戳
-    uint64_t m_time = 0;
-    //线程名
-    std::string m_threadname;
-    //日志内容流
-    std::stringstream m_ss;
-    //日志器
-    std::shared_ptr<Logger> m_logger;
+    //时间戳的微秒部分
+    uint32_t m_usec = 0;
     //日志等级
     LogLevel::Level m_level;
+
+    //日志内容流，内置缓冲区紧随固定字段
+    LogStream m_ss;
+
+    //少用的字段
+    //延迟日志的参数类型编码
+    const char* m_arg_types = nullptr;
+    uint8_t m_trace_id_len = 0;
+    //延迟日志编码后的参数
+    std::string m_args;
+    //结构化字段
+    std::vector<LogField> m_fields;
+    //字符串字段的值
+    std::string m_field_data;
+    //跟踪id
+    char m_trace_id[LogContext::TRACE_ID_SIZE];
+};
+
+/**
+ * @brief 线程内的时间文本缓存
+ * @details 按(秒, 时间格式)缓存localtime_r/strftime的结果，同一秒内的日志
+ *          只需拷贝缓存文本。格式中的%L(毫秒，3位)、%f(微秒，6位)在缓存中
+ *          预留位置，每次直接写入数字
+ */
+class LogDateCache {
+public:
+    /**
+     * @brief 返回格式化后的时间文本
+     * 
+     * @param fmt 时间格式，以'\0'结尾
+     * @param sec 秒级时间戳
+     * @param usec 微秒部分
+     * @param len 返回文本长度
+     * @return const char* 线程内缓存的文本，下次调用前有效
+     */
+    static const char* format(const char* fmt, time_t sec, uint32_t usec, size_t& len);
+};
+
+namespace detail {
+
+/**
+ * @brief 格式化输出到std::ostream
+ */
+struct OstreamSink {
+    std::ostream& os;
+    //写入的字节数
+    size_t len = 0;
+    void append(const char* str, size_t n) {
+        os.write(str, n);
+        len += n;
+    }
 };
 
+/**
+ * @brief 格式化追加到std::string
+ */
+struct StringSink {
+    std::string& str;
+    void append(const char* data, size_t len) { str.append(data, len); }
+};
+
+/**
+ * @brief 格式化写入定长缓冲区，超出部分只计长度不写入
+ */
+struct SpanSink {
+    char* buf;
+    size_t size;
+    size_t len;
+    void append(const char* data, size_t n) {
+        if (len < size) {
+            memcpy(buf + len, data, n < size - len ? n : size - len);
+        }
+        len += n;
+    }
+};
+
+template<class Sink>
+inline void sink_cstr(Sink& sink, const char* str) {
+    if (str) {
+        sink.append(str, strlen(str));
+    }
+}
+
+template<class Sink, class T>
+inline void sink_int(Sink& sink, T v) {
+    char buf[number_format::INT_SIZE];
+    sink.append(buf, number_format::format_integer(buf, v) - buf);
+}
+
+template<class Sink>
+inline void sink_cached_id(Sink& sink, number_format::CachedIdType type, uint32_t id) {
+    std::string_view text = number_format::cached_id_text(type, id);
+    sink.append(text.data(), text.size());
+}
+
+}
+
 /**
  * @brief 日志事件包装器
  */
@@ -166,7 +513,33 @@ public:
     /**
      * @brief Get the 日志内容流
      */
-    std::stringstream& get_ss();
+    LogStream& get_ss();
+    /**
+     * @brief 日志内容会被输出时依次对参数求值并写入，见LCKL_LOG_LAZY_LEVEL
+     */
+    template<class... Args>
+    void lazy(Args&&... args) {
+        if (is_message_needed()) {
+            LogStream& ss = get_ss();
+            (append_lazy(ss, std::forward<Args>(args)), ...);
+        }
+    }
+    /**
+     * @brief 事件的日志器在该级别下是否会输出日志内容
+     */
+    bool is_message_needed() const;
+
+private:
+    template<class T>
+    static void append_lazy(LogStream& ss, T&& v) {
+        if constexpr (std::is_invocable<T, LogStream&>::value) {
+            v(ss);
+        } else if constexpr (std::is_invocable<T>::value) {
+            ss << v();
+        } else {
+            ss << v;
+        }
+    }
 
 private:
     //日志事件
@@ -179,6 +552,22 @@ private:
 class LogFormatter {
 public:
     typedef std::shared_ptr<LogFormatter> ptr;
+
+    /**
+     * @brief 输出风格
+     * @details JSON/LOGFMT风格下模板中的字面量、%T和%n被忽略，每个%项输出为一个键值对：
+     *          %d time、%p level、%r elapse、%c logger、%t thread、%N thread_name、
+     *          %F fiber、%I trace_id、%f file、%l line、%m msg，%x的字段总是在最后；
+     *          每条日志一行，字符串按JSON/logfmt规则转义，%d默认为ISO 8601格式
+     */
+    enum Style {
+        //%模板
+        PATTERN = 0,
+        //每行一个JSON对象
+        JSON,
+        //key=value，值含空格等字符时加引号
+        LOGFMT
+    };
     /**
      * @brief Construct a new Log Formatter object
      * 
@@ -189,15 +578,18 @@ public:
      * %c日志名称
      * %t线程id
      * %n换行
-     * %d时间
+     * %d时间，{}内为strftime格式，另支持%L毫秒、%f微秒
      * %f文件名
      * %l行号
      * %T制表符
      * %F协程id
      * %N线程名称
+     * %I跟踪id，没有时为空
+     * %x结构化字段，按logfmt格式输出 k=v k2="v 2"
      * 默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
+     * @param style 输出风格，JSON/LOGFMT时模板只用来选择输出哪些项，见Style
      */
-    LogFormatter(const std::string& pattern);
+    LogFormatter(const std::string& pattern, Style style = PATTERN);
     /**
      * @brief 返回格式化日志文本
      * 
@@ -205,10 +597,32 @@ public:
      * @param level 日志级别
      * @param event 日志事件
      */
-    std::string format(std::shared_ptr<Logger> logger
-                ,LogLevel::Level level, LogEvent::ptr event);
-    std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger
-                ,LogLevel::Level level, LogEvent::ptr event);
+    std::string format(const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent::ptr& event);
+    std::ostream& format(std::ostream& ofs, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent::ptr& event);
+    /**
+     * @brief 返回格式化日志文本，事件以引用传入，不产生引用计数操作
+     */
+    std::string format(const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event);
+    std::ostream& format(std::ostream& ofs, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event);
+    /**
+     * @brief 格式化日志追加到out末尾，不产生临时字符串
+     * @return 写入的字节数
+     */
+    size_t format(std::string& out, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event);
+    /**
+     * @brief 格式化日志写入定长缓冲区，不写'\0'
+     * 
+     * @param buf 缓冲区
+     * @param size 缓冲区大小
+     * @return 日志的完整长度，大于size时缓冲区只写入了前size字节
+     */
+    size_t format(char* buf, size_t size, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event);
 
 public: 
     /**
@@ -228,12 +642,68 @@ public:
              */
             virtual void format(std::ostream& os, std::shared_ptr<Logger> logger
                                 ,LogLevel::Level level, LogEvent::ptr event) = 0;
+            /**
+             * @brief 格式化日志追加到字符串，不经过std::ostream
+             * @details 默认实现借助ostringstream转调流接口，内置的项都有直接实现
+             */
+            virtual void format(std::string& out, const std::shared_ptr<Logger>& logger
+                                ,LogLevel::Level level, const LogEvent& event);
+    };
+
+    /**
+     * @brief 编译后的格式化指令
+     * @details 模板被编译为连续的指令数组，字面量与%d{}参数统一存放在
+     *          m_pool 中，指令只记录偏移和长度
+     */
+    struct FormatOp {
+        enum Type : uint8_t {
+            STRING = 0,     //字面量
+            MESSAGE,        //%m
+            LEVEL,          //%p
+            ELAPSE,         //%r
+            NAME,           //%c
+            THREADID,       //%t
+            DATE,           //%d
+            FILENAME,       //%f
+            LINE,           //%l
+            FIBERID,        //%F
+            THREADNAME,     //%N
+            TRACEID,        //%I
+            FIELDS          //%x
+        };
+        /**
+         * @brief 文本项的转义方式
+         */
+        enum Escape : uint8_t {
+            ESCAPE_NONE = 0,
+            ESCAPE_JSON,
+            ESCAPE_LOGFMT
+        };
+        Type type;
+        //文本项的转义方式，FIELDS的输出格式
+        Escape escape;
+        //m_pool中的偏移
+        uint32_t offset;
+        //m_pool中的长度，FIELDS为1时字段前需要分隔符
+        uint32_t len;
     };
 
     /**
      * @brief 初始化，解析日志模板
      */
     void init();
+    /**
+     * @brief 是否使用编译后的指令格式化(默认开启)
+     */
+    bool is_compiled() const { return m_compiled; }
+    /**
+     * @brief 设置是否使用编译后的指令格式化，关闭则走FormatItem虚函数路径
+     */
+    void set_compiled(bool v) { m_compiled = v || m_style != PATTERN; }
+    /**
+     * @brief 输出风格
+     */
+    Style get_style() const { return m_style; }
     /**
      * @brief 是否有错误
      */
@@ -242,24 +712,436 @@ public:
      * @brief 返回日志模板
      */
     const std::string get_pattern() const { return m_pattern; }
+    /**
+     * @brief 模板是否输出日志内容(%m)
+     */
+    bool has_message() const { return m_has_message; }
     
+private:
+    /**
+     * @brief 执行编译后的指令
+     * @tparam Sink 输出目标，见detail::OstreamSink等
+     */
+    template<class Sink>
+    void run(Sink& sink, LogLevel::Level level, const LogEvent& event) const;
+    /**
+     * @brief run的实现
+     * @tparam Timed 是否统计每条指令的耗时
+     */
+    template<bool Timed, class Sink>
+    void run_ops(Sink& sink, LogLevel::Level level, const LogEvent& event) const;
+    /**
+     * @brief 依次调用FormatItem，开启统计时记录每项的耗时
+     */
+    template<class Out, class Event>
+    void run_items(Out& out, const std::shared_ptr<Logger>& logger
+                  ,LogLevel::Level level, const Event& event) const;
+    /**
+     * @brief 未编译时输出到流，经字符串中转以统计写入的字节数
+     */
+    std::ostream& format_items(std::ostream& ofs, const std::shared_ptr<Logger>& logger
+                              ,LogLevel::Level level, const LogEvent& event, uint64_t begin) const;
+    /**
+     * @brief 将init()解析出的模板项编译为指令数组
+     * @param vec 解析结果 (str, format, type)
+     */
+    void compile(const std::vector<std::tuple<std::string, std::string, int>>& vec);
+    /**
+     * @brief JSON/LOGFMT风格的编译
+     */
+    void compile_structured(const std::vector<std::tuple<std::string, std::string, int>>& vec);
+
 private:
     std::string m_pattern;
+    Style m_style;
     std::vector<FormatItem::ptr> m_items;
+    //每个FormatItem对应的FormatOp::Type，用于耗时统计
+    std::vector<uint8_t> m_item_types;
+    //编译后的指令
+    std::vector<FormatOp> m_ops;
+    //字面量字符串池
+    std::string m_pool;
     bool m_error = false;
+    bool m_compiled = true;
+    //模板中有%m
+    bool m_has_message = false;
+};
+
+/**
+ * @brief 每行输出一个JSON对象的格式化器
+ */
+class JsonLogFormatter : public LogFormatter {
+public:
+    JsonLogFormatter(const std::string& pattern = "%d%p%c%t%N%F%f%l%m%x")
+        :LogFormatter(pattern, JSON) {
+    }
+};
+
+/**
+ * @brief 按logfmt输出的格式化器
+ */
+class LogfmtLogFormatter : public LogFormatter {
+public:
+    LogfmtLogFormatter(const std::string& pattern = "%d%p%c%t%N%F%f%l%m%x")
+        :LogFormatter(pattern, LOGFMT) {
+    }
 };
 
 /**
  * @brief 日志输出器
 */
 class LogAppender {
+public:
+    typedef std::shared_ptr<LogAppender> ptr;
+    virtual ~LogAppender() {}
+
+    /**
+     * @brief 格式化并输出日志
+     * @details Logger传入的logger不持有引用，只在调用期间有效，
+     *          需要保留到调用之后时用logger->shared_from_this()
+     * 
+     * @param logger 日志器
+     * @param level 日志级别
+     * @param event 日志事件
+     */
+    virtual void log(const std::shared_ptr<Logger>& logger
+                    ,LogLevel::Level level, const LogEvent::ptr& event) = 0;
+    /**
+     * @brief 输出已格式化的日志文本
+     */
+    virtual void write(const char* data, size_t len) = 0;
+    /**
+     * @brief 将缓冲的日志写到目标
+     */
+    virtual void flush() {}
+    /**
+     * @brief 作为下游时，上游的后台线程空闲时调用(最长约100ms一次)，用于重试未写出的数据
+     */
+    virtual void on_tick() {}
+    /**
+     * @brief 进程正常退出时由LoggerManager在flush_all之后调用，用于收尾(如截掉预分配的文件)
+     * @details 可能被调用多次，之后仍可能有日志写入(其它atexit函数、静态对象析构)，实现需要继续处理。
+     *          包装其他Appender的Appender对下游调用
+     */
+    virtual void on_exit() {}
+    /**
+     * @brief 是否输出日志内容，为false时惰性日志不构造内容
+     * @details 默认由格式化器的模板决定，没有格式化器时为true
+     */
+    virtual bool needs_message() const { return m_needs_message.load(std::memory_order_relaxed); }
+    /**
+     * @brief 崩溃时由LogCrashHandler调用，写出已缓冲、尚未写到目标的日志
+     * @details 只能使用异步信号安全的函数，不加锁、不申请内存
+     */
+    virtual void crash_flush() {}
+    /**
+     * @brief 崩溃时写入已格式化的文本，要求同crash_flush，默认丢弃
+     */
+    virtual void crash_write(const char* data, size_t len) {}
+
+    /**
+     * @brief Set the formatter
+     */
+    virtual void set_formatter(LogFormatter::ptr val);
+    /**
+     * @brief Get the formatter
+     */
+    LogFormatter::ptr get_formatter();
+    /**
+     * @brief 格式化器版本，每次set_formatter加1
+     * @details 调用方可以缓存格式化器，版本不变时不必加锁重新获取
+     */
+    uint32_t get_formatter_version() const { return m_formatter_version.load(std::memory_order_acquire); }
+    /**
+     * @brief Get the level
+     */
+    LogLevel::Level get_level() const { return m_level; }
+    /**
+     * @brief Set the level
+     */
+    void set_level(LogLevel::Level val) { m_level = val; }
+
+protected:
+    //日志级别
+    LogLevel::Level m_level = LogLevel::DEBUG;
+    //互斥锁
+    std::mutex m_mutex;
+    //日志格式化器
+    LogFormatter::ptr m_formatter;
+    std::atomic<uint32_t> m_formatter_version{0};
+    //当前格式化器的模板含%m
+    std::atomic<bool> m_needs_message{true};
+};
 
+/**
+ * @brief 输出到控制台的Appender
+ */
+class StdoutLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<StdoutLogAppender> ptr;
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    void flush() override;
+    /**
+     * @brief 直接写到标准输出的文件描述符，std::cout中的缓冲不写出
+     */
+    void crash_write(const char* data, size_t len) override;
 };
 
-class Logger {
+/**
+ * @brief 输出到文件的Appender
+ */
+class FileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<FileLogAppender> ptr;
+    FileLogAppender(const std::string& filename);
+    ~FileLogAppender();
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    void flush() override;
+    /**
+     * @brief 写出文件流缓冲中的数据
+     */
+    void crash_flush() override;
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 重新打开日志文件
+     * @return 成功返回true
+     */
+    bool reopen();
+
+private:
+    /**
+     * @brief 可以取出未写出数据的文件缓冲
+     */
+    class FileBuf : public std::filebuf {
+    public:
+        const char* get_pending(size_t& len) const {
+            len = pptr() - pbase();
+            return pbase();
+        }
+    };
+
+    //文件路径
+    std::string m_filename;
+    //文件缓冲
+    FileBuf m_filebuf;
+    //文件流
+    std::ostream m_filestream;
+    //同一文件的追加写描述符，只用于崩溃时写出
+    int m_crash_fd = -1;
+};
+
+/**
+ * @brief 日志器
+ */
+class Logger : public std::enable_shared_from_this<Logger> {
+friend class LoggerManager;
 public:
     typedef std::shared_ptr<Logger> ptr;
-    std::string get_name() {}
+
+    /**
+     * @brief Construct a new Logger object
+     * 
+     * @param name 日志器名称
+     */
+    Logger(const std::string& name = "root");
+    ~Logger();
+
+    /**
+     * @brief 写日志到所有Appender，没有Appender时交给主日志器
+     * @details FATAL日志写完后同步刷新所有日志器，进程随后退出时不丢失异步队列中的日志
+     * 
+     * @param level 日志级别
+     * @param event 日志事件
+     */
+    void log(LogLevel::Level level, const LogEvent::ptr& event);
+    void debug(const LogEvent::ptr& event);
+    void info(const LogEvent::ptr& event);
+    void warn(const LogEvent::ptr& event);
+    void error(const LogEvent::ptr& event);
+    void fatal(const LogEvent::ptr& event);
+
+    /**
+     * @brief 一条路由，不低于level的日志交给appender
+     */
+    struct Route {
+        LogAppender::ptr appender;
+        LogLevel::Level level;
+    };
+
+    /**
+     * @brief 添加Appender，Appender没有格式化器时使用日志器的格式化器
+     * @param level 只把不低于该级别的日志交给这个Appender
+     */
+    void add_appender(LogAppender::ptr appender, LogLevel::Level level = LogLevel::UNKNOWN);
+    /**
+     * @brief 删除Appender
+     */
+    void del_appender(LogAppender::ptr appender);
+    /**
+     * @brief 清空Appender
+     */
+    void clear_appenders();
+    /**
+     * @brief 修改已添加的Appender的路由级别
+     * @return appender不存在时返回false
+     */
+    bool set_appender_level(LogAppender::ptr appender, LogLevel::Level level);
+    /**
+     * @brief 一次替换全部路由，日志路径上整体生效
+     */
+    void set_routes(const std::vector<Route>& routes);
+    /**
+     * @brief 返回当前的路由
+     */
+    std::vector<Route> get_routes() const;
+    /**
+     * @brief 刷新所有Appender，异步Appender会等待队列中的记录写出
+     */
+    void flush();
+    /**
+     * @brief 该级别的日志是否有Appender输出日志内容，没有Appender时看主日志器
+     */
+    bool needs_message(LogLevel::Level level) const;
+    /**
+     * @brief 进程正常退出时调用所有Appender的on_exit
+     */
+    void on_exit();
+    /**
+     * @brief 崩溃时写出所有Appender的紧急数据，见LogCrashHandler
+     */
+    void crash_flush();
+    /**
+     * @brief 崩溃时把已格式化的一行按路由写给Appender，没有Appender时交给主日志器
+     */
+    void crash_write(LogLevel::Level level, const char* data, size_t len);
+
+    /**
+     * @brief 该级别是否需要输出，只有一次relaxed原子读
+     */
+    bool is_enabled(LogLevel::Level level) const {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief Get the level
+     */
+    LogLevel::Level get_level() const { return m_level.load(std::memory_order_relaxed); }
+    /**
+     * @brief Set the level
+     */
+    void set_level(LogLevel::Level val) { m_level.store(val, std::memory_order_relaxed); }
+    /**
+     * @brief Get the name
+     */
+    const std::string& get_name() const { return m_name; }
+    /**
+     * @brief Set the formatter
+     */
+    void set_formatter(LogFormatter::ptr val);
+    /**
+     * @brief Set the formatter
+     * @param val 日志模板
+     */
+    void set_formatter(const std::string& val);
+    /**
+     * @brief Get the formatter
+     */
+    LogFormatter::ptr get_formatter();
+    /**
+     * @brief 自身统计中的编号，见LogMetrics::register_logger
+     */
+    uint32_t get_metrics_id() const { return m_metrics_id; }
+
+private:
+    /**
+     * @brief 路由表快照，发布后不再修改
+     */
+    struct RouteTable {
+        std::vector<Route> routes;
+        //每个级别要写入的Appender，指向routes中的对象
+        std::vector<LogAppender*> levels[LogLevel::FATAL + 1];
+    };
+
+    /**
+     * @brief 发布新的路由表，旧表在读端都离开后释放，调用方持有m_mutex
+     */
+    void publish(std::vector<Route>&& routes);
+
+private:
+    //日志器名称
+    std::string m_name;
+    //自身统计中的编号
+    uint32_t m_metrics_id;
+    //日志级别
+    std::atomic<LogLevel::Level> m_level;
+    //互斥锁，只用于串行化修改
+    mutable std::mutex m_mutex;
+    //当前路由表，写日志时在LogRcu读区间内读取，不加锁
+    std::atomic<const RouteTable*> m_routes;
+    //日志格式化器
+    LogFormatter::ptr m_formatter;
+    //主日志器
+    Logger::ptr m_root;
+    //指向自身但不持有引用，写日志时传给Appender，不对引用计数做原子加减
+    Logger::ptr m_self;
+};
+
+/**
+ * @brief 日志器管理类
+ * @details 名称到日志器的表以只读快照发布，查找只有一次原子读和一次哈希查找，
+ *          不加锁。新建日志器时在锁内复制整张表并发布新快照，旧快照不释放，
+ *          正在读的线程不受影响；日志器数量有限，多占的内存可以忽略
+ */
+class LoggerManager {
+public:
+    LoggerManager();
+
+    /**
+     * @brief 获取日志器，不存在时创建
+     * 
+     * @param name 日志器名称
+     */
+    Logger::ptr get_logger(const std::string& name);
+    /**
+     * @brief 查找日志器，不存在时返回nullptr
+     */
+    Logger::ptr find_logger(const std::string& name) const;
+    /**
+     * @brief 返回主日志器
+     */
+    Logger::ptr get_root() const { return m_root; }
+    /**
+     * @brief 刷新所有日志器的Appender
+     * @details 第一次创建管理类时用atexit注册，进程正常退出时写完异步Appender中的日志
+     */
+    void flush_all();
+    /**
+     * @brief 调用所有日志器的Appender的on_exit，与flush_all一起在进程正常退出时调用
+     */
+    void exit_all();
+    /**
+     * @brief 崩溃时写出所有日志器的紧急数据，见LogCrashHandler
+     */
+    void crash_flush();
+
+    /**
+     * @brief 返回全局的日志器管理类，不会析构
+     */
+    static LoggerManager* get_instance() { return Singleton<LoggerManager>::get_instance(); }
+
+private:
+    typedef std::unordered_map<std::string, Logger::ptr> LoggerMap;
+
+    std::mutex m_mutex;
+    //当前快照
+    std::atomic<const LoggerMap*> m_loggers;
+    //发布过的所有快照
+    std::vector<std::unique_ptr<LoggerMap>> m_snapshots;
+    //主日志器
+    Logger::ptr m_root;
 };
 
 }
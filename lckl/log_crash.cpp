@@ -0,0 +1,326 @@
+#include "log_crash.h"
+#include "deferred_log.h"
+#include <atomic>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lckl {
+
+//紧急缓冲区，一行日志的上限
+static const size_t s_line_size = 64 * 1024;
+//一次写出中记录的Appender数，超出后的Appender可能被写出多次
+static const size_t s_max_appenders = 256;
+//备用信号栈的大小
+static const size_t s_altstack_size = 64 * 1024;
+
+static const int s_signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+static const size_t s_signal_count = sizeof(s_signals) / sizeof(s_signals[0]);
+
+namespace {
+
+/**
+ * @brief 一次写出中已处理的Appender
+ */
+struct SeenAppender {
+    LogAppender* appender;
+    //直接挂在日志器上，崩溃标记只写给这些Appender
+    bool top;
+};
+
+char s_line[s_line_size];
+SeenAppender s_seen[s_max_appenders];
+size_t s_seen_count = 0;
+
+std::atomic<bool> s_installed{false};
+struct sigaction s_old_actions[s_signal_count];
+//正在写出的线程，0表示没有
+std::atomic<pid_t> s_crash_tid{0};
+//崩溃标记所用的日志器名称
+const std::string s_logger_name = "lckl";
+
+const char* get_signal_name(int sig) {
+    switch (sig) {
+#define XX(name) \
+    case name: return #name;
+    XX(SIGSEGV)
+    XX(SIGABRT)
+    XX(SIGBUS)
+    XX(SIGFPE)
+    XX(SIGILL)
+#undef XX
+    default: return "UNKNOWN";
+    }
+}
+
+void restore_signal(int sig) {
+    for (size_t i = 0; i < s_signal_count; ++i) {
+        if (s_signals[i] == sig) {
+            sigaction(sig, &s_old_actions[i], nullptr);
+            return;
+        }
+    }
+    signal(sig, SIG_DFL);
+}
+
+void on_signal(int sig, siginfo_t* info, void* context) {
+    int saved_errno = errno;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    pid_t expected = 0;
+    if (!s_crash_tid.compare_exchange_strong(expected, tid)) {
+        if (expected != tid) {
+            //其他线程正在写出，等它结束进程
+            for (;;) {
+                pause();
+            }
+        }
+        //写出过程中自身再次崩溃，交给原来的处理方式
+        restore_signal(sig);
+        raise(sig);
+        return;
+    }
+    LogCrashHandler::emergency_flush(sig);
+    //信号在处理期间被阻塞，返回后按原来的处理方式再次处理
+    restore_signal(sig);
+    raise(sig);
+    errno = saved_errno;
+}
+
+}
+
+LogCrashHandler::Line::Line()
+    :m_data(s_line)
+    ,m_capacity(s_line_size) {
+}
+
+void LogCrashHandler::Line::append(const char* str, size_t len) {
+    if (len > m_capacity - m_size) {
+        len = m_capacity - m_size;
+    }
+    memcpy(m_data + m_size, str, len);
+    m_size += len;
+}
+
+void LogCrashHandler::Line::append(const char* str) {
+    append(str ? str : "(null)", str ? strlen(str) : 6);
+}
+
+void LogCrashHandler::Line::append_int(int64_t v) {
+    char buf[number_format::INT_SIZE];
+    append(buf, number_format::format_int(buf, v) - buf);
+}
+
+void LogCrashHandler::Line::append_uint(uint64_t v) {
+    char buf[number_format::INT_SIZE];
+    append(buf, number_format::format_uint(buf, v) - buf);
+}
+
+void LogCrashHandler::Line::append_hex(uint64_t v) {
+    char buf[16];
+    size_t n = 0;
+    do {
+        buf[sizeof(buf) - ++n] = "0123456789abcdef"[v & 0xf];
+        v >>= 4;
+    } while (v);
+    append(buf + sizeof(buf) - n, n);
+}
+
+void LogCrashHandler::Line::append_double(double v, int precision) {
+    if (v != v) {
+        append("nan", 3);
+        return;
+    }
+    if (v < 0) {
+        append("-", 1);
+        v = -v;
+    }
+    if (v > 1.8e19) {
+        append("inf", 3);
+        return;
+    }
+    if (precision > 9) {
+        precision = 9;
+    }
+    uint64_t scale = 1;
+    for (int i = 0; i < precision; ++i) {
+        scale *= 10;
+    }
+    uint64_t ipart = (uint64_t)v;
+    uint64_t fpart = (uint64_t)((v - (double)ipart) * scale + 0.5);
+    if (fpart >= scale) {
+        ++ipart;
+        fpart -= scale;
+    }
+    append_uint(ipart);
+    if (precision > 0) {
+        char buf[10];
+        buf[0] = '.';
+        for (int i = precision; i > 0; --i) {
+            buf[i] = '0' + fpart % 10;
+            fpart /= 10;
+        }
+        append(buf, precision + 1);
+    }
+}
+
+void LogCrashHandler::Line::end() {
+    if (m_size == m_capacity) {
+        --m_size;
+    }
+    m_data[m_size++] = '\n';
+}
+
+bool LogCrashHandler::install() {
+    if (s_installed.exchange(true)) {
+        return true;
+    }
+    //提前创建，处理函数中不再申请内存
+    LoggerManager::get_instance();
+    memset(s_line, 0, sizeof(s_line));
+
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = mmap(nullptr, s_altstack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ss.ss_sp != MAP_FAILED) {
+        ss.ss_size = s_altstack_size;
+        if (sigaltstack(&ss, nullptr) != 0) {
+            munmap(ss.ss_sp, s_altstack_size);
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_signal;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    bool ok = true;
+    for (size_t i = 0; i < s_signal_count; ++i) {
+        if (sigaction(s_signals[i], &sa, &s_old_actions[i]) != 0) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void LogCrashHandler::uninstall() {
+    if (!s_installed.exchange(false)) {
+        return;
+    }
+    for (size_t i = 0; i < s_signal_count; ++i) {
+        sigaction(s_signals[i], &s_old_actions[i], nullptr);
+    }
+}
+
+bool LogCrashHandler::is_installed() {
+    return s_installed.load(std::memory_order_relaxed);
+}
+
+void LogCrashHandler::emergency_flush(int sig) {
+    s_seen_count = 0;
+    if (sig) {
+        Line line;
+        line.append("*** lckl: caught signal ");
+        line.append_int(sig);
+        line.append(" (");
+        line.append(get_signal_name(sig));
+        line.append("), flushing logs ***");
+        line.end();
+        write_fd(STDERR_FILENO, line.data(), line.size());
+    }
+    //按流水线从下游到上游：Appender的缓冲、异步队列、延迟日志缓冲区
+    LoggerManager::get_instance()->crash_flush();
+    DeferredLogBackend::crash_flush();
+    if (!sig) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    Line line;
+    format_prefix(line, (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000
+                 ,(uint32_t)syscall(SYS_gettid), nullptr, LogLevel::FATAL, s_logger_name, __FILE__, __LINE__);
+    line.append("caught signal ");
+    line.append_int(sig);
+    line.append(" (");
+    line.append(get_signal_name(sig));
+    line.append(")");
+    line.end();
+    for (size_t i = 0; i < s_seen_count; ++i) {
+        if (s_seen[i].top) {
+            s_seen[i].appender->crash_write(line.data(), line.size());
+        }
+    }
+}
+
+void LogCrashHandler::flush_appender(LogAppender* appender, bool top) {
+    if (!appender) {
+        return;
+    }
+    for (size_t i = 0; i < s_seen_count; ++i) {
+        if (s_seen[i].appender == appender) {
+            s_seen[i].top = s_seen[i].top || top;
+            return;
+        }
+    }
+    if (s_seen_count < s_max_appenders) {
+        s_seen[s_seen_count++] = SeenAppender{appender, top};
+    }
+    appender->crash_flush();
+}
+
+void LogCrashHandler::format_event(Line& line, LogLevel::Level level, const LogEvent& event) {
+    static const std::string s_empty;
+    const std::string& name = event.get_logger() ? event.get_logger()->get_name() : s_empty;
+    format_prefix(line, event.get_time() * 1000000 + event.get_usec(), event.get_threadid()
+                 ,&event.get_threadname(), level, name, event.get_file(), event.get_line());
+    std::string_view content = event.get_content_view();
+    line.append(content.data(), content.size());
+    line.end();
+}
+
+void LogCrashHandler::format_prefix(Line& line, uint64_t time, uint32_t threadid, const std::string* threadname
+                                   ,LogLevel::Level level, const std::string& logger, const char* file, int32_t line_no) {
+    line.append_uint(time / 1000000);
+    char usec[7];
+    uint32_t v = time % 1000000;
+    usec[0] = '.';
+    for (int i = 6; i > 0; --i) {
+        usec[i] = '0' + v % 10;
+        v /= 10;
+    }
+    line.append(usec, sizeof(usec));
+    line.append("\t", 1);
+    line.append_uint(threadid);
+    line.append("\t", 1);
+    if (threadname) {
+        line.append(threadname->data(), threadname->size());
+    }
+    line.append("\t[", 2);
+    line.append(LogLevel::to_string(level));
+    line.append("]\t[", 3);
+    line.append(logger.data(), logger.size());
+    line.append("]\t", 2);
+    line.append(file);
+    line.append(":", 1);
+    line.append_int(line_no);
+    line.append("\t", 1);
+}
+
+void LogCrashHandler::write_fd(int fd, const char* data, size_t len) {
+    while (len > 0 && fd != -1) {
+        ssize_t rt = ::write(fd, data, len);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += rt;
+        len -= rt;
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef __LOG_CRASH_H__
+#define __LOG_CRASH_H__
+
+#include "log.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lckl {
+
+/**
+ * @brief 崩溃时写出日志流水线中尚未落盘的日志
+ * @details 处理SIGSEGV/SIGABRT/SIGBUS/SIGFPE/SIGILL：依次写出LoggerManager中所有日志器的Appender已缓冲的
+ *          文本(LogAppender::crash_flush)、异步/分片队列中的记录以及延迟日志缓冲区中的记录，
+ *          在日志末尾写一行崩溃标记，然后恢复原来的处理方式并重新触发信号。
+ *          处理期间只调用异步信号安全的函数，不加锁、不申请内存，不使用LogFormatter；
+ *          尚未格式化的事件在预先分配的紧急缓冲区中按固定格式组装为一行：
+ *          "秒.微秒 线程id 线程名 [级别] [日志器] 文件:行号 消息"。
+ *          数据在其他线程写入的过程中被读取，写出的是尽力而为的结果
+ */
+class LogCrashHandler {
+public:
+    /**
+     * @brief 紧急缓冲区中的一行日志，超出缓冲区的部分被截断
+     * @details 只能在崩溃处理期间使用，同一时间只有一行
+     */
+    class Line {
+    public:
+        Line();
+        void append(const char* str, size_t len);
+        void append(const char* str);
+        void append_int(int64_t v);
+        void append_uint(uint64_t v);
+        void append_hex(uint64_t v);
+        /**
+         * @brief 定点输出浮点数，不经过printf
+         */
+        void append_double(double v, int precision = 6);
+        /**
+         * @brief 以'\n'结束一行，缓冲区满时覆盖最后一个字节
+         */
+        void end();
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        char* m_data;
+        size_t m_size = 0;
+        size_t m_capacity;
+    };
+
+    /**
+     * @brief 安装信号处理函数，重复调用无效果
+     * @details 同时为当前线程设置备用信号栈，当前线程栈溢出时也能写出日志
+     * @return 成功返回true
+     */
+    static bool install();
+    /**
+     * @brief 恢复安装前的信号处理方式
+     */
+    static void uninstall();
+    static bool is_installed();
+    /**
+     * @brief 不经过信号直接执行一次崩溃写出，用于自定义的崩溃处理
+     * @param sig 写入崩溃标记的信号，0时不写标记
+     * @details 与信号处理函数相同，只能在进程即将退出时调用
+     */
+    static void emergency_flush(int sig = 0);
+    /**
+     * @brief 写出一个Appender的紧急数据，同一次写出中每个Appender只处理一次
+     * @details 包装其他Appender的Appender在crash_flush中对下游调用
+     * @param top 直接挂在日志器上，崩溃标记只写给这些Appender
+     */
+    static void flush_appender(LogAppender* appender, bool top = false);
+    /**
+     * @brief 把尚未格式化的事件组装为一行
+     */
+    static void format_event(Line& line, LogLevel::Level level, const LogEvent& event);
+    /**
+     * @brief 按固定格式写一行的头部
+     * @param time 时间戳，微秒
+     */
+    static void format_prefix(Line& line, uint64_t time, uint32_t threadid, const std::string* threadname
+                             ,LogLevel::Level level, const std::string& logger, const char* file, int32_t line_no);
+    /**
+     * @brief 写完整个缓冲区，只处理EINTR
+     */
+    static void write_fd(int fd, const char* data, size_t len);
+};
+
+}
+
+#endif // !__LOG_CRASH_H__
@@ -0,0 +1,207 @@
+#include "log_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace lckl {
+
+namespace log_index {
+
+static_assert(sizeof(Block) == 72, "log_index::Block is stored on disk");
+
+//文件头的字节数：MAGIC、block_size、保留
+static const size_t s_header_size = sizeof(MAGIC) + 8;
+
+namespace {
+
+void bloom_bits(std::string_view logger, size_t bits[BLOOM_HASHES]) {
+    uint64_t h = hash(logger);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (size_t i = 0; i < BLOOM_HASHES; ++i) {
+        bits[i] = (h1 + i * h2) % (BLOOM_BYTES * 8);
+    }
+}
+
+bool write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t rt = ::write(fd, p, len);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += rt;
+        len -= rt;
+    }
+    return true;
+}
+
+}
+
+void Block::add(uint64_t time, LogLevel::Level level, std::string_view logger) {
+    if (count == 0 || time < min_time) {
+        min_time = time;
+    }
+    if (count == 0 || time > max_time) {
+        max_time = time;
+    }
+    ++count;
+    if ((unsigned)level < 31) {
+        levels |= 1u << level;
+    }
+    size_t bits[BLOOM_HASHES];
+    bloom_bits(logger, bits);
+    for (size_t i = 0; i < BLOOM_HASHES; ++i) {
+        bloom[bits[i] / 8] |= 1 << (bits[i] % 8);
+    }
+}
+
+bool Block::match_logger(std::string_view logger) const {
+    if (is_unknown()) {
+        return true;
+    }
+    size_t bits[BLOOM_HASHES];
+    bloom_bits(logger, bits);
+    for (size_t i = 0; i < BLOOM_HASHES; ++i) {
+        if (!(bloom[bits[i] / 8] & (1 << (bits[i] % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load(const std::string& path, std::vector<Block>& blocks, uint32_t* block_size) {
+    blocks.clear();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    std::string data;
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t rt = ::read(fd, buf, sizeof(buf));
+        if (rt < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rt <= 0) {
+            break;
+        }
+        data.append(buf, rt);
+    }
+    ::close(fd);
+    if (data.size() < s_header_size || memcmp(data.data(), MAGIC, sizeof(MAGIC))) {
+        return false;
+    }
+    if (block_size) {
+        memcpy(block_size, data.data() + sizeof(MAGIC), sizeof(*block_size));
+    }
+    size_t n = (data.size() - s_header_size) / sizeof(Block);
+    blocks.resize(n);
+    if (n) {
+        memcpy(&blocks[0], data.data() + s_header_size, n * sizeof(Block));
+    }
+    return true;
+}
+
+bool save(const std::string& path, uint32_t block_size, const std::vector<Block>& blocks) {
+    //先写临时文件再改名，查询方不会读到写了一半的索引
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    char header[s_header_size] = {0};
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    memcpy(header + sizeof(MAGIC), &block_size, sizeof(block_size));
+    bool ok = write_all(fd, header, sizeof(header))
+            && (blocks.empty() || write_all(fd, &blocks[0], blocks.size() * sizeof(Block)));
+    ::close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
+
+LogIndexWriter::LogIndexWriter(uint32_t block_size)
+    :m_block_size(block_size ? block_size : 1) {
+    memset(&m_block, 0, sizeof(m_block));
+}
+
+LogIndexWriter::~LogIndexWriter() {
+    close();
+}
+
+bool LogIndexWriter::open(const std::string& path) {
+    close();
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        return false;
+    }
+    char header[log_index::s_header_size] = {0};
+    memcpy(header, log_index::MAGIC, sizeof(log_index::MAGIC));
+    memcpy(header + sizeof(log_index::MAGIC), &m_block_size, sizeof(m_block_size));
+    if (!log_index::write_all(m_fd, header, sizeof(header))) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    memset(&m_block, 0, sizeof(m_block));
+    m_block_count = 0;
+    return true;
+}
+
+void LogIndexWriter::close() {
+    if (m_fd == -1) {
+        return;
+    }
+    write_block();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void LogIndexWriter::write_block() {
+    if (m_block.size == 0) {
+        return;
+    }
+    if (log_index::write_all(m_fd, &m_block, sizeof(m_block))) {
+        ++m_block_count;
+    }
+    memset(&m_block, 0, sizeof(m_block));
+}
+
+void LogIndexWriter::begin(uint64_t offset) {
+    if (m_block.size >= m_block_size || (m_block.size && m_block.offset + m_block.size != offset)) {
+        write_block();
+    }
+    if (m_block.size == 0) {
+        m_block.offset = offset;
+    }
+}
+
+void LogIndexWriter::add(uint64_t offset, size_t len, uint64_t time, LogLevel::Level level, std::string_view logger) {
+    if (m_fd == -1) {
+        return;
+    }
+    begin(offset);
+    m_block.size += len;
+    m_block.add(time, level, logger);
+}
+
+void LogIndexWriter::add_raw(uint64_t offset, size_t len) {
+    if (m_fd == -1) {
+        return;
+    }
+    begin(offset);
+    m_block.size += len;
+    m_block.add_unknown();
+}
+
+}
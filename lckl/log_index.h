@@ -0,0 +1,170 @@
+#ifndef __LOG_INDEX_H__
+#define __LOG_INDEX_H__
+
+#include "log.h"
+#include <string_view>
+#include <vector>
+
+namespace lckl {
+
+/**
+ * @brief 文本日志文件的稀疏索引
+ * @details 索引文件(日志文件名加".idx")把日志文件按约block_size字节切分为块，块边界总在行首。
+ *          每块记录起始偏移、长度、块内日志的最早/最晚时间、出现过的级别和日志器名称的布隆过滤器，
+ *          查询时按时间范围、级别、日志器跳过不可能匹配的块。
+ *          文件由MAGIC、block_size(uint32)、保留(uint32)和连续的Block组成，字段按本机字节序。
+ *          块写满时立即追加到索引文件，进程崩溃后索引覆盖到最后一个写满的块，之后的部分需要顺序扫描
+ */
+namespace log_index {
+
+//文件头
+static const char MAGIC[8] = {'L', 'C', 'K', 'L', 'I', 'D', 'X', 1};
+//布隆过滤器的字节数
+static const size_t BLOOM_BYTES = 32;
+//每个名称在布隆过滤器中置位的数量
+static const size_t BLOOM_HASHES = 3;
+//Block::levels的最高位：块内有时间、级别或日志器未知的文本(如直接write的已格式化文本)，查询时不能跳过
+static const uint32_t UNKNOWN_TEXT = 1u << 31;
+
+/**
+ * @brief 索引中的一个块
+ */
+struct Block {
+    //块在日志文件中的起始偏移
+    uint64_t offset;
+    //块的字节数
+    uint64_t size;
+    //块内日志的最早、最晚时间，微秒
+    uint64_t min_time;
+    uint64_t max_time;
+    //日志行数
+    uint32_t count;
+    //出现过的级别，第level位；最高位为UNKNOWN_TEXT
+    uint32_t levels;
+    //日志器名称的布隆过滤器
+    uint8_t bloom[BLOOM_BYTES];
+
+    /**
+     * @brief 记录一行日志，offset和size由调用方维护
+     */
+    void add(uint64_t time, LogLevel::Level level, std::string_view logger);
+    /**
+     * @brief 记录一段内容未知的文本，之后任何条件都不跳过此块
+     */
+    void add_unknown() { levels |= UNKNOWN_TEXT; }
+    bool is_unknown() const { return levels & UNKNOWN_TEXT; }
+    /**
+     * @brief 时间是否可能落在[begin, end)内
+     */
+    bool match_time(uint64_t begin, uint64_t end) const {
+        return count == 0 || is_unknown() || (min_time < end && max_time >= begin);
+    }
+    /**
+     * @brief 是否包含不低于level的日志
+     */
+    bool match_level(LogLevel::Level level) const {
+        return is_unknown() || (levels >> level) != 0;
+    }
+    /**
+     * @brief 是否可能包含该日志器的日志
+     */
+    bool match_logger(std::string_view logger) const;
+};
+
+/**
+ * @brief 日志器名称的哈希(FNV-1a)，布隆过滤器依赖它在不同版本间保持不变
+ */
+inline uint64_t hash(std::string_view str) {
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : str) {
+        h = (h ^ (uint8_t)c) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief 返回日志文件对应的索引文件路径
+ */
+inline std::string get_index_path(const std::string& path) {
+    return path + ".idx";
+}
+
+/**
+ * @brief 读取索引文件，末尾不完整的块被忽略
+ * @param block_size 返回写入时的块大小，可以为nullptr
+ * @return 文件不存在或格式不符返回false
+ */
+bool load(const std::string& path, std::vector<Block>& blocks, uint32_t* block_size = nullptr);
+/**
+ * @brief 一次写出整个索引文件，用于为已有的日志文件生成索引
+ * @return 成功返回true
+ */
+bool save(const std::string& path, uint32_t block_size, const std::vector<Block>& blocks);
+
+}
+
+/**
+ * @brief 索引文件的写入器
+ * @details 由写日志的一方按日志在文件中的顺序调用add，不加锁
+ */
+class LogIndexWriter {
+public:
+    /**
+     * @brief Construct a new Log Index Writer object
+     *
+     * @param block_size 块的字节数，块在第一行超出该大小后结束
+     */
+    LogIndexWriter(uint32_t block_size = 64 * 1024);
+    ~LogIndexWriter();
+    LogIndexWriter(const LogIndexWriter&) = delete;
+    LogIndexWriter& operator=(const LogIndexWriter&) = delete;
+
+    /**
+     * @brief 创建索引文件，已打开时先关闭
+     * @return 成功返回true
+     */
+    bool open(const std::string& path);
+    /**
+     * @brief 写出最后一个块并关闭索引文件
+     */
+    void close();
+    bool is_open() const { return m_fd != -1; }
+
+    /**
+     * @brief 记录一行日志
+     *
+     * @param offset 日志在日志文件中的偏移
+     * @param len 日志的字节数
+     * @param time 时间戳，微秒
+     */
+    void add(uint64_t offset, size_t len, uint64_t time, LogLevel::Level level, std::string_view logger);
+    /**
+     * @brief 记录直接写入的文本，其时间、级别和日志器未知，当前块标记为UNKNOWN_TEXT
+     * @details 在AsyncLogAppender/ShardedLogAppender之后时所有日志都经由此处
+     */
+    void add_raw(uint64_t offset, size_t len);
+
+    uint32_t get_block_size() const { return m_block_size; }
+    /**
+     * @brief 已写出的块数
+     */
+    uint64_t get_block_count() const { return m_block_count; }
+
+private:
+    /**
+     * @brief 当前块已满时写出，并从offset开始新块
+     */
+    void begin(uint64_t offset);
+    void write_block();
+
+private:
+    uint32_t m_block_size;
+    int m_fd = -1;
+    //当前块，size为0表示空
+    log_index::Block m_block;
+    uint64_t m_block_count = 0;
+};
+
+}
+
+#endif // !__LOG_INDEX_H__
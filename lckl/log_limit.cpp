@@ -0,0 +1,67 @@
+#include "log_limit.h"
+#include <time.h>
+
+namespace lckl {
+
+static std::atomic<uint32_t> s_report_interval{10000};
+
+namespace {
+
+uint64_t coarse_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+}
+
+void LogLimiter::set_report_interval(uint32_t ms) {
+    s_report_interval.store(ms, std::memory_order_relaxed);
+}
+
+uint32_t LogLimiter::get_report_interval() {
+    return s_report_interval.load(std::memory_order_relaxed);
+}
+
+void LogLimiter::report(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+                       ,const char* file, int32_t line) {
+    uint64_t now = coarse_ns() / 1000000;
+    uint64_t next = m_next_report.load(std::memory_order_relaxed);
+    if (next != 0 && now < next) {
+        return;
+    }
+    //只有一个线程进入新的周期
+    if (!m_next_report.compare_exchange_strong(next, now + get_report_interval()
+                                              ,std::memory_order_relaxed)) {
+        return;
+    }
+    if (next == 0) {
+        return;
+    }
+    uint64_t n = m_suppressed.exchange(0, std::memory_order_relaxed);
+    if (n) {
+        LogEventWrap(LogEvent::create(logger, level, file, line)).get_ss()
+            << "suppressed " << n << " messages";
+    }
+}
+
+bool LogRateLimit::acquire(uint32_t k) {
+    if (k == 0) {
+        return false;
+    }
+    uint64_t interval = 1000000000 / k;
+    uint64_t tolerance = interval * (k - 1);
+    uint64_t now = coarse_ns();
+    uint64_t tat = m_tat.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t t = tat > now ? tat : now;
+        if (t - now > tolerance) {
+            return false;
+        }
+        if (m_tat.compare_exchange_weak(tat, t + interval, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+}
@@ -0,0 +1,168 @@
+#ifndef __LOG_LIMIT_H__
+#define __LOG_LIMIT_H__
+
+#include "log.h"
+
+/**
+ * @brief 调用点的限流状态，每个宏展开处一个静态对象
+ * @details 对象只含原子变量，常量初始化，没有函数内静态变量的初始化检查
+ */
+#define LCKL_LOG_LIMIT_SITE(type) \
+    ([]() -> type& { \
+        static type s_lckl_site; \
+        return s_lckl_site; \
+    }())
+
+#define LCKL_LOG_LIMIT_LEVEL(logger, level, type, n) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1) \
+            || !LCKL_LOG_LIMIT_SITE(type).check(n, logger, level, __FILE__, __LINE__)) {} \
+    else lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).get_ss()
+
+#define LCKL_LOG_FMT_LIMIT_LEVEL(logger, level, type, n, fmt, ...) \
+    if (level < LCKL_LOG_MIN_LEVEL || __builtin_expect(!(logger)->is_enabled(level), 1) \
+            || !LCKL_LOG_LIMIT_SITE(type).check(n, logger, level, __FILE__, __LINE__)) {} \
+    else lckl::LogEventWrap(lckl::LogEvent::create(logger, level, __FILE__, __LINE__)).get_event()->format(fmt, ##__VA_ARGS__)
+
+/**
+ * @brief 同一调用点每n次只写第一次，n为0时不写
+ */
+#define LCKL_LOG_EVERY_N(logger, level, n) LCKL_LOG_LIMIT_LEVEL(logger, level, lckl::LogEveryN, n)
+/**
+ * @brief 同一调用点每秒最多写k条，允许k条的突发，k为0时不写
+ */
+#define LCKL_LOG_RATE_LIMIT(logger, level, k) LCKL_LOG_LIMIT_LEVEL(logger, level, lckl::LogRateLimit, k)
+/**
+ * @brief 同一调用点只写前n次，n为0时不写
+ */
+#define LCKL_LOG_FIRST_N(logger, level, n) LCKL_LOG_LIMIT_LEVEL(logger, level, lckl::LogFirstN, n)
+
+#define LCKL_LOG_FMT_EVERY_N(logger, level, n, fmt, ...) \
+    LCKL_LOG_FMT_LIMIT_LEVEL(logger, level, lckl::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_RATE_LIMIT(logger, level, k, fmt, ...) \
+    LCKL_LOG_FMT_LIMIT_LEVEL(logger, level, lckl::LogRateLimit, k, fmt, ##__VA_ARGS__)
+#define LCKL_LOG_FMT_FIRST_N(logger, level, n, fmt, ...) \
+    LCKL_LOG_FMT_LIMIT_LEVEL(logger, level, lckl::LogFirstN, n, fmt, ##__VA_ARGS__)
+
+namespace lckl {
+
+/**
+ * @brief 调用点限流的公共部分
+ * @details 被丢弃的日志只做计数，每个汇总周期最多输出一条
+ *          "suppressed X messages"，带调用点的文件名和行号。
+ *          周期从第一次丢弃开始计算，在该调用点之后的调用中检查，没有后续调用时不输出
+ */
+class LogLimiter {
+public:
+    /**
+     * @brief 设置汇总周期，毫秒，默认10秒
+     */
+    static void set_report_interval(uint32_t ms);
+    static uint32_t get_report_interval();
+
+    /**
+     * @brief 尚未汇总的丢弃数
+     */
+    uint64_t get_suppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+
+protected:
+    /**
+     * @brief 日志通过，有待汇总的丢弃数时检查汇总周期
+     */
+    void pass(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+             ,const char* file, int32_t line) {
+        if (__builtin_expect(m_suppressed.load(std::memory_order_relaxed) != 0, 0)) {
+            report(logger, level, file, line);
+        }
+    }
+    /**
+     * @brief 日志被丢弃
+     */
+    void suppress(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+                 ,const char* file, int32_t line) {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        report(logger, level, file, line);
+    }
+
+private:
+    void report(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+               ,const char* file, int32_t line);
+
+private:
+    std::atomic<uint64_t> m_suppressed{0};
+    //下次汇总的时间，毫秒，0表示周期还未开始
+    std::atomic<uint64_t> m_next_report{0};
+};
+
+/**
+ * @brief 每n次通过一次
+ * @details n为1时每次都通过；n为0时从不通过，与LogFirstN、LogRateLimit的0一致
+ */
+class LogEveryN : public LogLimiter {
+public:
+    bool check(uint64_t n, const std::shared_ptr<Logger>& logger, LogLevel::Level level
+              ,const char* file, int32_t line) {
+        //n可能来自配置，为0时不能作除数
+        if (n != 0 && (n == 1 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0)) {
+            pass(logger, level, file, line);
+            return true;
+        }
+        suppress(logger, level, file, line);
+        return false;
+    }
+
+private:
+    std::atomic<uint64_t> m_count{0};
+};
+
+/**
+ * @brief 前n次通过，n为0时从不通过
+ */
+class LogFirstN : public LogLimiter {
+public:
+    bool check(uint64_t n, const std::shared_ptr<Logger>& logger, LogLevel::Level level
+              ,const char* file, int32_t line) {
+        //达到n之后只读不写，避免热点调用点反复争用缓存行
+        if (m_count.load(std::memory_order_relaxed) < n
+                && m_count.fetch_add(1, std::memory_order_relaxed) < n) {
+            pass(logger, level, file, line);
+            return true;
+        }
+        suppress(logger, level, file, line);
+        return false;
+    }
+
+private:
+    std::atomic<uint64_t> m_count{0};
+};
+
+/**
+ * @brief 令牌桶，每秒k个令牌，桶容量k
+ * @details 用GCRA实现，只有一个原子变量：记录令牌用尽的理论时间，
+ *          取令牌时向后推1/k秒，超出当前时间1秒以上时拒绝。
+ *          时间取CLOCK_MONOTONIC_COARSE，拒绝时不写共享变量。k为0时从不通过
+ */
+class LogRateLimit : public LogLimiter {
+public:
+    bool check(uint32_t k, const std::shared_ptr<Logger>& logger, LogLevel::Level level
+              ,const char* file, int32_t line) {
+        if (acquire(k)) {
+            pass(logger, level, file, line);
+            return true;
+        }
+        suppress(logger, level, file, line);
+        return false;
+    }
+
+    /**
+     * @brief 取一个令牌
+     */
+    bool acquire(uint32_t k);
+
+private:
+    //纳秒
+    std::atomic<uint64_t> m_tat{0};
+};
+
+}
+
+#endif // !__LOG_LIMIT_H__
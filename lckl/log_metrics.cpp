@@ -0,0 +1,386 @@
+#include "log_metrics.h"
+#include "log.h"
+#include "singleton.h"
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+namespace lckl {
+
+namespace detail {
+
+thread_local LogMetrics::Slot* t_metrics_slot = nullptr;
+std::atomic<bool> s_metrics_timing{false};
+std::atomic<bool> s_metrics_item_timing{false};
+
+}
+
+namespace {
+
+/**
+ * @brief 汇总用的累加值，与Slot布局相同但不是原子变量
+ */
+struct MetricsTotals {
+    uint64_t events[LogMetrics::MAX_LOGGERS][LogMetrics::LEVEL_COUNT] = {};
+    uint64_t counters[LogMetrics::COUNTER_COUNT] = {};
+    LogMetrics::HistogramData histograms[LogMetrics::HISTOGRAM_COUNT];
+    LogMetrics::ItemData items[LogMetrics::ITEM_COUNT];
+
+    void add(const LogMetrics::Slot& slot) {
+        for (size_t i = 0; i < LogMetrics::MAX_LOGGERS; ++i) {
+            for (size_t j = 0; j < LogMetrics::LEVEL_COUNT; ++j) {
+                events[i][j] += slot.events[i][j].load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < LogMetrics::COUNTER_COUNT; ++i) {
+            counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < LogMetrics::HISTOGRAM_COUNT; ++i) {
+            auto& src = slot.histograms[i];
+            auto& dst = histograms[i];
+            dst.count += src.count.load(std::memory_order_relaxed);
+            dst.sum += src.sum.load(std::memory_order_relaxed);
+            dst.max = std::max(dst.max, src.max.load(std::memory_order_relaxed));
+            for (size_t j = 0; j < LogMetrics::BUCKET_COUNT; ++j) {
+                dst.buckets[j] += src.buckets[j].load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < LogMetrics::ITEM_COUNT; ++i) {
+            items[i].count += slot.items[i].count.load(std::memory_order_relaxed);
+            items[i].ns += slot.items[i].ns.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @brief 所有线程统计槽的登记表，只在线程创建退出、登记日志器和读快照时加锁
+ */
+struct MetricsRegistry {
+    std::mutex mutex;
+    std::set<const LogMetrics::Slot*> slots;
+    //已退出线程的统计
+    MetricsTotals retired;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> ids;
+};
+
+MetricsRegistry& get_registry() {
+    //不析构，线程退出晚于静态对象析构时依然可用
+    return *Singleton<MetricsRegistry>::get_instance();
+}
+
+//线程退出阶段的写入落到这里，不参与汇总
+LogMetrics::Slot s_discard_slot;
+
+struct MetricsSlotHolder {
+    ~MetricsSlotHolder() {
+        LogMetrics::Slot* slot = detail::t_metrics_slot;
+        if (slot && slot != &s_discard_slot) {
+            MetricsRegistry& r = get_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.retired.add(*slot);
+            r.slots.erase(slot);
+            delete slot;
+        }
+        detail::t_metrics_slot = &s_discard_slot;
+    }
+};
+thread_local MetricsSlotHolder t_slot_holder;
+
+/**
+ * @brief 定时输出统计的后台线程
+ */
+struct MetricsDumper {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    Logger::ptr logger;
+    uint32_t interval = 10000;
+    bool stopping = false;
+
+    void run() {
+        LogMetrics::Snapshot prev = LogMetrics::snapshot();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            cond.wait_for(lock, std::chrono::milliseconds(interval));
+            if (stopping) {
+                break;
+            }
+            LogMetrics::Snapshot cur = LogMetrics::snapshot();
+            LogMetrics::Snapshot delta = cur;
+            delta.subtract(prev);
+            prev = std::move(cur);
+            Logger::ptr l = logger;
+            lock.unlock();
+            LCKL_LOG_INFO(l) << "metrics interval_ms=" << interval << " " << delta.to_string();
+            lock.lock();
+        }
+    }
+};
+
+MetricsDumper& get_dumper() {
+    return *Singleton<MetricsDumper>::get_instance();
+}
+
+uint64_t bucket_upper(size_t i) {
+    return i == 0 ? 0 : i >= 64 ? UINT64_MAX : ((uint64_t)1 << i) - 1;
+}
+
+}
+
+LogMetrics::Slot* LogMetrics::init_slot() {
+    //触发thread_local析构注册
+    (void)&t_slot_holder;
+    Slot* slot = new Slot();
+    MetricsRegistry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.slots.insert(slot);
+    detail::t_metrics_slot = slot;
+    return slot;
+}
+
+LogMetrics::Snapshot LogMetrics::snapshot() {
+    MetricsTotals totals;
+    Snapshot s;
+    std::vector<std::string> names;
+    {
+        MetricsRegistry& r = get_registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        totals = r.retired;
+        for (auto& i : r.slots) {
+            totals.add(*i);
+        }
+        s.threads = r.slots.size();
+        names = r.names;
+    }
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        s.counters[i] = totals.counters[i];
+    }
+    for (size_t i = 0; i < HISTOGRAM_COUNT; ++i) {
+        s.histograms[i] = totals.histograms[i];
+    }
+    for (size_t i = 0; i < ITEM_COUNT; ++i) {
+        s.items[i] = totals.items[i];
+    }
+    for (size_t i = 0; i < MAX_LOGGERS; ++i) {
+        uint64_t n = 0;
+        for (size_t j = 0; j < LEVEL_COUNT; ++j) {
+            n += totals.events[i][j];
+        }
+        if (n == 0) {
+            continue;
+        }
+        LoggerData d;
+        d.name = i < names.size() ? names[i] : "<other>";
+        for (size_t j = 0; j < LEVEL_COUNT; ++j) {
+            d.events[j] = totals.events[i][j];
+        }
+        s.loggers.push_back(std::move(d));
+    }
+    return s;
+}
+
+void LogMetrics::set_timing(bool v) {
+    detail::s_metrics_timing.store(v, std::memory_order_relaxed);
+}
+
+void LogMetrics::set_item_timing(bool v) {
+    detail::s_metrics_item_timing.store(v, std::memory_order_relaxed);
+}
+
+uint32_t LogMetrics::register_logger(const std::string& name) {
+    MetricsRegistry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto it = r.ids.find(name);
+    if (it != r.ids.end()) {
+        return it->second;
+    }
+    //最后一个编号留给"<other>"
+    if (r.names.size() >= MAX_LOGGERS - 1) {
+        return MAX_LOGGERS - 1;
+    }
+    uint32_t id = r.names.size();
+    r.names.push_back(name);
+    r.ids[name] = id;
+    return id;
+}
+
+const char* LogMetrics::to_string(Counter counter) {
+    switch (counter) {
+#define XX(name, str) \
+    case name: \
+        return #str;
+    XX(FORMAT_CALLS, format_calls);
+    XX(FORMAT_BYTES, format_bytes);
+    XX(ENQUEUED, enqueued);
+    XX(DROPPED, dropped);
+    XX(FLUSHES, flushes);
+#undef XX
+    default:
+        return "unknown";
+    }
+}
+
+const char* LogMetrics::to_string(Histogram histogram) {
+    switch (histogram) {
+#define XX(name, str) \
+    case name: \
+        return #str;
+    XX(FORMAT_NS, format_ns);
+    XX(ENQUEUE_NS, enqueue_ns);
+    XX(FLUSH_NS, flush_ns);
+    XX(QUEUE_DEPTH, queue_depth);
+#undef XX
+    default:
+        return "unknown";
+    }
+}
+
+const char* LogMetrics::get_item_name(size_t item) {
+    static const char* s_names[ITEM_COUNT] = {
+        "string", "message", "level", "elapse", "name", "thread_id"
+        ,"date", "filename", "line", "fiber_id", "thread_name", "trace_id", "fields"
+    };
+    return item < ITEM_COUNT ? s_names[item] : "unknown";
+}
+
+void LogMetrics::start_dump(const std::shared_ptr<Logger>& logger, uint32_t interval) {
+    stop_dump();
+    MetricsDumper& d = get_dumper();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.logger = logger;
+    d.interval = interval ? interval : 1;
+    d.stopping = false;
+    d.thread = std::thread(&MetricsDumper::run, &d);
+}
+
+void LogMetrics::stop_dump() {
+    MetricsDumper& d = get_dumper();
+    std::thread t;
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.stopping = true;
+        d.cond.notify_all();
+        t.swap(d.thread);
+    }
+    if (t.joinable()) {
+        t.join();
+    }
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.logger.reset();
+}
+
+uint64_t LogMetrics::HistogramData::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil(q * count);
+    rank = rank == 0 ? 1 : rank > count ? count : rank;
+    uint64_t n = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        n += buckets[i];
+        if (n >= rank) {
+            return std::min(bucket_upper(i), max);
+        }
+    }
+    return max;
+}
+
+uint64_t LogMetrics::Snapshot::get_events() const {
+    uint64_t n = 0;
+    for (auto& i : loggers) {
+        for (size_t j = 0; j < LEVEL_COUNT; ++j) {
+            n += i.events[j];
+        }
+    }
+    return n;
+}
+
+void LogMetrics::Snapshot::subtract(const Snapshot& prev) {
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        counters[i] -= prev.counters[i];
+    }
+    for (size_t i = 0; i < HISTOGRAM_COUNT; ++i) {
+        HistogramData& h = histograms[i];
+        const HistogramData& p = prev.histograms[i];
+        h.count -= p.count;
+        h.sum -= p.sum;
+        size_t top = 0;
+        for (size_t j = 0; j < BUCKET_COUNT; ++j) {
+            h.buckets[j] -= p.buckets[j];
+            if (h.buckets[j]) {
+                top = j;
+            }
+        }
+        h.max = h.count ? std::min(bucket_upper(top), h.max) : 0;
+    }
+    for (size_t i = 0; i < ITEM_COUNT; ++i) {
+        items[i].count -= prev.items[i].count;
+        items[i].ns -= prev.items[i].ns;
+    }
+    //日志器只增不减，按名称对应
+    std::vector<LoggerData> result;
+    for (auto& i : loggers) {
+        LoggerData d = i;
+        uint64_t n = 0;
+        for (auto& j : prev.loggers) {
+            if (j.name == d.name) {
+                for (size_t k = 0; k < LEVEL_COUNT; ++k) {
+                    d.events[k] -= j.events[k];
+                }
+                break;
+            }
+        }
+        for (size_t k = 0; k < LEVEL_COUNT; ++k) {
+            n += d.events[k];
+        }
+        if (n) {
+            result.push_back(std::move(d));
+        }
+    }
+    loggers.swap(result);
+}
+
+std::string LogMetrics::Snapshot::to_string() const {
+    std::stringstream ss;
+    ss << "threads=" << threads << " events=" << get_events();
+    for (auto& i : loggers) {
+        for (size_t j = 0; j < LEVEL_COUNT; ++j) {
+            if (i.events[j]) {
+                ss << " events." << i.name << "." << LogLevel::to_string((LogLevel::Level)j)
+                   << "=" << i.events[j];
+            }
+        }
+    }
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        if (counters[i]) {
+            ss << " " << LogMetrics::to_string((Counter)i) << "=" << counters[i];
+        }
+    }
+    for (size_t i = 0; i < HISTOGRAM_COUNT; ++i) {
+        const HistogramData& h = histograms[i];
+        if (h.count == 0) {
+            continue;
+        }
+        const char* name = LogMetrics::to_string((Histogram)i);
+        ss << " " << name << ".count=" << h.count
+           << " " << name << ".mean=" << (uint64_t)h.mean()
+           << " " << name << ".p50=" << h.percentile(0.5)
+           << " " << name << ".p99=" << h.percentile(0.99)
+           << " " << name << ".p999=" << h.percentile(0.999)
+           << " " << name << ".max=" << h.max;
+    }
+    for (size_t i = 0; i < ITEM_COUNT; ++i) {
+        if (items[i].count) {
+            ss << " item." << get_item_name(i) << ".count=" << items[i].count
+               << " item." << get_item_name(i) << ".ns=" << items[i].ns;
+        }
+    }
+    return ss.str();
+}
+
+}
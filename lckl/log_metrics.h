@@ -0,0 +1,282 @@
+#ifndef __LOG_METRICS_H__
+#define __LOG_METRICS_H__
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+/**
+ * @brief 是否编译日志库自身的统计，为0时所有埋点为空
+ */
+#ifndef LCKL_LOG_METRICS
+#define LCKL_LOG_METRICS 1
+#endif
+
+namespace lckl {
+
+class Logger;
+
+/**
+ * @brief 日志库自身的统计
+ * @details 每个线程一个按缓存行对齐的统计槽，只由所属线程写(relaxed读后写，不是原子加)，
+ *          读快照时加锁汇总所有线程的槽，线程退出时槽内数据并入已退出部分。
+ *          计数总是开启；耗时需要读时钟，默认关闭，由set_timing/set_item_timing开启
+ */
+class LogMetrics {
+public:
+    //单独统计的日志器名称数，之后的日志器合并为"<other>"
+    static const size_t MAX_LOGGERS = 64;
+    static const size_t LEVEL_COUNT = 6;
+    static const size_t BUCKET_COUNT = 64;
+    //模板项的种类，与LogFormatter::FormatOp::Type一一对应
+    static const size_t ITEM_COUNT = 13;
+
+    enum Counter {
+        //LogFormatter::format调用次数
+        FORMAT_CALLS = 0,
+        //格式化输出的字节数，流接口的非编译路径不计
+        FORMAT_BYTES,
+        //进入异步队列的记录数
+        ENQUEUED,
+        //异步队列、网络等丢弃的记录数
+        DROPPED,
+        //Logger::flush调用次数
+        FLUSHES,
+        COUNTER_COUNT
+    };
+
+    enum Histogram {
+        //LogFormatter::format耗时，纳秒
+        FORMAT_NS = 0,
+        //入队耗时，含队列满时的等待，纳秒
+        ENQUEUE_NS,
+        //Logger::flush耗时，纳秒
+        FLUSH_NS,
+        //后台线程每次取记录时的队列深度
+        QUEUE_DEPTH,
+        HISTOGRAM_COUNT
+    };
+
+    /**
+     * @brief 汇总后的直方图
+     * @details buckets[i]为[2^(i-1), 2^i)内的样本数，buckets[0]为值0的样本数
+     */
+    struct HistogramData {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        uint64_t buckets[BUCKET_COUNT] = {0};
+
+        /**
+         * @brief 分位数的估计值，取所在桶的上界，不超过max
+         * @param q 0到1之间
+         */
+        uint64_t percentile(double q) const;
+        double mean() const { return count ? (double)sum / count : 0; }
+    };
+
+    /**
+     * @brief 一个日志器名称下各级别创建的事件数
+     */
+    struct LoggerData {
+        std::string name;
+        uint64_t events[LEVEL_COUNT] = {0};
+    };
+
+    /**
+     * @brief 一种模板项的调用次数和耗时
+     */
+    struct ItemData {
+        uint64_t count = 0;
+        uint64_t ns = 0;
+    };
+
+    /**
+     * @brief 统计快照
+     */
+    struct Snapshot {
+        //汇总的线程数，不含已退出线程
+        uint32_t threads = 0;
+        uint64_t counters[COUNTER_COUNT] = {0};
+        HistogramData histograms[HISTOGRAM_COUNT];
+        //只含有事件的日志器
+        std::vector<LoggerData> loggers;
+        ItemData items[ITEM_COUNT];
+
+        /**
+         * @brief 所有日志器创建的事件数
+         */
+        uint64_t get_events() const;
+        /**
+         * @brief 减去更早的快照，得到区间内的增量
+         * @details 区间内的max由最高的非空桶估计
+         */
+        void subtract(const Snapshot& prev);
+        /**
+         * @brief 输出为一行logfmt，省略为0的项
+         */
+        std::string to_string() const;
+    };
+
+    /**
+     * @brief 每个线程的统计槽
+     */
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> events[MAX_LOGGERS][LEVEL_COUNT];
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        struct {
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> sum;
+            std::atomic<uint64_t> max;
+            std::atomic<uint64_t> buckets[BUCKET_COUNT];
+        } histograms[HISTOGRAM_COUNT];
+        struct {
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> ns;
+        } items[ITEM_COUNT];
+    };
+
+    /**
+     * @brief 汇总所有线程的统计
+     */
+    static Snapshot snapshot();
+
+    /**
+     * @brief 开启format、入队、flush的耗时统计
+     */
+    static void set_timing(bool v);
+    static bool is_timing();
+    /**
+     * @brief 开启每个模板项的耗时统计，每项读两次时钟，只用于排查
+     */
+    static void set_item_timing(bool v);
+    static bool is_item_timing();
+
+    /**
+     * @brief 登记日志器名称，同名的日志器共用一个编号
+     */
+    static uint32_t register_logger(const std::string& name);
+
+    static const char* to_string(Counter counter);
+    static const char* to_string(Histogram histogram);
+    static const char* get_item_name(size_t item);
+
+    /**
+     * @brief 启动后台线程，每隔interval毫秒把区间内的增量写到logger(INFO级别)
+     * @details 已启动时替换为新的参数，进程退出前应调用stop_dump
+     */
+    static void start_dump(const std::shared_ptr<Logger>& logger, uint32_t interval = 10000);
+    static void stop_dump();
+
+    /**
+     * @brief 单调时钟，纳秒
+     */
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    /**
+     * @brief 开启计时时返回当前时间，否则返回0
+     */
+    static uint64_t timer_begin() { return is_timing() ? now_ns() : 0; }
+    /**
+     * @brief begin不为0时记录耗时
+     */
+    static void timer_end(Histogram histogram, uint64_t begin) {
+        if (begin) {
+            record(histogram, now_ns() - begin);
+        }
+    }
+
+    static void add_event(uint32_t logger_id, int level);
+    static void add(Counter counter, uint64_t v = 1);
+    static void record(Histogram histogram, uint64_t v);
+    static void add_item(size_t item, uint64_t ns);
+
+private:
+    static Slot* get_slot();
+    static Slot* init_slot();
+    /**
+     * @brief 只由所属线程写，不需要原子加
+     */
+    static void bump(std::atomic<uint64_t>& a, uint64_t v) {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+};
+
+namespace detail {
+
+extern thread_local LogMetrics::Slot* t_metrics_slot;
+extern std::atomic<bool> s_metrics_timing;
+extern std::atomic<bool> s_metrics_item_timing;
+
+}
+
+inline bool LogMetrics::is_timing() {
+#if LCKL_LOG_METRICS
+    return detail::s_metrics_timing.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+inline bool LogMetrics::is_item_timing() {
+#if LCKL_LOG_METRICS
+    return detail::s_metrics_item_timing.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+inline LogMetrics::Slot* LogMetrics::get_slot() {
+    Slot* slot = detail::t_metrics_slot;
+    if (__builtin_expect(slot == nullptr, 0)) {
+        slot = init_slot();
+    }
+    return slot;
+}
+
+inline void LogMetrics::add_event(uint32_t logger_id, int level) {
+#if LCKL_LOG_METRICS
+    if (logger_id < MAX_LOGGERS && (unsigned)level < LEVEL_COUNT) {
+        bump(get_slot()->events[logger_id][level], 1);
+    }
+#endif
+}
+
+inline void LogMetrics::add(Counter counter, uint64_t v) {
+#if LCKL_LOG_METRICS
+    bump(get_slot()->counters[counter], v);
+#endif
+}
+
+inline void LogMetrics::record(Histogram histogram, uint64_t v) {
+#if LCKL_LOG_METRICS
+    auto& h = get_slot()->histograms[histogram];
+    size_t i = v ? 64 - __builtin_clzll(v) : 0;
+    bump(h.buckets[i < BUCKET_COUNT ? i : BUCKET_COUNT - 1], 1);
+    bump(h.count, 1);
+    bump(h.sum, v);
+    if (v > h.max.load(std::memory_order_relaxed)) {
+        h.max.store(v, std::memory_order_relaxed);
+    }
+#endif
+}
+
+inline void LogMetrics::add_item(size_t item, uint64_t ns) {
+#if LCKL_LOG_METRICS
+    if (item < ITEM_COUNT) {
+        auto& it = get_slot()->items[item];
+        bump(it.count, 1);
+        bump(it.ns, ns);
+    }
+#endif
+}
+
+}
+
+#endif // !__LOG_METRICS_H__
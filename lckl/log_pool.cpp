@@ -0,0 +1,289 @@
+#include "log_pool.h"
+#include "singleton.h"
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <cstddef>
+
+namespace lckl {
+
+/**
+ * @brief 事件槽，事件与其shared_ptr控制块存放在一起
+ */
+struct LogEventPool::Slot {
+    Slot(ThreadPool* pool)
+        :event(nullptr, LogLevel::UNKNOWN, nullptr, 0, 0, 0, 0, 0, std::string())
+        ,owner(pool) {
+    }
+
+    //事件
+    LogEvent event;
+    //所属线程池
+    ThreadPool* owner;
+    //空闲链表
+    Slot* next = nullptr;
+    //shared_ptr控制块的存储
+    alignas(std::max_align_t) char ctrl[64];
+};
+
+namespace {
+
+/**
+ * @brief 控制块分配器，直接使用槽内的存储，释放控制块时归还槽
+ */
+template<class T>
+struct SlotAllocator {
+    typedef T value_type;
+
+    SlotAllocator(LogEventPool::Slot* s) : slot(s) {}
+    template<class U>
+    SlotAllocator(const SlotAllocator<U>& o) : slot(o.slot) {}
+
+    T* allocate(size_t n) {
+        if (n * sizeof(T) <= sizeof(slot->ctrl) && alignof(T) <= alignof(std::max_align_t)) {
+            return reinterpret_cast<T*>(slot->ctrl);
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        if (reinterpret_cast<char*>(p) != slot->ctrl) {
+            ::operator delete(p);
+        }
+        //控制块销毁是shared_ptr对槽的最后一次访问
+        LogEventPool::release(slot);
+    }
+
+    template<class U>
+    bool operator==(const SlotAllocator<U>& o) const { return slot == o.slot; }
+    template<class U>
+    bool operator!=(const SlotAllocator<U>& o) const { return slot != o.slot; }
+
+    LogEventPool::Slot* slot;
+};
+
+/**
+ * @brief 事件留在槽内，由控制块释放时整体回收
+ */
+struct SlotDeleter {
+    void operator()(LogEvent*) const {
+    }
+};
+
+}
+
+/**
+ * @brief 单个线程的事件池
+ * @details m_live为借出的事件数加上所属线程自身的1，归零者负责销毁池
+ */
+class LogEventPool::ThreadPool {
+public:
+    ThreadPool();
+    ~ThreadPool();
+
+    Slot* acquire();
+    void release(Slot* slot);
+    /**
+     * @brief 所属线程退出
+     */
+    void orphan();
+    void add_stats(Stats& stats) const;
+
+private:
+    void unref();
+    void reclaim();
+    void free_slot(Slot* slot);
+
+private:
+    //本线程的空闲链表，只有所属线程访问
+    Slot* m_free = nullptr;
+    size_t m_free_count = 0;
+    //其它线程归还的事件
+    std::atomic<Slot*> m_returned{nullptr};
+    std::atomic<int64_t> m_live{1};
+    std::atomic<bool> m_orphaned{false};
+
+    std::atomic<uint64_t> m_created{0};
+    std::atomic<uint64_t> m_freed{0};
+    std::atomic<uint64_t> m_acquired{0};
+    std::atomic<uint64_t> m_remote_released{0};
+};
+
+namespace {
+
+/**
+ * @brief 所有线程池的登记表，只在线程池创建销毁和统计时加锁
+ */
+struct PoolRegistry {
+    std::mutex mutex;
+    std::set<const LogEventPool::ThreadPool*> pools;
+    //已销毁线程池的统计
+    LogEventPool::Stats retired;
+};
+
+PoolRegistry& get_registry() {
+    //不析构，线程退出晚于静态对象析构时依然可用
+    return *Singleton<PoolRegistry>::get_instance();
+}
+
+//当前线程的事件池，线程退出后置为s_dead_pool
+thread_local LogEventPool::ThreadPool* t_pool = nullptr;
+LogEventPool::ThreadPool* const s_dead_pool = reinterpret_cast<LogEventPool::ThreadPool*>(uintptr_t(1));
+
+struct ThreadPoolHolder {
+    ~ThreadPoolHolder() {
+        if (t_pool && t_pool != s_dead_pool) {
+            t_pool->orphan();
+        }
+        t_pool = s_dead_pool;
+    }
+};
+thread_local ThreadPoolHolder t_pool_holder;
+
+}
+
+LogEventPool::ThreadPool::ThreadPool() {
+    PoolRegistry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.pools.insert(this);
+}
+
+LogEventPool::ThreadPool::~ThreadPool() {
+    PoolRegistry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    add_stats(r.retired);
+    r.pools.erase(this);
+}
+
+void LogEventPool::ThreadPool::add_stats(Stats& stats) const {
+    stats.created += m_created.load(std::memory_order_relaxed);
+    stats.freed += m_freed.load(std::memory_order_relaxed);
+    stats.acquired += m_acquired.load(std::memory_order_relaxed);
+    stats.remote_released += m_remote_released.load(std::memory_order_relaxed);
+}
+
+void LogEventPool::ThreadPool::free_slot(Slot* slot) {
+    delete slot;
+    m_freed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LogEventPool::ThreadPool::reclaim() {
+    Slot* s = m_returned.exchange(nullptr, std::memory_order_acquire);
+    while (s) {
+        Slot* next = s->next;
+        if (m_free_count < MAX_CACHED) {
+            s->next = m_free;
+            m_free = s;
+            ++m_free_count;
+        } else {
+            free_slot(s);
+        }
+        s = next;
+    }
+}
+
+LogEventPool::Slot* LogEventPool::ThreadPool::acquire() {
+    if (!m_free) {
+        reclaim();
+    }
+    Slot* s = m_free;
+    if (s) {
+        m_free = s->next;
+        --m_free_count;
+    } else {
+        s = new Slot(this);
+        m_created.fetch_add(1, std::memory_order_relaxed);
+    }
+    //计数只由本线程写入，无需原子的读改写
+    m_acquired.store(m_acquired.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_live.fetch_add(1, std::memory_order_relaxed);
+    return s;
+}
+
+void LogEventPool::ThreadPool::release(Slot* slot) {
+    if (t_pool == this) {
+        if (m_free_count < MAX_CACHED) {
+            slot->next = m_free;
+            m_free = slot;
+            ++m_free_count;
+        } else {
+            free_slot(slot);
+        }
+    } else if (m_orphaned.load(std::memory_order_acquire)) {
+        free_slot(slot);
+    } else {
+        Slot* head = m_returned.load(std::memory_order_relaxed);
+        do {
+            slot->next = head;
+        } while (!m_returned.compare_exchange_weak(head, slot
+                    ,std::memory_order_release, std::memory_order_relaxed));
+        m_remote_released.fetch_add(1, std::memory_order_relaxed);
+    }
+    unref();
+}
+
+void LogEventPool::ThreadPool::orphan() {
+    m_orphaned.store(true, std::memory_order_release);
+    while (m_free) {
+        Slot* next = m_free->next;
+        free_slot(m_free);
+        m_free = next;
+    }
+    m_free_count = 0;
+    Slot* s = m_returned.exchange(nullptr, std::memory_order_acquire);
+    while (s) {
+        Slot* next = s->next;
+        free_slot(s);
+        s = next;
+    }
+    unref();
+}
+
+void LogEventPool::ThreadPool::unref() {
+    if (m_live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        //在所属线程退出后才可能归零，此时归还链表中可能还有残留
+        Slot* s = m_returned.exchange(nullptr, std::memory_order_acquire);
+        while (s) {
+            Slot* next = s->next;
+            free_slot(s);
+            s = next;
+        }
+        delete this;
+    }
+}
+
+LogEvent::ptr LogEventPool::acquire(Logger* logger, LogLevel::Level level
+                                   ,const char* file, int32_t line, uint32_t elapse
+                                   ,uint32_t threadid, uint32_t fiberid, uint64_t time
+                                   ,const std::string* threadname, uint32_t usec) {
+    if (!t_pool) {
+        //触发thread_local析构注册
+        (void)&t_pool_holder;
+        t_pool = new ThreadPool;
+    }
+    if (t_pool == s_dead_pool) {
+        //线程退出阶段，不再使用对象池
+        LogEvent::ptr event = std::make_shared<LogEvent>(nullptr, level, file, line, elapse
+                                                        ,threadid, fiberid, time, *threadname, usec);
+        event->m_logger = logger;
+        return event;
+    }
+    Slot* s = t_pool->acquire();
+    s->event.reset(logger, level, file, line, elapse, threadid, fiberid, time, threadname, usec);
+    return LogEvent::ptr(&s->event, SlotDeleter(), SlotAllocator<LogEvent>(s));
+}
+
+void LogEventPool::release(Slot* slot) {
+    slot->owner->release(slot);
+}
+
+LogEventPool::Stats LogEventPool::get_stats() {
+    PoolRegistry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    Stats stats = r.retired;
+    for (auto& i : r.pools) {
+        i->add_stats(stats);
+    }
+    return stats;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef __LOG_POOL_H__
+#define __LOG_POOL_H__
+
+#include "log.h"
+#include <stdint.h>
+
+namespace lckl {
+
+/**
+ * @brief 日志事件对象池
+ * @details 每个线程持有一个事件池，事件及其shared_ptr控制块、内容缓冲区在
+ *          最后一个引用释放后回收复用。在其它线程(如输出线程)释放的事件
+ *          通过无锁链表归还给所属线程，所属线程退出后剩余事件由最后释放者清理。
+ *          稳态下acquire()不做任何内存分配
+ */
+class LogEventPool {
+public:
+    /**
+     * @brief 每个线程缓存的空闲事件上限，超出部分直接释放
+     */
+    static const size_t MAX_CACHED = 1024;
+
+    /**
+     * @brief 分配统计
+     */
+    struct Stats {
+        //新申请的事件(malloc)
+        uint64_t created = 0;
+        //释放的事件(free)
+        uint64_t freed = 0;
+        //获取事件总数
+        uint64_t acquired = 0;
+        //由其它线程归还的事件数
+        uint64_t remote_released = 0;
+    };
+
+    /**
+     * @brief 从当前线程的事件池获取一个事件，参数同LogEvent构造函数
+     * @param logger 日志器，事件只保存指针，使用期间需保持有效
+     * @param threadname 常驻的线程名(ThreadContext或intern_thread_name())，只保存指针
+     */
+    static LogEvent::ptr acquire(Logger* logger, LogLevel::Level level
+                                ,const char* file, int32_t line, uint32_t elapse
+                                ,uint32_t threadid, uint32_t fiberid, uint64_t time
+                                ,const std::string* threadname, uint32_t usec = 0);
+
+    /**
+     * @brief 汇总所有线程(含已退出线程)的分配统计
+     */
+    static Stats get_stats();
+
+public:
+    struct Slot;
+    class ThreadPool;
+    /**
+     * @brief 归还事件槽，可在任意线程调用
+     */
+    static void release(Slot* slot);
+};
+
+}
+
+#endif // !__LOG_POOL_H__
@@ -0,0 +1,120 @@
+#include "log_rcu.h"
+#include "singleton.h"
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace lckl {
+
+namespace detail {
+
+thread_local LogRcu::Reader* t_rcu_reader = nullptr;
+//从1开始，读端的0表示不在读区间
+std::atomic<uint64_t> s_rcu_epoch{1};
+
+}
+
+namespace {
+
+/**
+ * @brief 等待释放的旧对象
+ */
+struct RetiredObject {
+    //retire时推进后的纪元
+    uint64_t epoch;
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+/**
+ * @brief 所有读端的登记表和待释放列表，只在线程创建退出和写端加锁
+ */
+struct RcuRegistry {
+    std::mutex mutex;
+    std::set<LogRcu::Reader*> readers;
+    std::vector<RetiredObject> retired;
+};
+
+RcuRegistry& get_registry() {
+    //不析构，线程退出晚于静态对象析构时依然可用
+    return *Singleton<RcuRegistry>::get_instance();
+}
+
+struct RcuReaderHolder {
+    ~RcuReaderHolder() {
+        LogRcu::Reader* r = detail::t_rcu_reader;
+        if (r) {
+            RcuRegistry& reg = get_registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.readers.erase(r);
+            delete r;
+        }
+        //之后再进入读区间时重新登记，不再随线程退出注销
+        detail::t_rcu_reader = nullptr;
+    }
+};
+thread_local RcuReaderHolder t_reader_holder;
+
+}
+
+LogRcu::Reader* LogRcu::init_reader() {
+    //触发thread_local析构注册
+    (void)&t_reader_holder;
+    Reader* r = new Reader;
+    RcuRegistry& reg = get_registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.readers.insert(r);
+    detail::t_rcu_reader = r;
+    return r;
+}
+
+void LogRcu::retire(void* ptr, void (*deleter)(void*)) {
+    if (!ptr) {
+        return;
+    }
+    //此后进入读区间的线程读到的纪元不小于epoch，一定能看到已替换的指针
+    uint64_t epoch = detail::s_rcu_epoch.fetch_add(1) + 1;
+    {
+        RcuRegistry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.retired.push_back(RetiredObject{epoch, ptr, deleter});
+    }
+    reclaim();
+}
+
+size_t LogRcu::reclaim() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<RetiredObject> ready;
+    size_t left;
+    {
+        RcuRegistry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (reg.retired.empty()) {
+            return 0;
+        }
+        uint64_t min = UINT64_MAX;
+        for (auto& i : reg.readers) {
+            uint64_t e = i->active.load(std::memory_order_acquire);
+            if (e && e < min) {
+                min = e;
+            }
+        }
+        auto it = reg.retired.begin();
+        for (auto& i : reg.retired) {
+            if (i.epoch <= min) {
+                ready.push_back(i);
+            } else {
+                *it++ = i;
+            }
+        }
+        reg.retired.erase(it, reg.retired.end());
+        left = reg.retired.size();
+    }
+    //锁外释放，析构函数中可能再写日志或修改配置
+    for (auto& i : ready) {
+        i.deleter(i.ptr);
+    }
+    return left;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef __LOG_RCU_H__
+#define __LOG_RCU_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lckl {
+
+/**
+ * @brief 基于纪元的RCU，用于日志路径上读取可在运行时替换的配置
+ * @details 读端进入时在本线程的槽中记下当前纪元，离开时清零，只写本线程的缓存行，不加锁。
+ *          写端原子替换指针后调用retire，旧对象标记为新的纪元，
+ *          所有线程都离开该纪元之前的读区间后才释放；写端不等待读端，
+ *          可回收的旧对象在之后的retire或reclaim中释放。读区间可以嵌套
+ */
+class LogRcu {
+public:
+    /**
+     * @brief 读区间
+     */
+    class ReadGuard {
+    public:
+        ReadGuard() { read_lock(); }
+        ~ReadGuard() { read_unlock(); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    /**
+     * @brief 每个线程的读端状态
+     */
+    struct alignas(64) Reader {
+        //进入读区间时的纪元，0表示不在读区间
+        std::atomic<uint64_t> active{0};
+        //嵌套深度，只有所属线程访问
+        uint32_t depth = 0;
+    };
+
+    static void read_lock();
+    static void read_unlock();
+
+    /**
+     * @brief 登记已从共享指针上摘下的旧对象，读端都离开后调用deleter释放
+     * @details 调用前指针必须已经替换，同时尝试释放之前登记的对象
+     */
+    static void retire(void* ptr, void (*deleter)(void*));
+    template<class T>
+    static void retire(const T* ptr) {
+        retire(const_cast<T*>(ptr), [](void* p) { delete static_cast<T*>(p); });
+    }
+    /**
+     * @brief 释放已经没有读端的旧对象
+     * @return 仍在等待的旧对象数
+     */
+    static size_t reclaim();
+
+private:
+    static Reader* init_reader();
+};
+
+namespace detail {
+
+extern thread_local LogRcu::Reader* t_rcu_reader;
+extern std::atomic<uint64_t> s_rcu_epoch;
+
+}
+
+inline void LogRcu::read_lock() {
+    Reader* r = detail::t_rcu_reader;
+    if (__builtin_expect(r == nullptr, 0)) {
+        r = init_reader();
+    }
+    if (r->depth++ == 0) {
+        //与写端retire中的fence配对：写端要么看到active，要么读端看到新的指针
+        r->active.store(detail::s_rcu_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+inline void LogRcu::read_unlock() {
+    Reader* r = detail::t_rcu_reader;
+    if (--r->depth == 0) {
+        r->active.store(0, std::memory_order_release);
+    }
+}
+
+}
+
+#endif // !__LOG_RCU_H__
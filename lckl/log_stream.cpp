@@ -0,0 +1,81 @@
+#include "log_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ostream>
+
+namespace lckl {
+
+LogStream::~LogStream() {
+    if (m_data != m_inline) {
+        free(m_data);
+    }
+}
+
+void LogStream::grow(size_t need) {
+    size_t capacity = m_capacity * 2;
+    while (capacity < need) {
+        capacity *= 2;
+    }
+    if (m_data == m_inline) {
+        char* data = (char*)malloc(capacity);
+        memcpy(data, m_inline, m_size);
+        m_data = data;
+    } else {
+        m_data = (char*)realloc(m_data, capacity);
+    }
+    m_capacity = capacity;
+}
+
+void LogStream::append_format(const char* fmt, va_list al) {
+    va_list ap;
+    va_copy(ap, al);
+    size_t avail = m_capacity - m_size;
+    int len = vsnprintf(m_data + m_size, avail, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return;
+    }
+    //空间不足，扩容后重新格式化
+    if ((size_t)len >= avail) {
+        reserve(len + 1);
+        va_copy(ap, al);
+        vsnprintf(m_data + m_size, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    m_size += len;
+}
+
+LogStream& LogStream::operator<<(const void* v) {
+    if (!v) {
+        put('0');
+        return *this;
+    }
+    //与%p一致，0x加小写十六进制
+    char buf[2 + sizeof(uintptr_t) * 2];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    for (uintptr_t n = (uintptr_t)v; n; n >>= 4) {
+        *--p = "0123456789abcdef"[n & 0xf];
+    }
+    *--p = 'x';
+    *--p = '0';
+    append(p, end - p);
+    return *this;
+}
+
+LogStream& LogStream::operator<<(const char* v) {
+    if (v) {
+        append(v, strlen(v));
+    }
+    return *this;
+}
+
+LogStream& LogStream::operator<<(std::ostream& (*pf)(std::ostream&)) {
+    std::ostringstream ss;
+    pf(ss);
+    const std::string& str = ss.str();
+    append(str.data(), str.size());
+    return *this;
+}
+
+}
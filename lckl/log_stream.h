@@ -0,0 +1,156 @@
+#ifndef __LOG_STREAM_H__
+#define __LOG_STREAM_H__
+
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <type_traits>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include "number_format.h"
+
+namespace lckl {
+
+/**
+ * @brief 日志内容构建器
+ * @details 内置INLINE_SIZE字节的缓冲区，日志内容超出时才申请堆内存。
+ *          提供与std::stringstream兼容的operator<<接口
+ */
+class LogStream {
+public:
+    //内置缓冲区大小
+    static const size_t INLINE_SIZE = 512;
+
+    LogStream() = default;
+    ~LogStream();
+    LogStream(const LogStream&) = delete;
+    LogStream& operator=(const LogStream&) = delete;
+
+    /**
+     * @brief 追加内容
+     */
+    void append(const char* data, size_t len) {
+        if (m_size + len > m_capacity) {
+            grow(m_size + len);
+        }
+        memcpy(m_data + m_size, data, len);
+        m_size += len;
+    }
+    void append(std::string_view str) { append(str.data(), str.size()); }
+    /**
+     * @brief 按printf格式追加内容
+     */
+    void append_format(const char* fmt, va_list al);
+    /**
+     * @brief 保证至少还能写入len字节，返回写入位置
+     */
+    char* reserve(size_t len) {
+        if (m_size + len > m_capacity) {
+            grow(m_size + len);
+        }
+        return m_data + m_size;
+    }
+    /**
+     * @brief 确认reserve()之后写入的len字节
+     */
+    void commit(size_t len) { m_size += len; }
+
+    /**
+     * @brief 返回内容
+     */
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+    /**
+     * @brief 返回内容拷贝，与std::stringstream::str()对应
+     */
+    std::string str() const { return std::string(m_data, m_size); }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    /**
+     * @brief 清空内容，保留已申请的内存
+     */
+    void clear() { m_size = 0; }
+    /**
+     * @brief 是否已使用堆内存
+     */
+    bool is_spilled() const { return m_data != m_inline; }
+
+    LogStream& operator<<(bool v) { put(v ? '1' : '0'); return *this; }
+    LogStream& operator<<(char v) { put(v); return *this; }
+    LogStream& operator<<(signed char v) { put(v); return *this; }
+    LogStream& operator<<(unsigned char v) { put(v); return *this; }
+    LogStream& operator<<(short v) { return append_int(v); }
+    LogStream& operator<<(unsigned short v) { return append_uint(v); }
+    LogStream& operator<<(int v) { return append_int(v); }
+    LogStream& operator<<(unsigned int v) { return append_uint(v); }
+    LogStream& operator<<(long v) { return append_int(v); }
+    LogStream& operator<<(unsigned long v) { return append_uint(v); }
+    LogStream& operator<<(long long v) { return append_int(v); }
+    LogStream& operator<<(unsigned long long v) { return append_uint(v); }
+    LogStream& operator<<(float v) { return append_double(v); }
+    LogStream& operator<<(double v) { return append_double(v); }
+    LogStream& operator<<(long double v) { return append_double(v); }
+    LogStream& operator<<(const void* v);
+    LogStream& operator<<(const char* v);
+    LogStream& operator<<(const std::string& v) { append(v.data(), v.size()); return *this; }
+    LogStream& operator<<(std::string_view v) { append(v.data(), v.size()); return *this; }
+    /**
+     * @brief 兼容std::endl等流操纵符
+     */
+    LogStream& operator<<(std::ostream& (*pf)(std::ostream&));
+
+    /**
+     * @brief 其它类型通过其operator<<(std::ostream&, const T&)输出
+     * @details 排除能转换为指针的类型，char*、char[N]和非const指针不经过ostringstream，
+     *          而是使用上面的const char*或const void*版本
+     */
+    template<class T>
+    typename std::enable_if<!std::is_arithmetic<T>::value
+                            && !std::is_convertible<const T&, const char*>::value
+                            && !std::is_convertible<const T&, const void*>::value, LogStream&>::type
+    operator<<(const T& v) {
+        std::ostringstream ss;
+        ss << v;
+        const std::string& str = ss.str();
+        append(str.data(), str.size());
+        return *this;
+    }
+
+private:
+    void put(char c) {
+        if (m_size == m_capacity) {
+            grow(m_size + 1);
+        }
+        m_data[m_size++] = c;
+    }
+    void grow(size_t need);
+    LogStream& append_int(long long v) {
+        char* p = reserve(number_format::INT_SIZE);
+        commit(number_format::format_int(p, v) - p);
+        return *this;
+    }
+    LogStream& append_uint(unsigned long long v) {
+        char* p = reserve(number_format::INT_SIZE);
+        commit(number_format::format_uint(p, v) - p);
+        return *this;
+    }
+    template<class T>
+    LogStream& append_double(T v) {
+        char* p = reserve(number_format::FLOAT_SIZE);
+        commit(number_format::format_float(p, v) - p);
+        return *this;
+    }
+
+private:
+    //当前使用的缓冲区，指向m_inline或堆内存
+    char* m_data = m_inline;
+    size_t m_size = 0;
+    size_t m_capacity = INLINE_SIZE;
+    //内置缓冲区
+    char m_inline[INLINE_SIZE];
+};
+
+}
+
+#endif // !__LOG_STREAM_H__
@@ -0,0 +1,273 @@
+#include "mmap_appender.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace lckl {
+
+namespace {
+
+size_t page_size() {
+    static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+size_t page_floor(size_t n) {
+    return n & ~(page_size() - 1);
+}
+
+}
+
+MmapFileLogAppender::MmapFileLogAppender(const std::string& basename, size_t segment_size
+                                        ,uint32_t roll_interval, uint32_t sync_interval
+                                        ,uint32_t index_block)
+    :m_basename(basename)
+    ,m_segment_size(std::max(segment_size, page_size()))
+    ,m_roll_interval(roll_interval)
+    ,m_sync_interval(sync_interval)
+    ,m_has_index(index_block != 0)
+    ,m_index(index_block) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        open_segment(time(0), m_segment_size);
+    }
+    m_thread = std::thread(&MmapFileLogAppender::run, this);
+}
+
+MmapFileLogAppender::~MmapFileLogAppender() {
+    stop();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    close_segment();
+}
+
+bool MmapFileLogAppender::open_segment(time_t now, size_t size) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S.", &tm);
+    uint32_t index = m_segment_count.fetch_add(1, std::memory_order_relaxed);
+    m_path = m_basename + std::string(buf, n) + std::to_string(index);
+    //按本地时间对齐到下一个边界
+    if (m_roll_interval) {
+        time_t local = now + tm.tm_gmtoff;
+        m_roll_time = (local / m_roll_interval + 1) * m_roll_interval - tm.tm_gmtoff;
+    } else {
+        m_roll_time = 0;
+    }
+
+    m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        return false;
+    }
+    //预先分配磁盘空间，避免写映射区时因空间不足收到SIGBUS
+    size = (size + page_size() - 1) & ~(page_size() - 1);
+    int rt = posix_fallocate(m_fd, 0, size);
+    if (rt == EOPNOTSUPP || rt == EINVAL) {
+        rt = ftruncate(m_fd, size) ? errno : 0;
+    }
+    void* p = rt ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED) {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_data = (char*)p;
+    m_capacity = size;
+    m_offset = 0;
+    m_released = 0;
+    m_synced = 0;
+    if (m_has_index) {
+        m_index.open(log_index::get_index_path(m_path));
+    }
+    return true;
+}
+
+void MmapFileLogAppender::close_segment() {
+    m_index.close();
+    if (m_data) {
+        //解除映射后脏页仍在页缓存中，由内核写回
+        munmap(m_data, m_capacity);
+        m_data = nullptr;
+    }
+    if (m_fd != -1) {
+        //截掉预分配但未使用的部分，失败时文件末尾留有0字节
+        int rt = ftruncate(m_fd, m_offset);
+        (void)rt;
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_capacity = m_offset = 0;
+}
+
+bool MmapFileLogAppender::roll(time_t now, size_t size) {
+    close_segment();
+    return open_segment(now, size);
+}
+
+void MmapFileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    LogFormatter::ptr formatter = get_formatter();
+    if (!formatter) {
+        return;
+    }
+    time_t now = event->get_time();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_exited) {
+        std::string text;
+        formatter->format(text, logger, level, *event);
+        write_file(text.data(), text.size());
+        return;
+    }
+    if ((!m_data || need_roll(now)) && !roll(now, m_segment_size)) {
+        return;
+    }
+    size_t len = formatter->format(m_data + m_offset, m_capacity - m_offset, logger, level, *event);
+    if (m_offset + len > m_capacity) {
+        //放不下时整条日志写到新分段，超长的日志单独使用一个足够大的分段
+        if (!roll(now, std::max(m_segment_size, len))) {
+            return;
+        }
+        len = std::min(formatter->format(m_data, m_capacity, logger, level, *event), m_capacity);
+    }
+    m_index.add(m_offset, len, event->get_time() * 1000000 + event->get_usec()
+               ,level, event->get_logger()->get_name());
+    m_offset += len;
+    m_written.fetch_add(len, std::memory_order_relaxed);
+}
+
+void MmapFileLogAppender::write(const char* data, size_t len) {
+    time_t now = time(0);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_exited) {
+        write_file(data, len);
+        return;
+    }
+    if ((!m_data || need_roll(now)) && !roll(now, m_segment_size)) {
+        return;
+    }
+    if (m_offset + len > m_capacity && !roll(now, std::max(m_segment_size, len))) {
+        return;
+    }
+    memcpy(m_data + m_offset, data, len);
+    m_index.add_raw(m_offset, len);
+    m_offset += len;
+    m_written.fetch_add(len, std::memory_order_relaxed);
+}
+
+void MmapFileLogAppender::crash_write(const char* data, size_t len) {
+    if (!m_data || m_offset + len > m_capacity) {
+        return;
+    }
+    memcpy(m_data + m_offset, data, len);
+    m_offset += len;
+}
+
+void MmapFileLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_data || m_offset == m_synced) {
+        return;
+    }
+    //已释放的页只发起过MS_ASYNC，仍要同步；MADV_DONTNEED之后这段地址依然映射着文件
+    size_t begin = page_floor(m_synced);
+    msync(m_data + begin, m_offset - begin, MS_SYNC);
+    m_synced = m_offset;
+}
+
+void MmapFileLogAppender::release_pages() {
+    if (!m_data) {
+        return;
+    }
+    //只处理完全写满的页，写入位置所在的页还在使用
+    size_t end = page_floor(m_offset);
+    if (end <= m_released) {
+        return;
+    }
+    msync(m_data + m_released, end - m_released, MS_ASYNC);
+    madvise(m_data + m_released, end - m_released, MADV_DONTNEED);
+    m_released = end;
+}
+
+void MmapFileLogAppender::on_exit() {
+    stop();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_exited) {
+        return;
+    }
+    m_exited = true;
+    m_index.close();
+    if (m_data) {
+        munmap(m_data, m_capacity);
+        m_data = nullptr;
+    }
+    if (m_fd != -1) {
+        int rt = ftruncate(m_fd, m_offset);
+        (void)rt;
+    }
+    m_capacity = 0;
+}
+
+void MmapFileLogAppender::write_file(const char* data, size_t len) {
+    while (m_fd != -1 && len > 0) {
+        ssize_t rt = pwrite(m_fd, data, len, m_offset);
+        if (rt < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rt <= 0) {
+            return;
+        }
+        data += rt;
+        len -= rt;
+        m_offset += rt;
+        m_written.fetch_add(rt, std::memory_order_relaxed);
+    }
+}
+
+bool MmapFileLogAppender::reopen() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_exited) {
+        return false;
+    }
+    return roll(time(0), m_segment_size);
+}
+
+std::string MmapFileLogAppender::get_path() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_path;
+}
+
+void MmapFileLogAppender::stop() {
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wait_mutex);
+        m_cond.notify_one();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void MmapFileLogAppender::run() {
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        {
+            std::unique_lock<std::mutex> lock(m_wait_mutex);
+            m_cond.wait_for(lock, std::chrono::milliseconds(m_sync_interval));
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        release_pages();
+        //没有新日志时也按时间边界关闭分段
+        time_t now = time(0);
+        if (m_data && m_offset > 0 && need_roll(now)) {
+            roll(now, m_segment_size);
+        }
+    }
+}
+
+}
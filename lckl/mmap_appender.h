@@ -0,0 +1,143 @@
+#ifndef __MMAP_APPENDER_H__
+#define __MMAP_APPENDER_H__
+
+#include "log.h"
+#include "log_index.h"
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+namespace lckl {
+
+/**
+ * @brief 通过mmap写入的滚动文件Appender
+ * @details 每个分段文件预先分配segment_size字节并映射到内存，日志直接格式化到映射区，
+ *          单条日志没有系统调用。数据在页缓存中，进程崩溃后依然会写回文件。
+ *          后台线程按周期对已写满的页发起msync(MS_ASYNC)并madvise(MADV_DONTNEED)，
+ *          避免映射区占用的内存随文件增长。
+ *          分段写满或到达时间边界(按本地时间对齐)时滚动到新文件，
+ *          文件名为 basename.YYYYmmdd-HHMMSS.序号，关闭分段时截掉未使用的部分。
+ *          进程正常退出时(on_exit)同样截掉最后一个分段并写完索引，之后的日志直接追加写入该文件；
+ *          进程崩溃时最后一个分段的末尾会留有未截掉的0字节。
+ *          开启索引后每个分段同时写一个稀疏索引文件(见log_index)，供tools/lckl_query按时间范围、
+ *          级别和日志器只扫描可能匹配的块
+ */
+class MmapFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<MmapFileLogAppender> ptr;
+
+    /**
+     * @brief Construct a new Mmap File Log Appender object
+     *
+     * @param basename 分段文件路径前缀
+     * @param segment_size 每个分段的大小
+     * @param roll_interval 按时间滚动的周期，秒，0表示只按大小滚动
+     * @param sync_interval 后台msync周期，毫秒
+     * @param index_block 索引的块大小，0表示不写索引
+     */
+    MmapFileLogAppender(const std::string& basename
+                       ,size_t segment_size = 64 * 1024 * 1024
+                       ,uint32_t roll_interval = 0
+                       ,uint32_t sync_interval = 1000
+                       ,uint32_t index_block = 0);
+    ~MmapFileLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 同步写回当前分段中上次flush之后写入的数据(msync MS_SYNC)
+     * @details 包括后台线程已发起异步写回并释放的页，返回时这些数据都已落盘
+     */
+    void flush() override;
+    /**
+     * @brief 写入映射中剩余的空间，放不下时丢弃
+     * @details 已写入映射的日志在进程崩溃后仍由内核写回，不需要crash_flush
+     */
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 停止后台线程，截掉当前分段未使用的部分并写完索引
+     * @details 之后的日志不再经过映射，用pwrite追加到该分段，也不再滚动
+     */
+    void on_exit() override;
+    /**
+     * @brief 关闭当前分段，开始新的分段
+     * @return 成功返回true，on_exit之后返回false
+     */
+    bool reopen();
+    /**
+     * @brief 停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 当前分段的文件路径
+     */
+    std::string get_path();
+    /**
+     * @brief 写入的总字节数
+     */
+    uint64_t get_written() const { return m_written.load(std::memory_order_relaxed); }
+    /**
+     * @brief 打开过的分段数
+     */
+    uint32_t get_segment_count() const { return m_segment_count.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief 该时间是否已越过当前分段的时间边界
+     */
+    bool need_roll(time_t now) const { return m_roll_time && now >= m_roll_time; }
+    /**
+     * @brief 关闭当前分段并打开至少size字节的新分段，调用方持有m_mutex
+     */
+    bool roll(time_t now, size_t size);
+    bool open_segment(time_t now, size_t size);
+    void close_segment();
+    /**
+     * @brief 对已写满的页发起异步写回并释放映射，调用方持有m_mutex
+     */
+    void release_pages();
+    /**
+     * @brief on_exit之后直接写入文件，调用方持有m_mutex
+     */
+    void write_file(const char* data, size_t len);
+    void run();
+
+private:
+    std::string m_basename;
+    size_t m_segment_size;
+    uint32_t m_roll_interval;
+    uint32_t m_sync_interval;
+
+    //当前分段
+    std::string m_path;
+    int m_fd = -1;
+    char* m_data = nullptr;
+    size_t m_capacity = 0;
+    //已写入的位置
+    size_t m_offset = 0;
+    //此位置之前的页已释放，按页对齐
+    size_t m_released = 0;
+    //此位置之前的数据已由flush同步落盘
+    size_t m_synced = 0;
+    //当前分段的时间边界，0表示不按时间滚动
+    time_t m_roll_time = 0;
+    //当前分段的索引，m_has_index为false时不打开
+    bool m_has_index;
+    LogIndexWriter m_index;
+    //已调用on_exit，分段已截断、不再映射
+    bool m_exited = false;
+
+    std::mutex m_wait_mutex;
+    std::condition_variable m_cond;
+    std::atomic<bool> m_stopping{false};
+    std::thread m_thread;
+
+    std::atomic<uint64_t> m_written{0};
+    std::atomic<uint32_t> m_segment_count{0};
+};
+
+}
+
+#endif // !__MMAP_APPENDER_H__
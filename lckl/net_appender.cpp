@@ -0,0 +1,390 @@
+#include "net_appender.h"
+#include "log_metrics.h"
+#include "util.h"
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lckl {
+
+static const uint32_t s_min_backoff = 100;
+static const uint32_t s_max_backoff = 10000;
+//TCP每个数据块的大小
+static const size_t s_tcp_chunk = 64 * 1024;
+//一次sendmmsg最多发送的数据报
+static const size_t s_max_batch = 64;
+static const size_t s_max_free = 16;
+static const uint64_t s_flush_timeout = 1000;
+
+namespace {
+
+uint64_t count_records(const char* data, size_t len) {
+    uint64_t n = std::count(data, data + len, '\n');
+    return n ? n : 1;
+}
+
+}
+
+NetworkLogAppender::NetworkLogAppender(Protocol protocol, const std::string& host, uint16_t port
+                                      ,size_t max_pending, size_t max_datagram)
+    :m_protocol(protocol)
+    ,m_host(host)
+    ,m_port(port)
+    ,m_max_pending(max_pending)
+    ,m_backoff(s_min_backoff) {
+    if (m_protocol == UDP) {
+        //IPv4 UDP载荷的上限
+        m_max_chunk = std::min(std::max(max_datagram, (size_t)512), (size_t)65507);
+    } else {
+        m_max_chunk = s_tcp_chunk;
+    }
+    memset(&m_addr, 0, sizeof(m_addr));
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = m_protocol == UDP ? SOCK_DGRAM : SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0 || !res) {
+        std::cout << "NetworkLogAppender resolve " << host << ":" << port << " failed" << std::endl;
+        return;
+    }
+    memcpy(&m_addr, res->ai_addr, res->ai_addrlen);
+    m_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    if (m_protocol == UDP) {
+        //connect之后用send/sendmmsg不用再带地址，收集器不在时也能收到ECONNREFUSED
+        m_fd = socket(m_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_fd != -1 && connect(m_fd, (struct sockaddr*)&m_addr, m_addr_len) != 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_connected.store(m_fd != -1, std::memory_order_relaxed);
+    }
+}
+
+NetworkLogAppender::~NetworkLogAppender() {
+    flush();
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+void NetworkLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_formatter) {
+        return;
+    }
+    m_buf.clear();
+    m_formatter->format(m_buf, logger, level, *event);
+    append(m_buf.data(), m_buf.size());
+    send_pending();
+}
+
+void NetworkLogAppender::write(const char* data, size_t len) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    append(data, len);
+    send_pending();
+}
+
+void NetworkLogAppender::flush() {
+    uint64_t deadline = get_elapse_ms() + s_flush_timeout;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!send_pending()) {
+        uint64_t now = get_elapse_ms();
+        //等待重连的退避期间不等
+        if (now >= deadline || m_fd == -1) {
+            break;
+        }
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLOUT;
+        int rt = poll(&pfd, 1, deadline - now);
+        (void)rt;
+    }
+}
+
+void NetworkLogAppender::on_tick() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    send_pending();
+}
+
+void NetworkLogAppender::crash_flush() {
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        size_t offset = i == 0 ? m_head_offset : 0;
+        crash_send(m_chunks[i].data() + offset, m_chunks[i].size() - offset);
+    }
+}
+
+void NetworkLogAppender::crash_write(const char* data, size_t len) {
+    crash_send(data, len);
+}
+
+void NetworkLogAppender::crash_send(const char* data, size_t len) {
+    if (m_fd == -1 || m_connecting) {
+        return;
+    }
+    while (len > 0) {
+        //UDP按数据报上限切开，不再对齐行尾
+        size_t size = m_protocol == UDP ? std::min(len, m_max_chunk) : len;
+        ssize_t n = send(m_fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+void NetworkLogAppender::append(const char* data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (m_pending_bytes.load(std::memory_order_relaxed) + len > m_max_pending) {
+        add_dropped(count_records(data, len));
+        return;
+    }
+    m_pending_bytes.fetch_add(len, std::memory_order_relaxed);
+    bool next = false;
+    while (len) {
+        if (next || m_chunks.empty() || m_chunks.back().size() >= m_max_chunk) {
+            if (m_free.empty()) {
+                m_chunks.emplace_back();
+                m_chunks.back().reserve(m_max_chunk);
+            } else {
+                m_chunks.push_back(std::move(m_free.back()));
+                m_free.pop_back();
+            }
+            next = false;
+        }
+        std::string& tail = m_chunks.back();
+        size_t room = m_max_chunk - tail.size();
+        if (len <= room) {
+            tail.append(data, len);
+            break;
+        }
+        size_t cut = room;
+        if (m_protocol == UDP) {
+            //数据报在行尾切开，单条超过一个数据报的日志才从中间切开
+            const char* nl = (const char*)memrchr(data, '\n', room);
+            if (nl) {
+                cut = nl - data + 1;
+            } else if (!tail.empty()) {
+                cut = 0;
+            }
+            next = true;
+        }
+        tail.append(data, cut);
+        data += cut;
+        len -= cut;
+    }
+}
+
+bool NetworkLogAppender::send_pending() {
+    if (m_chunks.empty()) {
+        return true;
+    }
+    if (m_protocol == UDP) {
+        return send_udp();
+    }
+    return check_connection() && send_tcp();
+}
+
+bool NetworkLogAppender::send_udp() {
+    if (m_fd == -1) {
+        while (!m_chunks.empty()) {
+            add_dropped(count_records(m_chunks.front().data(), m_chunks.front().size()));
+            pop_front();
+        }
+        return true;
+    }
+    struct mmsghdr msgs[s_max_batch];
+    struct iovec iovs[s_max_batch];
+    while (!m_chunks.empty()) {
+        size_t cnt = std::min(m_chunks.size(), s_max_batch);
+        memset(msgs, 0, sizeof(msgs[0]) * cnt);
+        for (size_t i = 0; i < cnt; ++i) {
+            iovs[i].iov_base = &m_chunks[i][0];
+            iovs[i].iov_len = m_chunks[i].size();
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = sendmmsg(m_fd, msgs, cnt, MSG_DONTWAIT | MSG_NOSIGNAL);
+        m_syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                return false;
+            }
+            //收集器不在(ECONNREFUSED)等错误，丢弃队首的数据报，后面的继续发
+            add_dropped(count_records(m_chunks.front().data(), m_chunks.front().size()));
+            pop_front();
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            m_sent.fetch_add(m_chunks.front().size(), std::memory_order_relaxed);
+            pop_front();
+        }
+    }
+    return true;
+}
+
+bool NetworkLogAppender::send_tcp() {
+    struct iovec iovs[std::min(IOV_MAX, 64)];
+    const size_t max_iov = sizeof(iovs) / sizeof(iovs[0]);
+    while (!m_chunks.empty()) {
+        size_t cnt = std::min(m_chunks.size(), max_iov);
+        for (size_t i = 0; i < cnt; ++i) {
+            size_t offset = i == 0 ? m_head_offset : 0;
+            iovs[i].iov_base = &m_chunks[i][0] + offset;
+            iovs[i].iov_len = m_chunks[i].size() - offset;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(m_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        m_syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            close_socket(true);
+            return false;
+        }
+        m_sent.fetch_add(n, std::memory_order_relaxed);
+        size_t left = n;
+        while (left) {
+            std::string& head = m_chunks.front();
+            size_t rest = head.size() - m_head_offset;
+            if (left < rest) {
+                m_head_offset += left;
+                m_pending_bytes.fetch_sub(left, std::memory_order_relaxed);
+                m_partial = head[m_head_offset - 1] != '\n';
+                break;
+            }
+            left -= rest;
+            m_partial = head.back() != '\n';
+            pop_front();
+        }
+    }
+    return true;
+}
+
+bool NetworkLogAppender::check_connection() {
+    if (m_fd != -1 && !m_connecting) {
+        return true;
+    }
+    if (m_fd == -1) {
+        if (!is_valid() || get_elapse_ms() < m_retry_time) {
+            return false;
+        }
+        m_connects.fetch_add(1, std::memory_order_relaxed);
+        m_fd = socket(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_fd == -1) {
+            close_socket(true);
+            return false;
+        }
+        if (connect(m_fd, (struct sockaddr*)&m_addr, m_addr_len) != 0) {
+            if (errno != EINPROGRESS) {
+                close_socket(true);
+                return false;
+            }
+            m_connecting = true;
+        }
+    }
+    if (m_connecting) {
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 0) <= 0) {
+            return false;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            close_socket(true);
+            return false;
+        }
+        m_connecting = false;
+    }
+    m_backoff = s_min_backoff;
+    m_connected.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void NetworkLogAppender::close_socket(bool retry) {
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_connecting = false;
+    m_connected.store(false, std::memory_order_relaxed);
+    if (retry) {
+        m_retry_time = get_elapse_ms() + m_backoff;
+        m_backoff = std::min(m_backoff * 2, s_max_backoff);
+    }
+    drop_partial();
+}
+
+void NetworkLogAppender::pop_front() {
+    std::string& head = m_chunks.front();
+    m_pending_bytes.fetch_sub(head.size() - m_head_offset, std::memory_order_relaxed);
+    m_head_offset = 0;
+    if (m_free.size() < s_max_free) {
+        head.clear();
+        m_free.push_back(std::move(head));
+    }
+    m_chunks.pop_front();
+}
+
+void NetworkLogAppender::add_dropped(uint64_t n) {
+    m_dropped.fetch_add(n, std::memory_order_relaxed);
+    LogMetrics::add(LogMetrics::DROPPED, n);
+}
+
+void NetworkLogAppender::drop_partial() {
+    if (!m_partial) {
+        return;
+    }
+    m_partial = false;
+    add_dropped(1);
+    //丢到下一个行尾，之后的数据从新连接的行首开始
+    while (!m_chunks.empty()) {
+        std::string& head = m_chunks.front();
+        const char* begin = head.data() + m_head_offset;
+        const char* nl = (const char*)memchr(begin, '\n', head.size() - m_head_offset);
+        if (!nl) {
+            pop_front();
+            continue;
+        }
+        size_t skip = nl + 1 - begin;
+        m_head_offset += skip;
+        m_pending_bytes.fetch_sub(skip, std::memory_order_relaxed);
+        if (m_head_offset == head.size()) {
+            pop_front();
+        }
+        return;
+    }
+}
+
+}
@@ -0,0 +1,159 @@
+#ifndef __NET_APPENDER_H__
+#define __NET_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <sys/socket.h>
+
+namespace lckl {
+
+/**
+ * @brief 发送到远端收集器的Appender
+ * @details 设计为AsyncLogAppender/ShardedLogAppender的下游，所有网络操作都在上游的后台线程中进行，
+ *          调用Logger的线程不会被慢的收集器阻塞。套接字是非阻塞的，写不出去的数据
+ *          暂存在内存中，总量超过max_pending时丢弃新的日志并计数，上游空闲时通过on_tick重试。
+ *          UDP: 连续的日志按行合并为不超过max_datagram字节的数据报，一次sendmmsg发送多个，
+ *               单条超长的日志被切成多个数据报。
+ *          TCP: 保持一个长连接，暂存的数据块用一次sendmsg(等同writev，带MSG_NOSIGNAL)写出；
+ *               非阻塞connect，断开后按100ms到10s指数退避重连，
+ *               重连后丢弃写了一半的那一条日志，保证新连接从行首开始
+ */
+class NetworkLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<NetworkLogAppender> ptr;
+
+    enum Protocol {
+        UDP = 0,
+        TCP
+    };
+
+    /**
+     * @brief Construct a new Network Log Appender object
+     *
+     * @param protocol 协议
+     * @param host 主机名或地址，构造时解析一次
+     * @param port 端口
+     * @param max_pending 暂存数据的上限，字节
+     * @param max_datagram UDP数据报的最大长度
+     */
+    NetworkLogAppender(Protocol protocol, const std::string& host, uint16_t port
+                      ,size_t max_pending = 4 * 1024 * 1024
+                      ,size_t max_datagram = 8192);
+    ~NetworkLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 尽量发出暂存的数据，最多等待1秒
+     */
+    void flush() override;
+    void on_tick() override;
+    /**
+     * @brief 已连接时不等待地发出暂存的数据，发不出的丢弃
+     */
+    void crash_flush() override;
+    void crash_write(const char* data, size_t len) override;
+
+    Protocol get_protocol() const { return m_protocol; }
+    /**
+     * @brief 地址是否解析成功
+     */
+    bool is_valid() const { return m_addr_len != 0; }
+    /**
+     * @brief TCP是否已连接，UDP总是true
+     */
+    bool is_connected() const { return m_connected.load(std::memory_order_relaxed); }
+    /**
+     * @brief 丢弃的日志条数
+     */
+    uint64_t get_dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    /**
+     * @brief 已发出的字节数
+     */
+    uint64_t get_sent() const { return m_sent.load(std::memory_order_relaxed); }
+    /**
+     * @brief 暂存的字节数
+     */
+    size_t get_pending() const { return m_pending_bytes.load(std::memory_order_relaxed); }
+    /**
+     * @brief 发送系统调用次数
+     */
+    uint64_t get_syscall_count() const { return m_syscalls.load(std::memory_order_relaxed); }
+    /**
+     * @brief TCP连接次数
+     */
+    uint64_t get_connect_count() const { return m_connects.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief 放入暂存队列，调用方持有m_mutex
+     */
+    void append(const char* data, size_t len);
+    /**
+     * @brief 发出尽可能多的暂存数据，调用方持有m_mutex
+     * @return 暂存队列已清空返回true
+     */
+    bool send_pending();
+    bool send_udp();
+    bool send_tcp();
+    /**
+     * @brief 检查TCP连接状态，需要时发起重连
+     * @return 已连接返回true
+     */
+    bool check_connection();
+    void close_socket(bool retry);
+    /**
+     * @brief 队首数据块发出后出队
+     */
+    void pop_front();
+    /**
+     * @brief 连接断开时丢弃写了一半的那一条日志的剩余部分
+     */
+    void drop_partial();
+    void add_dropped(uint64_t n);
+    /**
+     * @brief 崩溃时不等待地发送，只用send
+     */
+    void crash_send(const char* data, size_t len);
+
+private:
+    Protocol m_protocol;
+    std::string m_host;
+    uint16_t m_port;
+    size_t m_max_pending;
+    size_t m_max_chunk;
+
+    struct sockaddr_storage m_addr;
+    socklen_t m_addr_len = 0;
+    int m_fd = -1;
+    //TCP非阻塞connect进行中
+    bool m_connecting = false;
+    //下次重连的时间，毫秒
+    uint64_t m_retry_time = 0;
+    uint32_t m_backoff;
+
+    //暂存的数据块，UDP每块是一个数据报
+    std::deque<std::string> m_chunks;
+    //发出后回收的数据块
+    std::vector<std::string> m_free;
+    //TCP队首数据块已写出的字节数
+    size_t m_head_offset = 0;
+    //TCP已写出的数据是否停在一条日志中间
+    bool m_partial = false;
+    //格式化用的临时缓冲
+    std::string m_buf;
+
+    std::atomic<bool> m_connected{false};
+    std::atomic<size_t> m_pending_bytes{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_sent{0};
+    std::atomic<uint64_t> m_syscalls{0};
+    std::atomic<uint64_t> m_connects{0};
+};
+
+}
+
+#endif // !__NET_APPENDER_H__
@@ -0,0 +1,174 @@
+#ifndef __NUMBER_FORMAT_H__
+#define __NUMBER_FORMAT_H__
+
+#include <charconv>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <type_traits>
+
+namespace lckl {
+
+/**
+ * @brief 数字转文本
+ * @details 整数按两位一组查表输出：先按10^4/10^8分段(常量除法，编译为乘法)，
+ *          每段乘以2^32/10^k得到定点小数，之后每次乘100取高32位就是下一组两位数字。
+ *          浮点数用std::to_chars(Ryu)，输出与std::ostream默认的6位%g一致
+ */
+namespace number_format {
+
+inline constexpr char DIGIT_PAIRS[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+//整数输出需要的最大长度
+static const size_t INT_SIZE = 20;
+//浮点数输出需要的最大长度
+static const size_t FLOAT_SIZE = 64;
+
+inline char* copy_pair(char* p, uint32_t n) {
+    memcpy(p, DIGIT_PAIRS + n * 2, 2);
+    return p + 2;
+}
+
+/**
+ * @brief 输出n(<100)，不补0
+ */
+inline char* write_head(char* p, uint32_t n) {
+    if (n < 10) {
+        *p = '0' + n;
+        return p + 1;
+    }
+    return copy_pair(p, n);
+}
+
+/**
+ * @brief 输出n(<10000)，不补0
+ */
+inline char* write_upto4(char* p, uint32_t n) {
+    if (n < 100) {
+        return write_head(p, n);
+    }
+    //高32位是n/100，低32位是n%100/100的定点小数
+    uint64_t t = (uint64_t)n * 42949673;
+    p = write_head(p, t >> 32);
+    t = (uint64_t)(uint32_t)t * 100;
+    return copy_pair(p, t >> 32);
+}
+
+/**
+ * @brief 输出n(<10000)，补0到4位
+ */
+inline char* write_fixed4(char* p, uint32_t n) {
+    uint64_t t = (uint64_t)n * 429497;
+    t = (uint64_t)(uint32_t)t * 100;
+    p = copy_pair(p, t >> 32);
+    t = (uint64_t)(uint32_t)t * 100;
+    return copy_pair(p, t >> 32);
+}
+
+/**
+ * @brief 输出n(<10^8)，补0到8位
+ */
+inline char* write_fixed8(char* p, uint32_t n) {
+    p = write_fixed4(p, n / 10000);
+    return write_fixed4(p, n % 10000);
+}
+
+/**
+ * @brief 输出32位无符号整数，返回写入结束位置
+ */
+inline char* format_uint32(char* p, uint32_t n) {
+    if (n < 10000) {
+        return write_upto4(p, n);
+    }
+    if (n < 100000000) {
+        p = write_upto4(p, n / 10000);
+        return write_fixed4(p, n % 10000);
+    }
+    p = write_head(p, n / 100000000);
+    return write_fixed8(p, n % 100000000);
+}
+
+/**
+ * @brief 输出无符号整数，p至少有INT_SIZE字节，返回写入结束位置
+ */
+inline char* format_uint(char* p, uint64_t n) {
+    if (n <= 0xffffffffu) {
+        return format_uint32(p, n);
+    }
+    uint64_t hi = n / 100000000;
+    uint32_t lo = n % 100000000;
+    if (hi <= 0xffffffffu) {
+        p = format_uint32(p, hi);
+    } else {
+        p = format_uint32(p, hi / 100000000);
+        p = write_fixed8(p, hi % 100000000);
+    }
+    return write_fixed8(p, lo);
+}
+
+/**
+ * @brief 输出有符号整数，p至少有INT_SIZE字节，返回写入结束位置
+ */
+inline char* format_int(char* p, int64_t n) {
+    if (n < 0) {
+        *p++ = '-';
+        return format_uint(p, 0 - (uint64_t)n);
+    }
+    return format_uint(p, n);
+}
+
+/**
+ * @brief 按6位有效数字的%g输出浮点数，p至少有FLOAT_SIZE字节，返回写入结束位置
+ */
+template<class T>
+inline char* format_float(char* p, T v) {
+    return std::to_chars(p, p + FLOAT_SIZE, v, std::chars_format::general, 6).ptr;
+}
+
+/**
+ * @brief 按类型选择整数输出
+ */
+template<class T>
+inline char* format_integer(char* p, T v) {
+    if constexpr (std::is_signed<T>::value) {
+        return format_int(p, v);
+    } else {
+        return format_uint(p, v);
+    }
+}
+
+/**
+ * @brief 线程内缓存的id文本
+ * @details 线程id、协程id在同一线程内几乎不变，值与上次相同时直接返回缓存的文本
+ */
+enum CachedIdType {
+    THREAD_ID = 0,
+    FIBER_ID,
+    CACHED_ID_COUNT
+};
+
+inline std::string_view cached_id_text(CachedIdType type, uint32_t id) {
+    struct Cache {
+        uint64_t id = ~(uint64_t)0;
+        uint32_t len = 0;
+        char text[12];
+    };
+    static thread_local Cache t_caches[CACHED_ID_COUNT];
+    Cache& c = t_caches[type];
+    if (c.id != id) {
+        c.id = id;
+        c.len = format_uint32(c.text, id) - c.text;
+    }
+    return std::string_view(c.text, c.len);
+}
+
+}
+
+}
+
+#endif // !__NUMBER_FORMAT_H__
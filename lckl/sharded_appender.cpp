@@ -0,0 +1,410 @@
+#include "sharded_appender.h"
+#include "log_crash.h"
+#include "log_metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+namespace lckl {
+
+//后台线程每轮从单个分片取出的最大记录数
+static const size_t s_max_batch = 256;
+//批量写缓冲达到此大小时写入下游
+static const size_t s_batch_size = 64 * 1024;
+//重排窗口中最多积压的记录数，超出时提前写出最早的记录
+static const size_t s_max_pending = 65536;
+
+/**
+ * @brief 单个线程的分片
+ */
+struct ShardedLogAppender::Shard {
+    /**
+     * @brief 队列中的一条记录
+     */
+    struct Record {
+        //日志时间，微秒
+        uint64_t time = 0;
+        //已格式化的日志文本
+        std::string text;
+    };
+
+    Shard(size_t capacity)
+        :ring(capacity) {
+    }
+
+    SpscRingBuffer<Record> ring;
+    //所属线程缓存的格式化器，版本变化时重新获取
+    LogFormatter::ptr formatter;
+    uint32_t formatter_version = 0;
+    //所属线程已退出
+    std::atomic<bool> detached{false};
+    //所属Appender已销毁
+    std::atomic<bool> closed{false};
+};
+
+namespace {
+
+struct ShardRef {
+    uint64_t id;
+    std::shared_ptr<ShardedLogAppender::Shard> shard;
+};
+
+/**
+ * @brief 当前线程在各个Appender中的分片，线程退出时交由后台线程回收
+ */
+struct ThreadShardList {
+    ~ThreadShardList() {
+        for (auto& i : refs) {
+            i.shard->detached.store(true, std::memory_order_release);
+        }
+    }
+    std::vector<ShardRef> refs;
+};
+
+thread_local ThreadShardList t_shards;
+std::atomic<uint64_t> s_appender_id{0};
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 小根堆的比较函数，时间相同时先到的在前
+ */
+template<class T>
+bool later(const T& a, const T& b) {
+    return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+}
+
+}
+
+ShardedLogAppender::ShardedLogAppender(LogAppender::ptr sink, size_t shard_capacity
+                                      ,OverflowPolicy policy, bool ordered
+                                      ,uint32_t reorder_window)
+    :m_sink(sink)
+    ,m_shard_capacity(shard_capacity)
+    ,m_policy(policy)
+    ,m_ordered(ordered)
+    ,m_reorder_window(reorder_window)
+    ,m_id(++s_appender_id) {
+    set_formatter(sink->get_formatter());
+    m_batch.reserve(s_batch_size + 4096);
+    m_thread = std::thread(&ShardedLogAppender::run, this);
+}
+
+ShardedLogAppender::~ShardedLogAppender() {
+    stop();
+    std::lock_guard<std::mutex> lock(m_shards_mutex);
+    for (auto& i : m_shards) {
+        i->closed.store(true, std::memory_order_release);
+    }
+    m_shards.clear();
+}
+
+ShardedLogAppender::Shard* ShardedLogAppender::get_shard() {
+    auto& refs = t_shards.refs;
+    for (size_t i = 0; i < refs.size(); ++i) {
+        if (refs[i].id == m_id) {
+            return refs[i].shard.get();
+        }
+    }
+    //顺便清理已销毁Appender的分片
+    refs.erase(std::remove_if(refs.begin(), refs.end(), [](const ShardRef& r) {
+                    return r.shard->closed.load(std::memory_order_acquire);
+                }), refs.end());
+    auto shard = std::make_shared<Shard>(m_shard_capacity);
+    {
+        std::lock_guard<std::mutex> lock(m_shards_mutex);
+        m_shards.push_back(shard);
+        m_shards_version.fetch_add(1, std::memory_order_release);
+    }
+    refs.push_back(ShardRef{m_id, shard});
+    return shard.get();
+}
+
+size_t ShardedLogAppender::get_shard_count() {
+    std::lock_guard<std::mutex> lock(m_shards_mutex);
+    return m_shards.size();
+}
+
+void ShardedLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    Shard* shard = get_shard();
+    //格式化器只在版本变化时加锁获取，生产者之间不竞争m_mutex
+    uint32_t version = get_formatter_version();
+    if (!shard->formatter || shard->formatter_version != version) {
+        shard->formatter = get_formatter();
+        shard->formatter_version = version;
+    }
+    const LogFormatter::ptr& formatter = shard->formatter;
+    if (!formatter) {
+        return;
+    }
+    uint64_t time = event->get_time() * 1000000ull + event->get_usec();
+    push(shard, time, [&](std::string& text) {
+        text.clear();
+        formatter->format(text, logger, level, *event);
+    });
+}
+
+void ShardedLogAppender::write(const char* data, size_t len) {
+    push(get_shard(), now_us(), [&](std::string& text) {
+        text.assign(data, len);
+    });
+}
+
+template<class F>
+void ShardedLogAppender::push(Shard* shard, uint64_t time, F&& f) {
+    uint64_t begin = LogMetrics::timer_begin();
+    for (int spin = 0; ; ++spin) {
+        if (m_stopping.load(std::memory_order_acquire)) {
+            std::string text;
+            f(text);
+            m_sink->write(text.data(), text.size());
+            return;
+        }
+        if (auto r = shard->ring.alloc()) {
+            r->time = time;
+            f(r->text);
+            shard->ring.commit();
+            break;
+        }
+        if (m_policy == DROP_NEWEST) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            LogMetrics::add(LogMetrics::DROPPED);
+            return;
+        } else if (spin < 64) {
+            std::this_thread::yield();
+        } else {
+            m_waiters.fetch_add(1);
+            wake_consumer();
+            {
+                std::unique_lock<std::mutex> lock(m_wait_mutex);
+                m_producer_cond.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            m_waiters.fetch_sub(1);
+        }
+    }
+    LogMetrics::add(LogMetrics::ENQUEUED);
+    LogMetrics::timer_end(LogMetrics::ENQUEUE_NS, begin);
+    //与后台线程设置m_sleeping、stop设置m_stopping配对，保证不会丢失唤醒和记录
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        wake_consumer();
+    }
+    if (m_stopping.load(std::memory_order_relaxed)) {
+        //入队前还未停止，stop的最后一次drain可能已经错过这条记录
+        while (!m_drained.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        drain_shard_direct(shard);
+    }
+}
+
+void ShardedLogAppender::drain_shard_direct(Shard* shard) {
+    bool written = false;
+    while (auto r = shard->ring.front()) {
+        m_sink->write(r->text.data(), r->text.size());
+        shard->ring.pop();
+        written = true;
+    }
+    if (written) {
+        m_sink->flush();
+    }
+}
+
+void ShardedLogAppender::flush() {
+    uint64_t req = m_flush_req.fetch_add(1) + 1;
+    m_waiters.fetch_add(1);
+    while (m_flush_done.load(std::memory_order_acquire) < req
+            && !m_stopping.load(std::memory_order_acquire)) {
+        wake_consumer();
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_producer_cond.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    m_waiters.fetch_sub(1);
+    m_sink->flush();
+}
+
+void ShardedLogAppender::on_exit() {
+    flush();
+    m_sink->on_exit();
+}
+
+void ShardedLogAppender::crash_flush() {
+    LogCrashHandler::flush_appender(m_sink.get());
+    if (!m_batch.empty()) {
+        m_sink->crash_write(m_batch.data(), m_batch.size());
+    }
+    for (auto& i : m_pending) {
+        m_sink->crash_write(i.text.data(), i.text.size());
+    }
+    for (auto& shard : m_shards) {
+        shard->ring.for_each([this](const Shard::Record& r) {
+            m_sink->crash_write(r.text.data(), r.text.size());
+        });
+    }
+}
+
+void ShardedLogAppender::crash_write(const char* data, size_t len) {
+    m_sink->crash_write(data, len);
+}
+
+void ShardedLogAppender::stop() {
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    //与push提交后检查m_stopping配对：要么这里能取到记录，要么生产者等drain结束后自己写出
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_consumer();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    //后台线程退出前仍在入队的记录
+    drain(true);
+    m_drained.store(true, std::memory_order_release);
+    m_sink->flush();
+}
+
+void ShardedLogAppender::wake_consumer() {
+    std::lock_guard<std::mutex> lock(m_wait_mutex);
+    m_consumer_cond.notify_one();
+}
+
+void ShardedLogAppender::write_batch() {
+    if (!m_batch.empty()) {
+        m_sink->write(m_batch.data(), m_batch.size());
+        m_batch.clear();
+    }
+}
+
+void ShardedLogAppender::emit_pending(uint64_t now, bool all) {
+    while (!m_pending.empty()) {
+        const Pending& top = m_pending.front();
+        if (!all && top.time + m_reorder_window > now && m_pending.size() <= s_max_pending) {
+            break;
+        }
+        std::pop_heap(m_pending.begin(), m_pending.end(), later<Pending>);
+        Pending& p = m_pending.back();
+        m_batch.append(p.text);
+        p.text.clear();
+        m_free_texts.push_back(std::move(p.text));
+        m_pending.pop_back();
+        if (m_batch.size() >= s_batch_size) {
+            write_batch();
+        }
+    }
+}
+
+size_t ShardedLogAppender::drain(bool all) {
+    uint64_t version = m_shards_version.load(std::memory_order_acquire);
+    if (version != m_local_version) {
+        std::lock_guard<std::mutex> lock(m_shards_mutex);
+        m_local_shards = m_shards;
+        m_local_version = m_shards_version.load(std::memory_order_relaxed);
+    }
+
+    size_t depth = 0;
+    for (auto& shard : m_local_shards) {
+        depth += shard->ring.size();
+    }
+    if (depth) {
+        LogMetrics::record(LogMetrics::QUEUE_DEPTH, depth);
+    }
+
+    size_t n = 0;
+    bool reap = false;
+    //flush时每个分片最多取一整队，避免生产者持续写入时无法返回
+    size_t limit = all ? m_shard_capacity : s_max_batch;
+    for (auto& shard : m_local_shards) {
+        auto& ring = shard->ring;
+        for (size_t i = 0; i < limit; ++i) {
+            auto r = ring.front();
+            if (!r) {
+                break;
+            }
+            if (m_ordered) {
+                //和槽位交换字符串，双方都保留已申请的内存
+                m_pending.push_back(Pending{r->time, m_pending_seq++, std::string()});
+                if (!m_free_texts.empty()) {
+                    m_pending.back().text.swap(m_free_texts.back());
+                    m_free_texts.pop_back();
+                }
+                m_pending.back().text.swap(r->text);
+                std::push_heap(m_pending.begin(), m_pending.end(), later<Pending>);
+            } else {
+                m_batch.append(r->text);
+            }
+            ring.pop();
+            ++n;
+            if (m_batch.size() >= s_batch_size) {
+                write_batch();
+            }
+        }
+        if (shard->detached.load(std::memory_order_acquire) && ring.empty()) {
+            reap = true;
+        }
+    }
+    if (m_ordered) {
+        emit_pending(now_us(), all);
+    }
+    write_batch();
+
+    if (reap) {
+        //回收已退出线程的空分片
+        std::lock_guard<std::mutex> lock(m_shards_mutex);
+        m_shards.erase(std::remove_if(m_shards.begin(), m_shards.end()
+                        ,[](const std::shared_ptr<Shard>& s) {
+                            return s->detached.load(std::memory_order_acquire) && s->ring.empty();
+                        }), m_shards.end());
+        m_shards_version.fetch_add(1, std::memory_order_release);
+    }
+    if (n && m_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_wait_mutex);
+        m_producer_cond.notify_all();
+    }
+    return n;
+}
+
+void ShardedLogAppender::run() {
+    for (;;) {
+        uint64_t req = m_flush_req.load(std::memory_order_acquire);
+        bool all = req != m_flush_done.load(std::memory_order_relaxed);
+        size_t n = drain(all);
+        if (all) {
+            m_flush_done.store(req, std::memory_order_release);
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_producer_cond.notify_all();
+        }
+        if (n) {
+            continue;
+        }
+        m_sink->on_tick();
+        if (m_stopping.load(std::memory_order_acquire)) {
+            break;
+        }
+        //重排窗口中有记录时只等到最早的记录到期
+        auto timeout = m_pending.empty() ? std::chrono::microseconds(100000)
+                                         : std::chrono::microseconds(m_reorder_window);
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool idle = !m_stopping.load(std::memory_order_acquire)
+                    && m_flush_req.load(std::memory_order_acquire) == m_flush_done.load(std::memory_order_relaxed)
+                    && m_shards_version.load(std::memory_order_acquire) == m_local_version;
+        for (auto& shard : m_local_shards) {
+            idle = idle && shard->ring.empty();
+        }
+        if (idle) {
+            m_consumer_cond.wait_for(lock, timeout);
+        }
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+    drain(true);
+}
+
+}
@@ -0,0 +1,262 @@
+#ifndef __SHARDED_APPENDER_H__
+#define __SHARDED_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace lckl {
+
+/**
+ * @brief 有界无锁单生产者单消费者队列
+ * @details 生产者和消费者各自缓存对方的位置，只在看起来满/空时才读取对方的原子变量，
+ *          正常入队出队不会引起缓存行在两个核之间来回传递
+ */
+template<class T>
+class SpscRingBuffer {
+public:
+    /**
+     * @brief Construct a new Spsc Ring Buffer object
+     *
+     * @param capacity 容量，向上取整为2的幂
+     */
+    SpscRingBuffer(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        m_mask = n - 1;
+        m_data.reset(new T[n]);
+    }
+
+    /**
+     * @brief 生产者取得下一个可写的槽位，队列满时返回nullptr
+     * @details 写完后调用commit发布
+     */
+    T* alloc() {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head > m_mask) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head > m_mask) {
+                return nullptr;
+            }
+        }
+        return &m_data[tail & m_mask];
+    }
+    /**
+     * @brief 发布alloc取得的槽位
+     */
+    void commit() {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 消费者取得队首槽位，队列空时返回nullptr
+     * @details 读完后调用pop释放
+     */
+    T* front() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail) {
+                return nullptr;
+            }
+        }
+        return &m_data[head & m_mask];
+    }
+    /**
+     * @brief 释放front取得的槽位
+     */
+    void pop() {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 依次访问队列中已发布的记录，不出队
+     * @details 只用于崩溃时写出，不与生产者和消费者同步，结果是尽力而为的
+     */
+    template<class F>
+    void for_each(F&& f) const {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        for (size_t i = m_head.load(std::memory_order_acquire); i != tail; ++i) {
+            f(m_data[i & m_mask]);
+        }
+    }
+
+    /**
+     * @brief 队列中的记录数(近似值)
+     */
+    size_t size() const {
+        size_t t = m_tail.load(std::memory_order_acquire);
+        size_t h = m_head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    std::unique_ptr<T[]> m_data;
+    size_t m_mask;
+    //生产者写入的位置和缓存的消费者位置
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cached_head = 0;
+    //消费者读取的位置和缓存的生产者位置
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_cached_tail = 0;
+};
+
+/**
+ * @brief 按线程分片的异步日志输出器
+ * @details 每个写日志的线程有自己的单生产者队列，日志在调用线程格式化后入队，
+ *          生产者之间没有任何共享的写操作，线程数增加时不会在同一个队列上竞争。
+ *          后台线程轮询所有分片，合并后批量写入下游Appender。
+ *          默认只保证同一线程的日志有序；ordered模式下后台线程按日志时间排序，
+ *          记录在重排窗口内等待更早的日志，超过窗口或积压过多时按时间顺序写出，
+ *          入队延迟超过窗口的日志可能仍然乱序
+ */
+class ShardedLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<ShardedLogAppender> ptr;
+
+    /**
+     * @brief 分片队列满时的处理策略
+     */
+    enum OverflowPolicy {
+        //等待队列有空位
+        BLOCK = 0,
+        //丢弃新的记录
+        DROP_NEWEST
+    };
+
+    /**
+     * @brief Construct a new Sharded Log Appender object
+     *
+     * @param sink 下游Appender，只由后台线程调用
+     * @param shard_capacity 每个分片队列的容量
+     * @param policy 队列满时的处理策略
+     * @param ordered 为true时按日志时间合并各分片
+     * @param reorder_window 重排窗口，微秒
+     */
+    ShardedLogAppender(LogAppender::ptr sink, size_t shard_capacity = 4096
+                      ,OverflowPolicy policy = BLOCK, bool ordered = false
+                      ,uint32_t reorder_window = 2000);
+    ~ShardedLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 等待调用前入队的记录全部写入下游，并刷新下游
+     * @details ordered模式下重排窗口内的记录也立即写出
+     */
+    void flush() override;
+    /**
+     * @brief 写完各分片中的记录后调用下游的on_exit
+     */
+    void on_exit() override;
+    /**
+     * @brief 先写出下游的缓冲，再依次把批量缓冲、重排窗口和各分片中的记录交给下游的crash_write
+     * @details 重排窗口中的记录不再按时间排序
+     */
+    void crash_flush() override;
+    void crash_write(const char* data, size_t len) override;
+    /**
+     * @brief 写完剩余记录后停止后台线程
+     */
+    void stop();
+
+    /**
+     * @brief 丢弃的记录数
+     */
+    uint64_t get_dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    /**
+     * @brief 当前的分片数
+     */
+    size_t get_shard_count();
+    LogAppender::ptr get_sink() const { return m_sink; }
+    bool is_ordered() const { return m_ordered; }
+
+public:
+    struct Shard;
+
+private:
+    /**
+     * @brief 重排窗口中等待写出的记录
+     */
+    struct Pending {
+        uint64_t time;
+        //到达顺序，时间相同时保持先后
+        uint64_t seq;
+        std::string text;
+    };
+
+    Shard* get_shard();
+    template<class F>
+    void push(Shard* shard, uint64_t time, F&& f);
+    void run();
+    /**
+     * @brief 轮询所有分片，返回取出的记录数
+     * @param all 为true时取空各分片并写出全部重排记录
+     */
+    size_t drain(bool all);
+    /**
+     * @brief 写出重排窗口中已到期的记录
+     */
+    void emit_pending(uint64_t now, bool all);
+    void write_batch();
+    /**
+     * @brief 停止后由所属线程取出分片中剩余的记录直接写入下游并刷新
+     * @details 等stop的最后一次drain结束后调用，此时所属线程是分片唯一的消费者
+     */
+    void drain_shard_direct(Shard* shard);
+    void wake_consumer();
+
+private:
+    LogAppender::ptr m_sink;
+    size_t m_shard_capacity;
+    OverflowPolicy m_policy;
+    bool m_ordered;
+    uint32_t m_reorder_window;
+    //用于区分线程局部分片属于哪个Appender
+    uint64_t m_id;
+
+    //所有分片，后台线程在版本变化时复制一份
+    std::mutex m_shards_mutex;
+    std::vector<std::shared_ptr<Shard>> m_shards;
+    std::atomic<uint64_t> m_shards_version{0};
+
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_stopping{false};
+    //stop已取完所有分片
+    std::atomic<bool> m_drained{false};
+    //后台线程是否在等待
+    std::atomic<bool> m_sleeping{false};
+    //等待中的生产者/flush调用数
+    std::atomic<int> m_waiters{0};
+    //flush请求序号和后台线程已完成的序号
+    std::atomic<uint64_t> m_flush_req{0};
+    std::atomic<uint64_t> m_flush_done{0};
+
+    std::mutex m_wait_mutex;
+    std::condition_variable m_consumer_cond;
+    std::condition_variable m_producer_cond;
+    std::thread m_thread;
+
+    //以下只由后台线程访问
+    std::vector<std::shared_ptr<Shard>> m_local_shards;
+    uint64_t m_local_version = 0;
+    //按时间排列的小根堆
+    std::vector<Pending> m_pending;
+    uint64_t m_pending_seq = 0;
+    //写出后回收的字符串，和分片槽位交换以复用内存
+    std::vector<std::string> m_free_texts;
+    //批量写缓冲
+    std::string m_batch;
+};
+
+}
+
+#endif // !__SHARDED_APPENDER_H__
@@ -1,6 +1,104 @@
 #ifndef __SINGLETON_H__
 #define __SINGLETON_H__
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 
+namespace lckl {
 
-#endif // !__SINGLETON_H__
\ No newline at end of file
+/**
+ * @brief 单例模式封装类
+ * @details 第一次调用时创建实例，并发的首次调用由call_once保证只创建一个，
+ *          其余调用者等待创建完成。创建后每次调用只有一次acquire读(x86上是普通读)，
+ *          没有原子读改写，也没有函数内静态变量的初始化检查。
+ *          实例不析构，静态对象析构阶段和晚于main退出的线程依然可以使用。
+ *          T的构造函数中不能再调用同一个单例的get_instance
+ *
+ * @tparam T 类型
+ * @tparam X 为了创造多个实例对应的Tag
+ * @tparam N 同一个Tag创造多个实例索引
+ */
+template<class T, class X = void, int N = 0>
+class Singleton {
+public:
+    /**
+     * @brief 返回单例裸指针
+     */
+    static T* get_instance() {
+        T* p = s_instance.load(std::memory_order_acquire);
+        return p ? p : create();
+    }
+
+    /**
+     * @brief 返回单例裸指针，指针缓存在线程局部变量中
+     * @details 适合每条日志都要访问的路径，命中时不读共享的缓存行
+     */
+    static T* get_thread_cached() {
+        static thread_local T* t_instance = nullptr;
+        if (!t_instance) {
+            t_instance = get_instance();
+        }
+        return t_instance;
+    }
+
+private:
+    static T* create() {
+        std::call_once(s_flag, []() {
+            s_instance.store(new T, std::memory_order_release);
+        });
+        return s_instance.load(std::memory_order_relaxed);
+    }
+
+private:
+    static inline std::atomic<T*> s_instance{nullptr};
+    static inline std::once_flag s_flag;
+};
+
+/**
+ * @brief 单例模式智能指针封装类
+ * @details 初始化和访问开销同Singleton，返回的引用一直有效，
+ *          实例同样不随静态对象析构，调用方复制的shared_ptr可以延长其生命周期
+ *
+ * @tparam T 类型
+ * @tparam X 为了创造多个实例对应的Tag
+ * @tparam N 同一个Tag创造多个实例索引
+ */
+template<class T, class X = void, int N = 0>
+class SingletonPtr {
+public:
+    /**
+     * @brief 返回单例智能指针
+     */
+    static const std::shared_ptr<T>& get_instance() {
+        std::shared_ptr<T>* p = s_instance.load(std::memory_order_acquire);
+        return p ? *p : create();
+    }
+
+    /**
+     * @brief 返回单例智能指针，缓存在线程局部变量中
+     */
+    static const std::shared_ptr<T>& get_thread_cached() {
+        static thread_local const std::shared_ptr<T>* t_instance = nullptr;
+        if (!t_instance) {
+            t_instance = &get_instance();
+        }
+        return *t_instance;
+    }
+
+private:
+    static const std::shared_ptr<T>& create() {
+        std::call_once(s_flag, []() {
+            s_instance.store(new std::shared_ptr<T>(new T), std::memory_order_release);
+        });
+        return *s_instance.load(std::memory_order_relaxed);
+    }
+
+private:
+    static inline std::atomic<std::shared_ptr<T>*> s_instance{nullptr};
+    static inline std::once_flag s_flag;
+};
+
+}
+
+#endif // !__SINGLETON_H__
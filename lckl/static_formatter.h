@@ -0,0 +1,303 @@
+#ifndef __STATIC_FORMATTER_H__
+#define __STATIC_FORMATTER_H__
+
+#include "log.h"
+#include <array>
+#include <ostream>
+#include <utility>
+
+namespace lckl {
+
+/**
+ * @brief 默认日志模板，可直接作为StaticLogFormatter的模板参数
+ */
+inline constexpr char DEFAULT_LOG_PATTERN[] = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+
+namespace detail {
+
+/**
+ * @brief 编译期解析出的模板项
+ */
+struct StaticToken {
+    enum Type {
+        STRING = 0,     //字面量
+        MESSAGE,        //%m
+        LEVEL,          //%p
+        ELAPSE,         //%r
+        NAME,           //%c
+        THREADID,       //%t
+        NEWLINE,        //%n
+        DATE,           //%d
+        FILENAME,       //%f
+        LINE,           //%l
+        TAB,            //%T
+        FIBERID,        //%F
+        THREADNAME,     //%N
+        TRACEID,        //%I
+        ERROR_FORMAT,   //未知的%xxx
+        ERROR_PATTERN   //{未闭合
+    };
+    Type type;
+    //字面量在模板中的起止
+    size_t begin;
+    size_t len;
+    //{}内参数在模板中的起止
+    size_t fmt_begin;
+    size_t fmt_len;
+    //下一个模板项的位置
+    size_t next;
+};
+
+constexpr bool static_is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr size_t static_strlen(const char* p) {
+    size_t n = 0;
+    while (p[n]) {
+        ++n;
+    }
+    return n;
+}
+
+constexpr StaticToken::Type static_item_type(const char* p, size_t begin, size_t len) {
+    if (len != 1) {
+        return StaticToken::ERROR_FORMAT;
+    }
+    switch (p[begin]) {
+#define XX(c, T) \
+    case c: \
+        return StaticToken::T;
+    XX('m', MESSAGE);
+    XX('p', LEVEL);
+    XX('r', ELAPSE);
+    XX('c', NAME);
+    XX('t', THREADID);
+    XX('n', NEWLINE);
+    XX('d', DATE);
+    XX('f', FILENAME);
+    XX('l', LINE);
+    XX('T', TAB);
+    XX('F', FIBERID);
+    XX('N', THREADNAME);
+    XX('I', TRACEID);
+#undef XX
+    default:
+        return StaticToken::ERROR_FORMAT;
+    }
+}
+
+/**
+ * @brief 从pos开始解析一个模板项，语法与LogFormatter::init()一致
+ *        %xxx %xxx{xxx} %%
+ */
+constexpr StaticToken static_next_token(const char* p, size_t pos) {
+    size_t size = static_strlen(p);
+    //%%转义为%
+    if (p[pos] == '%' && pos + 1 < size && p[pos + 1] == '%') {
+        return StaticToken{StaticToken::STRING, pos, 1, 0, 0, pos + 2};
+    }
+    //普通文本
+    if (p[pos] != '%') {
+        size_t n = pos;
+        while (n < size && p[n] != '%') {
+            ++n;
+        }
+        return StaticToken{StaticToken::STRING, pos, n - pos, 0, 0, n};
+    }
+    size_t n = pos + 1;
+    while (n < size && static_is_alpha(p[n])) {
+        ++n;
+    }
+    StaticToken::Type type = static_item_type(p, pos + 1, n - pos - 1);
+    if (n < size && p[n] == '{') {
+        size_t fmt_begin = n + 1;
+        size_t m = fmt_begin;
+        while (m < size && p[m] != '}') {
+            ++m;
+        }
+        if (m == size) {
+            return StaticToken{StaticToken::ERROR_PATTERN, pos, 0, fmt_begin, m - fmt_begin, m};
+        }
+        return StaticToken{type, pos + 1, n - pos - 1, fmt_begin, m - fmt_begin, m + 1};
+    }
+    return StaticToken{type, pos + 1, n - pos - 1, 0, 0, n};
+}
+
+/**
+ * @brief 模板项个数
+ */
+constexpr size_t static_token_count(const char* p) {
+    size_t size = static_strlen(p);
+    size_t count = 0;
+    for (size_t pos = 0; pos < size; pos = static_next_token(p, pos).next) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * @brief 第idx个模板项
+ */
+constexpr StaticToken static_token_at(const char* p, size_t idx) {
+    size_t pos = 0;
+    for (size_t i = 0; i < idx; ++i) {
+        pos = static_next_token(p, pos).next;
+    }
+    return static_next_token(p, pos);
+}
+
+/**
+ * @brief 模板中是否存在指定类型的模板项
+ */
+constexpr bool static_has_token(const char* p, StaticToken::Type type) {
+    size_t size = static_strlen(p);
+    for (size_t pos = 0; pos < size; pos = static_next_token(p, pos).next) {
+        if (static_next_token(p, pos).type == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 拷贝%d{}参数为以'\0'结尾的数组，为空时使用默认时间格式
+ */
+template<size_t N>
+constexpr std::array<char, N + 1> static_date_format(const char* p, size_t begin, size_t len) {
+    std::array<char, N + 1> buf{};
+    if (len == 0) {
+        const char* def = "%Y-%m-%d %H:%M:%S";
+        for (size_t i = 0; i < N; ++i) {
+            buf[i] = def[i];
+        }
+    } else {
+        for (size_t i = 0; i < N; ++i) {
+            buf[i] = p[begin + i];
+        }
+    }
+    return buf;
+}
+
+} // namespace detail
+
+/**
+ * @brief 编译期日志格式化器
+ * @details 模板在编译期按LogFormatter相同的语法解析，每个模板项展开为
+ *          内联代码，没有解析和分派开销。模板错误直接导致编译失败。
+ *          模板必须是具有链接性的字符数组，例如：
+ *          static constexpr char pattern[] = "%d%T%m%n";
+ *          StaticLogFormatter<pattern> fmt;
+ *          来自配置的模板请继续使用LogFormatter
+ * @tparam Pattern 模板格式
+ */
+template<const char* Pattern>
+class StaticLogFormatter {
+public:
+    static_assert(!detail::static_has_token(Pattern, detail::StaticToken::ERROR_PATTERN)
+                  ,"StaticLogFormatter: unterminated '{' in log pattern");
+    static_assert(!detail::static_has_token(Pattern, detail::StaticToken::ERROR_FORMAT)
+                  ,"StaticLogFormatter: unknown %x item in log pattern");
+
+    /**
+     * @brief 返回日志模板
+     */
+    static constexpr const char* get_pattern() { return Pattern; }
+
+    /**
+     * @brief 返回格式化日志文本
+     */
+    std::string format(const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event) const {
+        std::string str;
+        format(str, logger, level, event);
+        return str;
+    }
+
+    std::ostream& format(std::ostream& os, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event) const {
+        detail::OstreamSink sink{os};
+        format_items(sink, level, event
+                    ,std::make_index_sequence<detail::static_token_count(Pattern)>());
+        return os;
+    }
+
+    /**
+     * @brief 格式化日志追加到out末尾
+     * @return 写入的字节数
+     */
+    size_t format(std::string& out, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event) const {
+        size_t begin = out.size();
+        detail::StringSink sink{out};
+        format_items(sink, level, event
+                    ,std::make_index_sequence<detail::static_token_count(Pattern)>());
+        return out.size() - begin;
+    }
+
+    /**
+     * @brief 格式化日志写入定长缓冲区
+     * @return 日志的完整长度，大于size时缓冲区只写入了前size字节
+     */
+    size_t format(char* buf, size_t size, const std::shared_ptr<Logger>& logger
+                ,LogLevel::Level level, const LogEvent& event) const {
+        detail::SpanSink sink{buf, size, 0};
+        format_items(sink, level, event
+                    ,std::make_index_sequence<detail::static_token_count(Pattern)>());
+        return sink.len;
+    }
+
+private:
+    template<class Sink, size_t... I>
+    static void format_items(Sink& sink, LogLevel::Level level, const LogEvent& event
+                            ,std::index_sequence<I...>) {
+        (format_item<I>(sink, level, event), ...);
+    }
+
+    template<size_t I, class Sink>
+    static void format_item(Sink& sink, LogLevel::Level level, const LogEvent& event) {
+        constexpr detail::StaticToken tok = detail::static_token_at(Pattern, I);
+        if constexpr (tok.type == detail::StaticToken::STRING) {
+            sink.append(Pattern + tok.begin, tok.len);
+        } else if constexpr (tok.type == detail::StaticToken::MESSAGE) {
+            std::string_view content = event.get_content_view();
+            sink.append(content.data(), content.size());
+        } else if constexpr (tok.type == detail::StaticToken::LEVEL) {
+            detail::sink_cstr(sink, LogLevel::to_string(level));
+        } else if constexpr (tok.type == detail::StaticToken::ELAPSE) {
+            detail::sink_int(sink, event.get_elapse());
+        } else if constexpr (tok.type == detail::StaticToken::NAME) {
+            const std::string& name = event.get_logger()->get_name();
+            sink.append(name.data(), name.size());
+        } else if constexpr (tok.type == detail::StaticToken::THREADID) {
+            detail::sink_cached_id(sink, number_format::THREAD_ID, event.get_threadid());
+        } else if constexpr (tok.type == detail::StaticToken::NEWLINE) {
+            sink.append("\n", 1);
+        } else if constexpr (tok.type == detail::StaticToken::DATE) {
+            constexpr size_t n = tok.fmt_len ? tok.fmt_len : detail::static_strlen("%Y-%m-%d %H:%M:%S");
+            static constexpr std::array<char, n + 1> fmt
+                    = detail::static_date_format<n>(Pattern, tok.fmt_begin, tok.fmt_len);
+            size_t len;
+            const char* str = LogDateCache::format(fmt.data(), event.get_time(), event.get_usec(), len);
+            sink.append(str, len);
+        } else if constexpr (tok.type == detail::StaticToken::FILENAME) {
+            detail::sink_cstr(sink, event.get_file());
+        } else if constexpr (tok.type == detail::StaticToken::LINE) {
+            detail::sink_int(sink, event.get_line());
+        } else if constexpr (tok.type == detail::StaticToken::TAB) {
+            sink.append("\t", 1);
+        } else if constexpr (tok.type == detail::StaticToken::FIBERID) {
+            detail::sink_cached_id(sink, number_format::FIBER_ID, event.get_fiberid());
+        } else if constexpr (tok.type == detail::StaticToken::THREADNAME) {
+            const std::string& name = event.get_threadname();
+            sink.append(name.data(), name.size());
+        } else if constexpr (tok.type == detail::StaticToken::TRACEID) {
+            std::string_view id = event.get_trace_id();
+            sink.append(id.data(), id.size());
+        }
+    }
+};
+
+}
+
+#endif // !__STATIC_FORMATTER_H__
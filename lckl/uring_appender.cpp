@@ -0,0 +1,587 @@
+#include "uring_appender.h"
+#include "util.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <new>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace lckl {
+
+//写线程调用on_tick的周期，毫秒
+static const int s_tick_interval = 50;
+//O_DIRECT要求的对齐
+static const size_t s_align = 4096;
+//每个文件最多的缓冲区数，都在写入时等待
+static const size_t s_max_buffers = 4;
+
+namespace {
+
+size_t align_up(size_t n) {
+    return (n + s_align - 1) & ~(s_align - 1);
+}
+
+}
+
+IoUringWriter::IoUringWriter(bool use_uring, uint32_t entries) {
+    m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (use_uring && !setup_ring(entries)) {
+        close_ring();
+    }
+    m_thread = std::thread(&IoUringWriter::run, this);
+}
+
+IoUringWriter::~IoUringWriter() {
+    m_stopping.store(true, std::memory_order_release);
+    wake();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    close_ring();
+    if (m_event_fd != -1) {
+        close(m_event_fd);
+    }
+}
+
+bool IoUringWriter::setup_ring(uint32_t entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return false;
+    }
+    m_ring_fd = fd;
+    m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        m_sq_len = m_cq_len = std::max(m_sq_len, m_cq_len);
+    }
+    void* sq = mmap(nullptr, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                   ,fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        return false;
+    }
+    m_sq_ptr = sq;
+    void* cq = sq;
+    if (!single) {
+        cq = mmap(nullptr, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                 ,fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            return false;
+        }
+        m_cq_ptr = cq;
+    }
+    m_sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                     ,fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        m_sqes_len = 0;
+        return false;
+    }
+    m_sqes = (struct io_uring_sqe*)sqes;
+
+    char* sp = (char*)sq;
+    m_sq_head = (unsigned*)(sp + p.sq_off.head);
+    m_sq_tail = (unsigned*)(sp + p.sq_off.tail);
+    m_sq_mask = *(unsigned*)(sp + p.sq_off.ring_mask);
+    m_sq_entries = *(unsigned*)(sp + p.sq_off.ring_entries);
+    m_sq_array = (unsigned*)(sp + p.sq_off.array);
+    char* cp = (char*)cq;
+    m_cq_head = (unsigned*)(cp + p.cq_off.head);
+    m_cq_tail = (unsigned*)(cp + p.cq_off.tail);
+    m_cq_mask = *(unsigned*)(cp + p.cq_off.ring_mask);
+    m_cq_entries = *(unsigned*)(cp + p.cq_off.ring_entries);
+    m_cqes = (struct io_uring_cqe*)(cp + p.cq_off.cqes);
+
+    //完成事件写eventfd唤醒写线程
+    return m_event_fd != -1
+        && syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &m_event_fd, 1) == 0;
+}
+
+void IoUringWriter::close_ring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqes_len);
+        m_sqes = nullptr;
+    }
+    if (m_cq_ptr) {
+        munmap(m_cq_ptr, m_cq_len);
+        m_cq_ptr = nullptr;
+    }
+    if (m_sq_ptr) {
+        munmap(m_sq_ptr, m_sq_len);
+        m_sq_ptr = nullptr;
+    }
+    if (m_ring_fd != -1) {
+        close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+}
+
+void IoUringWriter::submit(IoClient* client, IoRequest* req) {
+    req->client = client;
+    req->done = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        m_queue.push_back(req);
+    }
+    wake();
+}
+
+void IoUringWriter::add_client(IoClient* client) {
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    m_clients.push_back(client);
+}
+
+void IoUringWriter::del_client(IoClient* client) {
+    std::lock_guard<std::mutex> lock(m_clients_mutex);
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+}
+
+void IoUringWriter::wake() {
+    uint64_t one = 1;
+    ssize_t rt = ::write(m_event_fd, &one, sizeof(one));
+    (void)rt;
+}
+
+size_t IoUringWriter::submit_ring(const std::vector<IoRequest*>& reqs) {
+    unsigned tail = *m_sq_tail;
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    //在途请求不超过完成队列长度，避免完成事件溢出
+    while (n < reqs.size() && tail - head < m_sq_entries && m_inflight < m_cq_entries) {
+        IoRequest* r = reqs[n];
+        unsigned idx = tail & m_sq_mask;
+        struct io_uring_sqe* sqe = &m_sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = r->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&r->iov;
+        sqe->len = 1;
+        sqe->off = r->offset < 0 ? (uint64_t)-1 : (uint64_t)(r->offset + r->done);
+        sqe->user_data = (uint64_t)(uintptr_t)r;
+        m_sq_array[idx] = idx;
+        ++tail;
+        ++n;
+        ++m_inflight;
+    }
+    if (n) {
+        __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+        m_to_submit += n;
+    }
+    if (m_to_submit) {
+        int rt = syscall(__NR_io_uring_enter, m_ring_fd, m_to_submit, 0, 0, nullptr, 0);
+        m_syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (rt > 0) {
+            m_to_submit -= rt;
+        }
+    }
+    return n;
+}
+
+void IoUringWriter::reap_ring() {
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &m_cqes[head & m_cq_mask];
+        IoRequest* r = (IoRequest*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        ++head;
+        --m_inflight;
+        complete(r, res);
+    }
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+}
+
+void IoUringWriter::complete(IoRequest* req, ssize_t res) {
+    if (res == -EINTR || res == -EAGAIN) {
+        m_pending.push_back(req);
+        return;
+    }
+    if (res < 0) {
+        req->client->on_complete(req, res);
+        return;
+    }
+    req->done += res;
+    if ((size_t)res < req->iov.iov_len) {
+        if (res == 0) {
+            req->client->on_complete(req, -EIO);
+            return;
+        }
+        //部分写入，续写剩余部分
+        req->iov.iov_base = (char*)req->iov.iov_base + res;
+        req->iov.iov_len -= res;
+        m_pending.push_back(req);
+        return;
+    }
+    req->client->on_complete(req, req->done);
+}
+
+void IoUringWriter::write_fallback(const std::vector<IoRequest*>& reqs) {
+    size_t i = 0;
+    while (i < reqs.size()) {
+        //同一文件偏移连续的请求合并为一次pwritev
+        struct iovec iov[IOV_MAX];
+        IoRequest* first = reqs[i];
+        int64_t offset = first->offset < 0 ? -1 : first->offset + first->done;
+        int64_t next = offset;
+        size_t j = i;
+        int n = 0;
+        for (; j < reqs.size() && n < IOV_MAX; ++j, ++n) {
+            IoRequest* r = reqs[j];
+            int64_t off = r->offset < 0 ? -1 : r->offset + r->done;
+            if (r->fd != first->fd || off != next) {
+                break;
+            }
+            iov[n] = r->iov;
+            if (next >= 0) {
+                next += r->iov.iov_len;
+            }
+        }
+        ssize_t rt = offset < 0 ? writev(first->fd, iov, n) : pwritev(first->fd, iov, n, offset);
+        m_syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (rt < 0) {
+            rt = -errno;
+            for (size_t k = i; k < j; ++k) {
+                complete(reqs[k], rt);
+            }
+        } else {
+            for (size_t k = i; k < j; ++k) {
+                size_t take = std::min((size_t)rt, reqs[k]->iov.iov_len);
+                rt -= take;
+                if (take == 0 && k != i) {
+                    m_pending.push_back(reqs[k]);
+                } else {
+                    complete(reqs[k], take);
+                }
+            }
+        }
+        i = j;
+    }
+}
+
+void IoUringWriter::run() {
+    std::vector<IoRequest*> reqs;
+    uint32_t last_tick = get_elapse_ms();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_pending.insert(m_pending.end(), m_queue.begin(), m_queue.end());
+            m_queue.clear();
+        }
+        if (is_uring()) {
+            reap_ring();
+            size_t n = submit_ring(m_pending);
+            m_pending.erase(m_pending.begin(), m_pending.begin() + n);
+        } else if (!m_pending.empty()) {
+            reqs.swap(m_pending);
+            write_fallback(reqs);
+            reqs.clear();
+        }
+
+        uint32_t now = get_elapse_ms();
+        if (now - last_tick >= (uint32_t)s_tick_interval) {
+            last_tick = now;
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            for (auto c : m_clients) {
+                c->on_tick();
+            }
+        }
+
+        bool idle = m_inflight == 0 && m_pending.empty();
+        if (idle && m_stopping.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            if (m_queue.empty()) {
+                break;
+            }
+        }
+        //有请求在途时等完成事件，只剩重试的请求时稍后再试
+        struct pollfd pfd = {m_event_fd, POLLIN, 0};
+        int timeout = (!m_pending.empty() && m_inflight == 0 && !m_to_submit) ? 1 : s_tick_interval;
+        if (poll(&pfd, 1, timeout) > 0) {
+            uint64_t v;
+            ssize_t rt = ::read(m_event_fd, &v, sizeof(v));
+            (void)rt;
+        }
+    }
+}
+
+UringFileLogAppender::UringFileLogAppender(const std::string& filename, size_t buffer_size
+                                          ,bool direct, uint32_t flush_interval
+                                          ,IoUringWriter* writer)
+    :m_filename(filename)
+    ,m_buffer_size(align_up(std::max(buffer_size, s_align)))
+    ,m_direct(direct)
+    ,m_flush_interval(flush_interval)
+    ,m_writer(writer ? writer : Singleton<IoUringWriter>::get_instance()) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current = new_buffer(m_buffer_size);
+        ++m_buffer_count;
+        open_file();
+        m_last_submit = get_elapse_ms();
+    }
+    m_writer->add_client(this);
+}
+
+UringFileLogAppender::~UringFileLogAppender() {
+    m_writer->del_client(this);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    submit_current(lock);
+    wait_idle(lock);
+    if (m_fd != -1) {
+        if (m_direct) {
+            int rt = ftruncate(m_fd, m_file_size);
+            (void)rt;
+        }
+        close(m_fd);
+    }
+    free_buffer(m_current);
+    for (auto b : m_free) {
+        free_buffer(b);
+    }
+}
+
+UringFileLogAppender::Buffer* UringFileLogAppender::new_buffer(size_t capacity) {
+    void* p = nullptr;
+    capacity = align_up(capacity);
+    if (posix_memalign(&p, s_align, capacity)) {
+        throw std::bad_alloc();
+    }
+    Buffer* b = new Buffer;
+    b->data = (char*)p;
+    b->capacity = capacity;
+    return b;
+}
+
+void UringFileLogAppender::free_buffer(Buffer* b) {
+    free(b->data);
+    delete b;
+}
+
+bool UringFileLogAppender::open_file() {
+    int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+    m_fd = -1;
+    if (m_direct) {
+        m_fd = open(m_filename.c_str(), flags | O_DIRECT, 0644);
+        if (m_fd == -1) {
+            m_direct = false;
+        }
+    }
+    if (m_fd == -1) {
+        m_fd = open(m_filename.c_str(), flags, 0644);
+    }
+    m_current->size = m_current->carry = 0;
+    if (m_fd == -1) {
+        return false;
+    }
+    struct stat st;
+    m_file_size = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    m_offset = m_file_size;
+    if (m_direct) {
+        //文件末尾不满一块时读出来，下次连同新日志一起写
+        size_t carry = m_file_size % s_align;
+        if (carry) {
+            uint64_t offset = m_file_size - carry;
+            if (pread(m_fd, m_current->data, s_align, offset) == (ssize_t)carry) {
+                m_offset = offset;
+                m_current->size = m_current->carry = carry;
+            } else {
+                fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+                m_direct = false;
+            }
+        }
+    }
+    return true;
+}
+
+char* UringFileLogAppender::reserve(size_t len, std::unique_lock<std::mutex>& lock) {
+    while (m_current->capacity - m_current->size < len) {
+        if (!rotate(lock, true, len)) {
+            return nullptr;
+        }
+    }
+    return m_current->data + m_current->size;
+}
+
+bool UringFileLogAppender::rotate(std::unique_lock<std::mutex>& lock, bool wait, size_t min_capacity) {
+    Buffer* b = m_current;
+    Buffer* next = nullptr;
+    if (min_capacity + s_align > m_buffer_size) {
+        //超长日志，容量在确定要复制的数据后再申请
+    } else if (!m_free.empty()) {
+        next = m_free.back();
+        m_free.pop_back();
+    } else if (m_buffer_count < s_max_buffers) {
+        next = new_buffer(m_buffer_size);
+        ++m_buffer_count;
+    } else {
+        if (!wait) {
+            return false;
+        }
+        //等待期间其他线程可能已经换过缓冲区，由调用方重新检查
+        m_cond.wait(lock);
+        return true;
+    }
+
+    size_t carry = m_direct ? b->size % s_align : 0;
+    if (!next) {
+        next = new_buffer(carry + min_capacity);
+        next->temporary = true;
+    }
+    memcpy(next->data, b->data + b->size - carry, carry);
+    next->size = next->carry = carry;
+
+    if (b->size > b->carry) {
+        size_t len = b->size;
+        if (m_direct) {
+            len = align_up(len);
+            memset(b->data + b->size, 0, len - b->size);
+        }
+        b->fd = m_fd;
+        b->offset = m_offset;
+        b->iov.iov_base = b->data;
+        b->iov.iov_len = len;
+        m_file_size = m_offset + b->size;
+        m_offset += b->size - carry;
+        //direct模式下相邻请求会重写同一块，必须按顺序完成
+        if (m_direct && m_inflight) {
+            m_queue.push_back(b);
+        } else {
+            start(b);
+        }
+    } else if (b->temporary) {
+        free_buffer(b);
+    } else {
+        m_free.push_back(b);
+    }
+    m_current = next;
+    m_last_submit = get_elapse_ms();
+    return true;
+}
+
+void UringFileLogAppender::submit_current(std::unique_lock<std::mutex>& lock) {
+    while (m_current->size > m_current->carry) {
+        Buffer* b = m_current;
+        rotate(lock, true);
+        if (m_current != b) {
+            break;
+        }
+    }
+}
+
+void UringFileLogAppender::start(Buffer* b) {
+    ++m_inflight;
+    m_writer->submit(this, b);
+}
+
+void UringFileLogAppender::wait_idle(std::unique_lock<std::mutex>& lock) {
+    while (m_inflight || !m_queue.empty()) {
+        m_cond.wait(lock);
+    }
+}
+
+void UringFileLogAppender::on_complete(IoRequest* req, ssize_t res) {
+    Buffer* b = static_cast<Buffer*>(req);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_inflight;
+    if (res < 0) {
+        m_errors.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        m_written.fetch_add(res, std::memory_order_relaxed);
+    }
+    if (b->temporary) {
+        free_buffer(b);
+    } else {
+        m_free.push_back(b);
+    }
+    if (!m_queue.empty() && m_inflight == 0) {
+        Buffer* n = m_queue.front();
+        m_queue.pop_front();
+        start(n);
+    }
+    m_cond.notify_all();
+}
+
+void UringFileLogAppender::on_tick() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd != -1 && m_current->size > m_current->carry
+            && get_elapse_ms() - m_last_submit >= m_flush_interval) {
+        rotate(lock, false);
+    }
+}
+
+void UringFileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level < m_level) {
+        return;
+    }
+    LogFormatter::ptr formatter = get_formatter();
+    if (!formatter) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd == -1) {
+        return;
+    }
+    Buffer* b = m_current;
+    size_t len = formatter->format(b->data + b->size, b->capacity - b->size, logger, level, *event);
+    if (b->size + len <= b->capacity) {
+        b->size += len;
+        return;
+    }
+    //放不下，整条日志重新格式化到新缓冲区
+    char* p = reserve(len, lock);
+    if (!p) {
+        return;
+    }
+    m_current->size += std::min(formatter->format(p, len, logger, level, *event), len);
+}
+
+void UringFileLogAppender::write(const char* data, size_t len) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd == -1) {
+        return;
+    }
+    char* p = reserve(len, lock);
+    if (!p) {
+        return;
+    }
+    memcpy(p, data, len);
+    m_current->size += len;
+}
+
+void UringFileLogAppender::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    submit_current(lock);
+    wait_idle(lock);
+    //direct模式下最后一块补了0，截断到实际长度
+    if (m_direct && m_fd != -1) {
+        int rt = ftruncate(m_fd, m_file_size);
+        (void)rt;
+    }
+}
+
+bool UringFileLogAppender::reopen() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    submit_current(lock);
+    wait_idle(lock);
+    if (m_fd != -1) {
+        if (m_direct) {
+            int rt = ftruncate(m_fd, m_file_size);
+            (void)rt;
+        }
+        close(m_fd);
+    }
+    return open_file();
+}
+
+}
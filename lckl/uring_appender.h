@@ -0,0 +1,264 @@
+#ifndef __URING_APPENDER_H__
+#define __URING_APPENDER_H__
+
+#include "log.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace lckl {
+
+class IoUringWriter;
+class IoClient;
+
+/**
+ * @brief 提交给IoUringWriter的一次写请求
+ * @details 请求在完成回调之前必须保持有效，部分写入由IoUringWriter自动续写
+ */
+struct IoRequest {
+    //发起请求的调用方，由submit设置
+    IoClient* client = nullptr;
+    int fd = -1;
+    //文件偏移，-1表示使用文件当前位置(socket、管道)
+    int64_t offset = -1;
+    //写线程续写时会修改iov
+    struct iovec iov;
+    //已写入的字节数
+    size_t done = 0;
+};
+
+/**
+ * @brief IoUringWriter的调用方
+ */
+class IoClient {
+public:
+    virtual ~IoClient() {}
+    /**
+     * @brief 请求完成，在写线程中调用
+     * @param res 写入的总字节数，失败时为-errno
+     */
+    virtual void on_complete(IoRequest* req, ssize_t res) = 0;
+    /**
+     * @brief 写线程按周期调用，用于提交未写满的缓冲区
+     */
+    virtual void on_tick() {}
+};
+
+/**
+ * @brief 批量写线程
+ * @details 一个后台线程为多个Appender提交写请求：请求先放入队列，
+ *          由写线程一次io_uring_enter提交一批，完成事件通过eventfd唤醒写线程后收割。
+ *          直接使用io_uring系统调用，不依赖liburing；
+ *          内核不支持或被禁用时退回到pwritev，同一文件偏移连续的请求合并为一次调用
+ */
+class IoUringWriter {
+public:
+    /**
+     * @brief Construct a new Io Uring Writer object
+     *
+     * @param use_uring 为false时直接使用pwritev
+     * @param entries 提交队列长度
+     */
+    IoUringWriter(bool use_uring = true, uint32_t entries = 256);
+    ~IoUringWriter();
+
+    /**
+     * @brief 提交写请求，完成后调用client->on_complete
+     */
+    void submit(IoClient* client, IoRequest* req);
+    /**
+     * @brief 注册周期回调
+     */
+    void add_client(IoClient* client);
+    /**
+     * @brief 取消周期回调，返回后不会再调用client->on_tick
+     */
+    void del_client(IoClient* client);
+
+    /**
+     * @brief 是否在使用io_uring
+     */
+    bool is_uring() const { return m_ring_fd != -1; }
+    /**
+     * @brief io_uring_enter/pwritev系统调用次数
+     */
+    uint64_t get_syscall_count() const { return m_syscalls.load(std::memory_order_relaxed); }
+
+private:
+    bool setup_ring(uint32_t entries);
+    void close_ring();
+    /**
+     * @brief 把请求放入提交队列，返回放入的数量
+     */
+    size_t submit_ring(const std::vector<IoRequest*>& reqs);
+    void reap_ring();
+    void write_fallback(const std::vector<IoRequest*>& reqs);
+    /**
+     * @brief 处理一次写入结果，未写完时重新放入队列
+     */
+    void complete(IoRequest* req, ssize_t res);
+    void wake();
+    void run();
+
+private:
+    //io_uring
+    int m_ring_fd = -1;
+    unsigned* m_sq_head = nullptr;
+    unsigned* m_sq_tail = nullptr;
+    unsigned* m_sq_array = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned m_sq_entries = 0;
+    struct io_uring_sqe* m_sqes = nullptr;
+    unsigned* m_cq_head = nullptr;
+    unsigned* m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    unsigned m_cq_entries = 0;
+    struct io_uring_cqe* m_cqes = nullptr;
+    void* m_sq_ptr = nullptr;
+    size_t m_sq_len = 0;
+    void* m_cq_ptr = nullptr;
+    size_t m_cq_len = 0;
+    size_t m_sqes_len = 0;
+    //已提交未完成的请求数
+    size_t m_inflight = 0;
+    //已放入提交队列但io_uring_enter还未接收的数量
+    unsigned m_to_submit = 0;
+
+    //新请求和io_uring完成事件共用的唤醒描述符
+    int m_event_fd = -1;
+    std::mutex m_queue_mutex;
+    std::vector<IoRequest*> m_queue;
+    //写线程内部等待提交的请求
+    std::vector<IoRequest*> m_pending;
+
+    std::mutex m_clients_mutex;
+    std::vector<IoClient*> m_clients;
+
+    std::atomic<bool> m_stopping{false};
+    std::thread m_thread;
+    std::atomic<uint64_t> m_syscalls{0};
+};
+
+/**
+ * @brief 通过IoUringWriter写入的文件Appender
+ * @details 日志格式化到当前缓冲区，写满或到达刷新周期时整块交给写线程，
+ *          缓冲区按4KB对齐，多个文件共用一个写线程。
+ *          direct模式下用O_DIRECT打开文件，写入长度补齐到4KB，
+ *          末尾不满一块的数据复制到下一个缓冲区，下次连同新日志覆盖写入，
+ *          同一文件同时只有一个写请求；flush后把文件截断到实际长度。
+ *          文件系统不支持O_DIRECT时按普通模式打开
+ */
+class UringFileLogAppender : public LogAppender, public IoClient {
+public:
+    typedef std::shared_ptr<UringFileLogAppender> ptr;
+
+    /**
+     * @brief Construct a new Uring File Log Appender object
+     *
+     * @param filename 文件路径
+     * @param buffer_size 每个缓冲区大小
+     * @param direct 是否使用O_DIRECT
+     * @param flush_interval 未写满的缓冲区最长等待时间，毫秒
+     * @param writer 写线程，必须比Appender存活更久，nullptr时使用全局共享的写线程
+     */
+    UringFileLogAppender(const std::string& filename
+                        ,size_t buffer_size = 256 * 1024
+                        ,bool direct = false
+                        ,uint32_t flush_interval = 1000
+                        ,IoUringWriter* writer = nullptr);
+    ~UringFileLogAppender();
+
+    void log(const std::shared_ptr<Logger>& logger
+            ,LogLevel::Level level, const LogEvent::ptr& event) override;
+    void write(const char* data, size_t len) override;
+    /**
+     * @brief 提交当前缓冲区并等待所有写请求完成
+     */
+    void flush() override;
+    /**
+     * @brief 写完缓冲的日志后重新打开日志文件
+     * @return 成功返回true
+     */
+    bool reopen();
+
+    void on_complete(IoRequest* req, ssize_t res) override;
+    void on_tick() override;
+
+    bool is_direct() const { return m_direct; }
+    /**
+     * @brief 已写入文件的字节数，direct模式下包括重写的块
+     */
+    uint64_t get_written() const { return m_written.load(std::memory_order_relaxed); }
+    /**
+     * @brief 失败的写请求数
+     */
+    uint64_t get_errors() const { return m_errors.load(std::memory_order_relaxed); }
+
+private:
+    struct Buffer : public IoRequest {
+        char* data = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        //开头从上一个缓冲区复制过来、已经写过的字节数
+        size_t carry = 0;
+        //超长日志临时申请的缓冲区，完成后释放
+        bool temporary = false;
+    };
+
+    Buffer* new_buffer(size_t capacity);
+    void free_buffer(Buffer* b);
+    /**
+     * @brief 返回至少有len字节空间的写入位置，必要时提交当前缓冲区
+     */
+    char* reserve(size_t len, std::unique_lock<std::mutex>& lock);
+    /**
+     * @brief 提交当前缓冲区
+     * @param wait 没有空闲缓冲区时是否等待
+     * @return 当前缓冲区已更换返回true
+     */
+    bool rotate(std::unique_lock<std::mutex>& lock, bool wait, size_t min_capacity = 0);
+    /**
+     * @brief 提交当前缓冲区中未写的数据，没有空闲缓冲区时等待
+     */
+    void submit_current(std::unique_lock<std::mutex>& lock);
+    void start(Buffer* b);
+    /**
+     * @brief 等待所有写请求完成
+     */
+    void wait_idle(std::unique_lock<std::mutex>& lock);
+    bool open_file();
+
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    size_t m_buffer_size;
+    bool m_direct;
+    uint32_t m_flush_interval;
+    IoUringWriter* m_writer;
+
+    //写入位置，m_current的第一个字节对应的文件偏移
+    uint64_t m_offset = 0;
+    //文件的实际长度
+    uint64_t m_file_size = 0;
+    Buffer* m_current = nullptr;
+    std::vector<Buffer*> m_free;
+    //direct模式下等待前一个请求完成的缓冲区
+    std::deque<Buffer*> m_queue;
+    size_t m_buffer_count = 0;
+    size_t m_inflight = 0;
+    uint64_t m_last_submit = 0;
+    std::condition_variable m_cond;
+
+    std::atomic<uint64_t> m_written{0};
+    std::atomic<uint64_t> m_errors{0};
+};
+
+}
+
+#endif // !__URING_APPENDER_H__
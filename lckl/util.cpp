@@ -0,0 +1,110 @@
+#include "util.h"
+#include "singleton.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lckl {
+
+static uint64_t get_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//程序启动时间
+static const uint64_t s_start_ms = get_monotonic_ms();
+
+namespace detail {
+
+thread_local ThreadContext t_thread_context = {0, 0, -1, nullptr, nullptr};
+
+void init_thread_context(ThreadContext& ctx) {
+    char name[16] = {0};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    ctx.threadname = intern_thread_name(name);
+    ctx.fiberid = 0;
+    ctx.cpu = sched_getcpu();
+    ctx.threadid = syscall(SYS_gettid);
+}
+
+}
+
+namespace {
+
+struct NameTable {
+    std::mutex mutex;
+    std::unordered_set<std::string> names;
+};
+
+NameTable& get_name_table() {
+    //不析构，保证引用的线程名在静态对象析构后依然有效
+    return *Singleton<NameTable>::get_instance();
+}
+
+}
+
+const std::string* intern_thread_name(const std::string& name) {
+    static thread_local const std::string* t_last = nullptr;
+    if (t_last && *t_last == name) {
+        return t_last;
+    }
+    NameTable& table = get_name_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    t_last = &*table.names.insert(name).first;
+    return t_last;
+}
+
+void set_thread_name(const std::string& name) {
+    ThreadContext& ctx = get_thread_context();
+    ctx.threadname = intern_thread_name(name);
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+}
+
+int32_t refresh_cpu_id() {
+    ThreadContext& ctx = get_thread_context();
+    ctx.cpu = sched_getcpu();
+    return ctx.cpu;
+}
+
+uint32_t get_elapse_ms() {
+    return get_monotonic_ms() - s_start_ms;
+}
+
+void LogContext::set_trace_id(std::string_view v) {
+    m_trace_id_len = std::min(v.size(), TRACE_ID_SIZE);
+    memcpy(m_trace_id, v.data(), m_trace_id_len);
+}
+
+LogContext::Local* LogContext::get_local(uint64_t key) const {
+    for (auto& i : m_locals) {
+        if (i.first == key) {
+            return i.second.get();
+        }
+    }
+    return nullptr;
+}
+
+void LogContext::set_local(uint64_t key, std::unique_ptr<Local> local) {
+    for (auto& i : m_locals) {
+        if (i.first == key) {
+            i.second = std::move(local);
+            return;
+        }
+    }
+    m_locals.push_back(std::make_pair(key, std::move(local)));
+}
+
+uint64_t LogContext::new_key() {
+    static std::atomic<uint64_t> s_key{0};
+    return ++s_key;
+}
+
+}
@@ -1,6 +1,188 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
 
+namespace lckl {
 
-#endif // !__UTIL_H__
\ No newline at end of file
+/**
+ * @brief 日志上下文，由协程调度器为每个协程维护一份
+ * @details 调度器切换协程时用set_log_context()发布当前协程的上下文，只是一次线程局部的指针写入。
+ *          创建日志事件时从当前上下文拷贝协程id和跟踪id，不加锁；同一时间只有运行该协程的线程
+ *          访问它，协程换到其他线程后的可见性由调度器的切换保证。
+ *          上下文需要在不再被任何线程发布为当前上下文之后才能析构
+ */
+class LogContext {
+public:
+    //跟踪id的最大长度，超出部分被截断
+    static const size_t TRACE_ID_SIZE = 40;
+
+    /**
+     * @brief 按协程保存的Appender数据，随上下文析构
+     */
+    class Local {
+    public:
+        virtual ~Local() {}
+    };
+
+    LogContext(uint32_t fiberid = 0) : m_fiberid(fiberid) {}
+    LogContext(const LogContext&) = delete;
+    LogContext& operator=(const LogContext&) = delete;
+
+    uint32_t get_fiberid() const { return m_fiberid; }
+    void set_fiberid(uint32_t v) { m_fiberid = v; }
+    /**
+     * @brief 跟踪id，为空表示没有
+     */
+    std::string_view get_trace_id() const { return std::string_view(m_trace_id, m_trace_id_len); }
+    /**
+     * @brief 设置跟踪id，通常在协程开始处理一个请求时调用
+     */
+    void set_trace_id(std::string_view v);
+    void clear_trace_id() { m_trace_id_len = 0; }
+
+    /**
+     * @brief 返回key对应的数据，没有返回nullptr
+     */
+    Local* get_local(uint64_t key) const;
+    /**
+     * @brief 设置key对应的数据，替换已有的数据
+     */
+    void set_local(uint64_t key, std::unique_ptr<Local> local);
+    /**
+     * @brief 分配一个进程内唯一的key
+     */
+    static uint64_t new_key();
+
+private:
+    //协程id
+    uint32_t m_fiberid;
+    uint8_t m_trace_id_len = 0;
+    //跟踪id
+    char m_trace_id[TRACE_ID_SIZE];
+    //按key保存的数据
+    std::vector<std::pair<uint64_t, std::unique_ptr<Local>>> m_locals;
+};
+
+/**
+ * @brief 线程上下文，每个线程一份，第一次使用时初始化
+ * @details 缓存线程id、线程名和协程id，写日志时不再调用gettid或拷贝线程名
+ */
+struct ThreadContext {
+    //线程id，为0表示未初始化
+    pid_t threadid;
+    //协程id，没有日志上下文时使用
+    uint32_t fiberid;
+    //初始化或refresh_cpu_id()时所在的CPU
+    int32_t cpu;
+    //线程名，指向常驻的字符串，线程退出后依然有效
+    const std::string* threadname;
+    //当前协程的日志上下文，为空表示没有
+    LogContext* context;
+};
+
+namespace detail {
+
+extern thread_local ThreadContext t_thread_context;
+void init_thread_context(ThreadContext& ctx);
+
+}
+
+/**
+ * @brief 返回当前线程的上下文
+ */
+inline ThreadContext& get_thread_context() {
+    ThreadContext& ctx = detail::t_thread_context;
+    if (__builtin_expect(ctx.threadid == 0, 0)) {
+        detail::init_thread_context(ctx);
+    }
+    return ctx;
+}
+
+/**
+ * @brief 返回当前线程id
+ */
+inline pid_t get_thread_id() {
+    return get_thread_context().threadid;
+}
+
+/**
+ * @brief 返回当前协程id
+ */
+inline uint32_t get_fiber_id() {
+    const ThreadContext& ctx = get_thread_context();
+    return ctx.context ? ctx.context->get_fiberid() : ctx.fiberid;
+}
+
+/**
+ * @brief 设置当前协程id，有日志上下文时设置到上下文中
+ */
+inline void set_fiber_id(uint32_t id) {
+    ThreadContext& ctx = get_thread_context();
+    if (ctx.context) {
+        ctx.context->set_fiberid(id);
+    } else {
+        ctx.fiberid = id;
+    }
+}
+
+/**
+ * @brief 设置当前线程的日志上下文，协程调度器在切换协程时调用
+ * @details 只写入线程局部的指针，不触发线程上下文的初始化
+ * @param context 切入协程的上下文，切回没有上下文的代码时为nullptr
+ */
+inline void set_log_context(LogContext* context) {
+    detail::t_thread_context.context = context;
+}
+
+/**
+ * @brief 返回当前线程的日志上下文
+ */
+inline LogContext* get_log_context() {
+    return detail::t_thread_context.context;
+}
+
+/**
+ * @brief 返回缓存的CPU编号
+ */
+inline int32_t get_cpu_id() {
+    return get_thread_context().cpu;
+}
+
+/**
+ * @brief 重新获取当前所在的CPU编号
+ */
+int32_t refresh_cpu_id();
+
+/**
+ * @brief 返回当前线程名，默认取自pthread_getname_np
+ */
+inline const std::string& get_thread_name() {
+    return *get_thread_context().threadname;
+}
+
+/**
+ * @brief 设置当前线程名，同时设置系统线程名(最多15个字符)
+ */
+void set_thread_name(const std::string& name);
+
+/**
+ * @brief 返回内容相同的常驻字符串，用于LogEvent引用线程名
+ * @details 字符串保存在不释放的全局表中，同一线程重复查询同一名字时不加锁
+ */
+const std::string* intern_thread_name(const std::string& name);
+
+/**
+ * @brief 返回程序启动以来的毫秒数
+ */
+uint32_t get_elapse_ms();
+
+}
+
+#endif // !__UTIL_H__
@@ -0,0 +1,79 @@
+/**
+ * @brief 把BinaryLogAppender写出的二进制日志还原为文本
+ * @details 用法: lckl_decode [-p pattern] [file ...]
+ *          pattern为LogFormatter模式，默认与Logger相同；不指定文件时读标准输入
+ *          编译: g++ -std=c++17 -O2 -I lckl tools/lckl_decode.cpp lckl/[a-z]*.cpp -pthread -o lckl_decode
+ */
+#include "binary_log.h"
+#include "static_formatter.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string.h>
+
+namespace {
+
+int decode(std::istream& is, const lckl::LogFormatter::ptr& formatter) {
+    lckl::BinaryLogReader reader(is);
+    lckl::BinaryLogReader::Entry entry;
+    //按名字缓存日志器，只用于%c
+    std::map<std::string, lckl::Logger::ptr> loggers;
+    while (reader.next(entry)) {
+        if (entry.raw) {
+            std::cout.write(entry.text.data(), entry.text.size());
+            continue;
+        }
+        auto& logger = loggers[*entry.logger];
+        if (!logger) {
+            logger = std::make_shared<lckl::Logger>(*entry.logger);
+        }
+        lckl::LogEvent event(logger, entry.level, entry.file->c_str(), entry.line
+                            ,entry.elapse, entry.threadid, entry.fiberid
+                            ,entry.time / 1000000, *entry.threadname, entry.time % 1000000);
+        event.set_trace_id(entry.trace_id);
+        lckl::BinaryLogReader::format_message(event.get_ss(), entry);
+        formatter->format(std::cout, logger, entry.level, event);
+    }
+    return reader.is_error() ? 1 : 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string pattern = lckl::DEFAULT_LOG_PATTERN;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            pattern = argv[++i];
+        } else if (!strcmp(argv[i], "-h")) {
+            std::cerr << "usage: " << argv[0] << " [-p pattern] [file ...]" << std::endl;
+            return 0;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    auto formatter = std::make_shared<lckl::LogFormatter>(pattern);
+    if (formatter->is_error()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 2;
+    }
+
+    int rt = 0;
+    if (files.empty()) {
+        rt = decode(std::cin, formatter);
+    }
+    for (auto f : files) {
+        std::ifstream ifs(f, std::ios::binary);
+        if (!ifs) {
+            std::cerr << "open " << f << " failed" << std::endl;
+            rt = 1;
+            continue;
+        }
+        if (decode(ifs, formatter)) {
+            std::cerr << f << ": corrupted or truncated" << std::endl;
+            rt = 1;
+        }
+    }
+    std::cout.flush();
+    return rt;
+}
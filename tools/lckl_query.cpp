@@ -0,0 +1,655 @@
+/**
+ * @brief 按时间范围、级别、日志器和关键字查询文本日志，以及为已有的日志文件生成索引
+ * @details 用法: lckl_query [-j threads] [-s begin] [-e end] [-l level] [-c logger] [-g text]
+ *                          [-d date_format] [-v] file ...
+ *                lckl_query index [-j threads] [-b block_size] [-d date_format] file ...
+ *          begin/end为"YYYY-mm-dd HH:MM:SS"、"YYYY-mm-dd HH:MM"或"@秒级时间戳"，查询范围为[begin, end)，
+ *          -l匹配不低于该级别的日志，-c精确匹配日志器名称，-g匹配消息中的子串。
+ *          文件通过mmap读取；有索引文件(log_index，MmapFileLogAppender写出或由index命令生成)时
+ *          只扫描时间、级别和日志器可能匹配的块，没有索引或索引之后新写入的部分按块顺序扫描。
+ *          各块由多个线程并行扫描，结果按文件内的顺序输出。
+ *          每行开头按date_format(strptime格式，默认"%Y-%m-%d %H:%M:%S")解析时间，不以时间开头的行
+ *          视为上一行的续行；级别和日志器取自行内第一个"[级别]"及其后的"[日志器]"，与默认模板
+ *          "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"一致
+ *          编译: g++ -std=c++17 -O2 -I lckl tools/lckl_query.cpp lckl/[a-z]*.cpp -pthread -o lckl_query
+ */
+#include "log_index.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+//没有索引的部分按此大小切分给各线程
+static const size_t s_scan_chunk = 4 * 1024 * 1024;
+//生成索引时每个线程处理的大小
+static const size_t s_index_chunk = 64 * 1024 * 1024;
+//最多等待输出的块数，限制结果占用的内存
+static const size_t s_max_pending = 256;
+
+/**
+ * @brief 查询条件
+ */
+struct Query {
+    uint64_t begin = 0;
+    uint64_t end = UINT64_MAX;
+    lckl::LogLevel::Level level = lckl::LogLevel::UNKNOWN;
+    std::string logger;
+    std::string text;
+    std::string date_format = "%Y-%m-%d %H:%M:%S";
+
+    bool has_time() const { return begin != 0 || end != UINT64_MAX; }
+};
+
+/**
+ * @brief 在[p, end)中查找needle
+ * @details SSE2下每次比较16个位置的首尾字节，两者都相等的位置再用memcmp确认
+ */
+const char* find_text(const char* p, const char* end, const std::string& needle) {
+    size_t n = needle.size();
+    if (n == 0) {
+        return p;
+    }
+    if ((size_t)(end - p) < n) {
+        return nullptr;
+    }
+    if (n == 1) {
+        return (const char*)memchr(p, needle[0], end - p);
+    }
+    //候选的起始位置在limit之前
+    const char* limit = end - n + 1;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    for (; p + 16 <= limit; p += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            if (memcmp(p + i + 1, needle.data() + 1, n - 2) == 0) {
+                return p + i;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; p < limit; ++p) {
+        if (*p == needle[0] && memcmp(p, needle.data(), n) == 0) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 行首时间的解析器，每个线程一个
+ * @details 同一秒内的行时间文本相同，只在文本变化时调用strptime/mktime
+ */
+class TimeParser {
+public:
+    TimeParser(const std::string& format) : m_format(format) {}
+
+    /**
+     * @brief 解析行首的时间
+     * @param time 返回时间戳，微秒
+     * @return 行不以时间开头返回false
+     */
+    bool parse(const char* p, const char* end, uint64_t& time) {
+        if (m_len && (size_t)(end - p) >= m_len && memcmp(p, m_last, m_len) == 0) {
+            time = m_time;
+            return true;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        char buf[sizeof(m_last)];
+        size_t n = std::min((size_t)(end - p), sizeof(buf) - 1);
+        const char* nl = (const char*)memchr(p, '\n', n);
+        if (nl) {
+            n = nl - p;
+        }
+        memcpy(buf, p, n);
+        buf[n] = 0;
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_isdst = -1;
+        const char* r = strptime(buf, m_format.c_str(), &tm);
+        if (!r) {
+            return false;
+        }
+        time_t t = mktime(&tm);
+        if (t == (time_t)-1) {
+            return false;
+        }
+        m_len = r - buf;
+        memcpy(m_last, buf, m_len);
+        m_time = (uint64_t)t * 1000000;
+        time = m_time;
+        return true;
+    }
+
+private:
+    std::string m_format;
+    //上次解析的时间文本
+    char m_last[64];
+    size_t m_len = 0;
+    uint64_t m_time = 0;
+};
+
+/**
+ * @brief 一条日志，包括其后的续行
+ */
+struct Record {
+    const char* begin;
+    const char* end;
+    //头一行是否以时间开头
+    bool has_time;
+    uint64_t time;
+    lckl::LogLevel::Level level;
+    std::string_view logger;
+};
+
+/**
+ * @brief 按记录遍历一段日志
+ */
+class RecordReader {
+public:
+    RecordReader(const char* begin, const char* end, TimeParser& parser)
+        :m_pos(begin)
+        ,m_end(end)
+        ,m_parser(parser) {
+    }
+
+    /**
+     * @brief 从p开始的记录
+     */
+    void seek(const char* p) { m_pos = p; }
+    bool next(Record& r);
+    /**
+     * @brief 返回p所在记录的开头，不早于begin
+     */
+    const char* record_start(const char* begin, const char* p);
+
+private:
+    const char* line_end(const char* p) const {
+        const char* nl = (const char*)memchr(p, '\n', m_end - p);
+        return nl ? nl + 1 : m_end;
+    }
+    bool is_start(const char* p) {
+        uint64_t t;
+        return m_parser.parse(p, m_end, t);
+    }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+    TimeParser& m_parser;
+};
+
+/**
+ * @brief 取出行内第一个"[级别]"和其后的"[日志器]"
+ */
+void parse_header(const char* p, const char* end, lckl::LogLevel::Level& level, std::string_view& logger) {
+    level = lckl::LogLevel::UNKNOWN;
+    logger = std::string_view();
+    while (p < end) {
+        const char* lb = (const char*)memchr(p, '[', end - p);
+        if (!lb) {
+            return;
+        }
+        const char* rb = (const char*)memchr(lb, ']', end - lb);
+        if (!rb) {
+            return;
+        }
+        std::string_view name(lb + 1, rb - lb - 1);
+        if (level == lckl::LogLevel::UNKNOWN) {
+            for (int i = lckl::LogLevel::DEBUG; i <= lckl::LogLevel::FATAL; ++i) {
+                if (name == lckl::LogLevel::to_string((lckl::LogLevel::Level)i)) {
+                    level = (lckl::LogLevel::Level)i;
+                    break;
+                }
+            }
+        } else {
+            logger = name;
+            return;
+        }
+        p = rb + 1;
+    }
+}
+
+bool RecordReader::next(Record& r) {
+    if (m_pos >= m_end) {
+        return false;
+    }
+    r.begin = m_pos;
+    const char* eol = line_end(m_pos);
+    r.has_time = m_parser.parse(m_pos, eol, r.time);
+    parse_header(m_pos, eol, r.level, r.logger);
+    const char* p = eol;
+    while (p < m_end && !is_start(p)) {
+        p = line_end(p);
+    }
+    r.end = p;
+    m_pos = p;
+    return true;
+}
+
+const char* RecordReader::record_start(const char* begin, const char* p) {
+    for (;;) {
+        const char* nl = p > begin ? (const char*)memrchr(begin, '\n', p - begin) : nullptr;
+        const char* line = nl ? nl + 1 : begin;
+        if (line == begin || is_start(line)) {
+            return line;
+        }
+        p = nl;
+    }
+}
+
+bool match_record(const Query& q, const Record& r) {
+    if (q.has_time() && (!r.has_time || r.time < q.begin || r.time >= q.end)) {
+        return false;
+    }
+    if (q.level != lckl::LogLevel::UNKNOWN && r.level < q.level) {
+        return false;
+    }
+    if (!q.logger.empty() && r.logger != q.logger) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 只读映射的日志文件
+ */
+struct MappedFile {
+    ~MappedFile() {
+        if (data) {
+            munmap((void*)data, map_size);
+        }
+    }
+    bool open(const std::string& p) {
+        path = p;
+        int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        map_size = st.st_size;
+        if (map_size) {
+            void* p = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = p == MAP_FAILED ? nullptr : (const char*)p;
+        }
+        ::close(fd);
+        if (map_size && !data) {
+            return false;
+        }
+        //未正常关闭的MmapFileLogAppender分段末尾留有0字节
+        size = map_size;
+        while (size > 0 && data[size - 1] == 0) {
+            --size;
+        }
+        return true;
+    }
+
+    std::string path;
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t map_size = 0;
+};
+
+/**
+ * @brief 分配给一个线程的一段日志，开头总是一条记录的开头
+ */
+struct Chunk {
+    const MappedFile* file;
+    uint64_t offset;
+    uint64_t size;
+};
+
+/**
+ * @brief 把[offset, size)按记录边界切成约chunk字节的若干段
+ */
+void split(const MappedFile* file, uint64_t offset, size_t chunk, TimeParser& parser, std::vector<Chunk>& out) {
+    RecordReader reader(file->data, file->data + file->size, parser);
+    while (offset < file->size) {
+        uint64_t end = offset + chunk;
+        if (end >= file->size) {
+            end = file->size;
+        } else {
+            //在下一个记录的开头切分
+            const char* p = (const char*)memchr(file->data + end, '\n', file->size - end);
+            const char* start = p ? reader.record_start(file->data + offset, p + 1) : nullptr;
+            while (p && start != p + 1) {
+                p = (const char*)memchr(p + 1, '\n', file->data + file->size - p - 1);
+                start = p ? reader.record_start(file->data + offset, p + 1) : nullptr;
+            }
+            end = p ? p + 1 - file->data : file->size;
+        }
+        out.push_back(Chunk{file, offset, end - offset});
+        offset = end;
+    }
+}
+
+/**
+ * @brief 扫描一段日志，匹配的记录写入out
+ */
+void scan_chunk(const Query& q, const Chunk& c, TimeParser& parser, std::string& out) {
+    const char* begin = c.file->data + c.offset;
+    const char* end = begin + c.size;
+    RecordReader reader(begin, end, parser);
+    Record r;
+    if (q.text.empty()) {
+        while (reader.next(r)) {
+            if (match_record(q, r)) {
+                out.append(r.begin, r.end - r.begin);
+            }
+        }
+        return;
+    }
+    //先找关键字，再检查所在记录
+    const char* p = begin;
+    while ((p = find_text(p, end, q.text)) != nullptr) {
+        reader.seek(reader.record_start(begin, p));
+        if (!reader.next(r)) {
+            break;
+        }
+        if (match_record(q, r)) {
+            out.append(r.begin, r.end - r.begin);
+        }
+        p = r.end;
+    }
+}
+
+/**
+ * @brief 用多个线程依次处理各段，结果按顺序交给output
+ */
+template<class F, class O>
+void run_parallel(size_t threads, size_t count, F&& work, O&& output) {
+    std::vector<std::string> results(count);
+    std::vector<bool> done(count, false);
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t printed = 0;
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= count) {
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return i < printed + s_max_pending; });
+            }
+            std::string out;
+            work(i, out);
+            std::lock_guard<std::mutex> lock(mutex);
+            results[i].swap(out);
+            done[i] = true;
+            cond.notify_all();
+        }
+    };
+    std::vector<std::thread> ts;
+    for (size_t i = 0; i < threads; ++i) {
+        ts.emplace_back(worker);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return (bool)done[i]; });
+            out.swap(results[i]);
+        }
+        output(i, out);
+        std::lock_guard<std::mutex> lock(mutex);
+        printed = i + 1;
+        cond.notify_all();
+    }
+    for (auto& t : ts) {
+        t.join();
+    }
+}
+
+bool parse_time_arg(const char* str, uint64_t& time) {
+    if (str[0] == '@') {
+        time = strtoull(str + 1, nullptr, 10) * 1000000;
+        return true;
+    }
+    static const char* s_formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"};
+    for (auto f : s_formats) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_isdst = -1;
+        const char* r = strptime(str, f, &tm);
+        if (r && *r == 0) {
+            time = (uint64_t)mktime(&tm) * 1000000;
+            return true;
+        }
+    }
+    return false;
+}
+
+int usage(const char* name) {
+    std::cerr << "usage: " << name << " [-j threads] [-s begin] [-e end] [-l level] [-c logger] [-g text]"
+              << " [-d date_format] [-v] file ...\n"
+              << "       " << name << " index [-j threads] [-b block_size] [-d date_format] file ..." << std::endl;
+    return 2;
+}
+
+int query(const Query& q, size_t threads, bool verbose, const std::vector<std::string>& paths) {
+    int rt = 0;
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<Chunk> chunks;
+    uint64_t total_blocks = 0;
+    uint64_t skipped_blocks = 0;
+    TimeParser parser(q.date_format);
+    for (auto& path : paths) {
+        std::unique_ptr<MappedFile> file(new MappedFile);
+        if (!file->open(path)) {
+            std::cerr << "open " << path << " failed" << std::endl;
+            rt = 1;
+            continue;
+        }
+        std::vector<lckl::log_index::Block> blocks;
+        std::vector<Chunk> matched;
+        uint64_t indexed = 0;
+        uint64_t skipped = 0;
+        if (lckl::log_index::load(lckl::log_index::get_index_path(path), blocks)) {
+            for (auto& b : blocks) {
+                if (b.offset != indexed || b.offset + b.size > file->size) {
+                    //索引与文件不符，整个文件按无索引处理
+                    std::cerr << path << ": index does not match, ignored" << std::endl;
+                    blocks.clear();
+                    matched.clear();
+                    indexed = 0;
+                    skipped = 0;
+                    break;
+                }
+                indexed = b.offset + b.size;
+                if ((q.has_time() && !b.match_time(q.begin, q.end))
+                        || (q.level != lckl::LogLevel::UNKNOWN && !b.match_level(q.level))
+                        || (!q.logger.empty() && !b.match_logger(q.logger))) {
+                    ++skipped;
+                    continue;
+                }
+                matched.push_back(Chunk{file.get(), b.offset, b.size});
+            }
+        }
+        total_blocks += blocks.size();
+        skipped_blocks += skipped;
+        chunks.insert(chunks.end(), matched.begin(), matched.end());
+        //索引之后的部分
+        split(file.get(), indexed, s_scan_chunk, parser, chunks);
+        files.push_back(std::move(file));
+    }
+
+    uint64_t scanned = 0;
+    for (auto& c : chunks) {
+        scanned += c.size;
+    }
+    run_parallel(threads, chunks.size(), [&](size_t i, std::string& out) {
+        thread_local std::unique_ptr<TimeParser> t_parser;
+        if (!t_parser) {
+            t_parser.reset(new TimeParser(q.date_format));
+        }
+        scan_chunk(q, chunks[i], *t_parser, out);
+    }, [](size_t i, const std::string& out) {
+        fwrite(out.data(), 1, out.size(), stdout);
+    });
+    fflush(stdout);
+    if (verbose) {
+        uint64_t size = 0;
+        for (auto& f : files) {
+            size += f->size;
+        }
+        std::cerr << "files=" << files.size() << " bytes=" << size << " scanned=" << scanned
+                  << " blocks=" << total_blocks << " skipped=" << skipped_blocks
+                  << " chunks=" << chunks.size() << std::endl;
+    }
+    return rt;
+}
+
+/**
+ * @brief 为一段日志生成块，块从这段的开头重新开始
+ */
+void index_chunk(const Chunk& c, uint32_t block_size, TimeParser& parser, std::vector<lckl::log_index::Block>& out) {
+    const char* begin = c.file->data + c.offset;
+    RecordReader reader(begin, begin + c.size, parser);
+    lckl::log_index::Block b;
+    memset(&b, 0, sizeof(b));
+    b.offset = c.offset;
+    Record r;
+    while (reader.next(r)) {
+        if (b.size >= block_size) {
+            out.push_back(b);
+            memset(&b, 0, sizeof(b));
+            b.offset = r.begin - c.file->data;
+        }
+        b.size += r.end - r.begin;
+        if (r.has_time && r.level != lckl::LogLevel::UNKNOWN && !r.logger.empty()) {
+            b.add(r.time, r.level, r.logger);
+        } else {
+            //不符合模板的文本，查询时不跳过
+            b.add_unknown();
+        }
+    }
+    if (b.size) {
+        out.push_back(b);
+    }
+}
+
+int build_index(const std::string& date_format, uint32_t block_size, size_t threads
+               ,const std::vector<std::string>& paths) {
+    int rt = 0;
+    TimeParser parser(date_format);
+    for (auto& path : paths) {
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cerr << "open " << path << " failed" << std::endl;
+            rt = 1;
+            continue;
+        }
+        std::vector<Chunk> chunks;
+        split(&file, 0, s_index_chunk, parser, chunks);
+        std::vector<lckl::log_index::Block> blocks;
+        run_parallel(threads, chunks.size(), [&](size_t i, std::string& out) {
+            thread_local std::unique_ptr<TimeParser> t_parser;
+            if (!t_parser) {
+                t_parser.reset(new TimeParser(date_format));
+            }
+            std::vector<lckl::log_index::Block> v;
+            index_chunk(chunks[i], block_size, *t_parser, v);
+            out.assign((const char*)v.data(), v.size() * sizeof(v[0]));
+        }, [&](size_t i, const std::string& out) {
+            size_t n = out.size() / sizeof(lckl::log_index::Block);
+            size_t old = blocks.size();
+            blocks.resize(old + n);
+            memcpy((void*)&blocks[old], out.data(), out.size());
+        });
+        if (!lckl::log_index::save(lckl::log_index::get_index_path(path), block_size, blocks)) {
+            std::cerr << "write index of " << path << " failed" << std::endl;
+            rt = 1;
+        }
+    }
+    return rt;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Query q;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t block_size = 64 * 1024;
+    bool verbose = false;
+    bool index = false;
+    std::vector<std::string> files;
+    int i = 1;
+    if (i < argc && !strcmp(argv[i], "index")) {
+        index = true;
+        ++i;
+    }
+    for (; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (!strcmp(arg, "-j") && has_value) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(arg, "-b") && has_value) {
+            block_size = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(arg, "-s") && has_value) {
+            if (!parse_time_arg(argv[++i], q.begin)) {
+                std::cerr << "invalid time: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if (!strcmp(arg, "-e") && has_value) {
+            if (!parse_time_arg(argv[++i], q.end)) {
+                std::cerr << "invalid time: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if (!strcmp(arg, "-l") && has_value) {
+            q.level = lckl::LogLevel::from_string(argv[++i]);
+            if (q.level == lckl::LogLevel::UNKNOWN) {
+                std::cerr << "invalid level: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if (!strcmp(arg, "-c") && has_value) {
+            q.logger = argv[++i];
+        } else if (!strcmp(arg, "-g") && has_value) {
+            q.text = argv[++i];
+        } else if (!strcmp(arg, "-d") && has_value) {
+            q.date_format = argv[++i];
+        } else if (!strcmp(arg, "-v")) {
+            verbose = true;
+        } else if (!strcmp(arg, "-h") || arg[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) {
+        return usage(argv[0]);
+    }
+    if (index) {
+        return build_index(q.date_format, block_size, threads, files);
+    }
+    return query(q, threads, verbose, files);
+}